@@ -4,10 +4,17 @@
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
 
 COMPONENT_SRCDIRS := src
-COMPONENT_OBJS := src/sn76489.o src/panning.o src/ym2612.o
+COMPONENT_OBJS := src/sn76489.o src/panning.o src/ym2612.o src/synth_verify.o
 COMPONENT_ADD_INCLUDEDIRS := src
 
 CFLAGS := -Wno-unused-result
 CFLAGS := -Wno-unused-function
 CFLAGS := -mlongcalls
 CPPFLAGS := -DESP32_SYNTH
+
+# make SYNTH_REFERENCE_KERNELS=1 builds the reference scalar kernels
+# and the differential check in src/synth_verify.c
+ifdef SYNTH_REFERENCE_KERNELS
+CPPFLAGS += -DSYNTH_REFERENCE_KERNELS
+COMPONENT_OBJS += src/sn76489_float.o
+endif
@@ -21,15 +21,54 @@
 */
 
 #include <stdlib.h> // malloc/free
-#include <float.h> // for FLT_MIN
+#include <limits.h> // for INT_MIN
 #include <string.h> // for memcpy
 #include "mamedef.h"
 #include "sn76489.h"
 #include "panning.h"
+#include "statehash.h"
+#include "sn76489_blep.h"
 
 #define NoiseInitialState 0x8000  /* Initial state of shift register */
 #define PSG_CUTOFF        0x6     /* Value below which PSG does not output */
 
+/* Fixed-point timebase: Clock/dClock in Q16 chip clocks, IntermediatePos in Q15 */
+#define PSG_CLOCK_SHIFT   16
+#define PSG_CLOCK_MASK    ((1 << PSG_CLOCK_SHIFT) - 1)
+#define PSG_POS_SHIFT     15
+#define PSG_FLAT          INT_MIN /* IntermediatePos: no antialiasing needed */
+#define PSG_PAN_SHIFT     14      /* Pan and Gain are Q14 */
+#define PSG_PAN_UNIT      (1 << PSG_PAN_SHIFT)
+
+/*
+	Four-lane kernel: the three tone counters and the noise counter sit in
+	one vector. Used where GCC vector extensions map onto SIMD registers
+	(SSE2, NEON), so this is a host-only path: the ESP32 has no SIMD unit
+	and the device always runs the scalar loops. test/bench_sn76489.c
+	times both (make -C test bench).
+*/
+#if ( defined(__SSE2__) || defined(__ARM_NEON) ) && !defined(SN76489_NO_SIMD)
+#define SN76489_SIMD
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+typedef int sn_v4si __attribute__ ((vector_size (16)));
+
+/* Nonzero when any lane is nonzero */
+static inline int sn_v4si_any(sn_v4si v)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_cmpeq_epi32((__m128i)v, _mm_setzero_si128())) != 0xffff;
+#else
+	return v[0] | v[1] | v[2] | v[3];
+#endif
+}
+#endif
+
+/* RegHash slots besides Registers[0..7] */
+#define HASH_LATCH        8
+#define HASH_STEREO       9
+
 static const int PSGVolumeValues[16] = {
 /*	// These values are taken from a real SMS2's output
 	{892,892,892,760,623,497,404,323,257,198,159,123,96,75,60,0}, // I can't remember why 892... :P some scaling I did at some point
@@ -40,44 +79,353 @@ static const int PSGVolumeValues[16] = {
 };
 
 /*static SN76489_Context SN76489[MAX_SN76489];*/
-static SN76489_Context* LastChipInit = NULL;
 //static unsigned short int FNumLimit;
 
 
-SN76489_Context* SN76489_Init( int PSGClockValue, int SamplingRate)
+/*
+	Noise generator.
+
+	Each positive edge of the noise flip-flop shifts the LFSR by one. The
+	shift is linear, so eight shifts of a 16-bit register are two lookups
+	into byte tables. The orbit from NoiseInitialState is a fixed cycle per
+	feedback pattern and width, which lets long jumps be reduced by its
+	period. Tables are built once per configuration and shared by chips;
+	a new table is published with a compare-and-swap, so chips may be
+	configured from several threads at once.
+*/
+
+#define NOISE_JUMP_CACHE  4
+
+typedef struct sn76489_noise_jump
 {
-	int i;
-	SN76489_Context* chip = (SN76489_Context*)malloc(sizeof(SN76489_Context));
-	if(chip)
+	int feedback;
+	int width;
+	unsigned int period[2];       /* periodic, white; 0 when not found */
+	uint16_t jump[2][2][256];     /* periodic/white, low/high byte: state after 8 shifts */
+} sn76489_noise_jump;
+
+static sn76489_noise_jump* NoiseJumpCache[NOISE_JUMP_CACHE];
+
+/* One LFSR shift (the original per-edge code) */
+INLINE int SN76489_NoiseShift(int nsr, int feedback, int width, int white)
+{
+	int Feedback;
+
+	if ( white ) {
+		/* White noise */
+		/* Calculate parity of fed-back bits for feedback */
+		switch (feedback) {
+			/* Do some optimised calculations for common (known) feedback values */
+		case 0x0003: /* SC-3000, BBC %00000011 */
+		case 0x0009: /* SMS, GG, MD  %00001001 */
+			/* If two bits fed back, I can do Feedback=(nsr & fb) && (nsr & fb ^ fb) */
+			/* since that's (one or more bits set) && (not all bits set) */
+			Feedback = ( ( nsr & feedback ) && ( ( nsr & feedback ) ^ feedback ) );
+			break;
+		default:
+			/* Default handler for all other feedback values */
+			/* XOR fold bits into the final bit */
+			Feedback = nsr & feedback;
+			Feedback ^= Feedback >> 8;
+			Feedback ^= Feedback >> 4;
+			Feedback ^= Feedback >> 2;
+			Feedback ^= Feedback >> 1;
+			Feedback &= 1;
+			break;
+		}
+	} else	  /* Periodic noise */
+		Feedback = nsr & 1;
+
+	return ( nsr >> 1 ) | ( Feedback << ( width - 1 ) );
+}
+
+static const sn76489_noise_jump* SN76489_NoiseJumpTables(int feedback, int width)
+{
+	sn76489_noise_jump* t;
+	int white, b, v, i, nsr, start;
+	unsigned int n;
+
+	sn76489_noise_jump* cached;
+
+	for ( i = 0; i < NOISE_JUMP_CACHE; i++ )
 	{
-		chip->dClock=(float)(PSGClockValue & 0x7FFFFFF)/16/SamplingRate;
+		cached = __atomic_load_n(&NoiseJumpCache[i], __ATOMIC_ACQUIRE);
+		if ( cached == NULL )
+			break;
+		if ( cached->feedback == feedback && cached->width == width )
+			return cached;
+	}
+	if ( i == NOISE_JUMP_CACHE || width > 16 )
+		return NULL; /* shift bit by bit */
 
-		SN76489_SetMute(chip, MUTE_ALLON);
-		SN76489_Config(chip, /*MUTE_ALLON,*/ FB_SEGAVDP, SRW_SEGAVDP, 1);
+	t = (sn76489_noise_jump*)malloc(sizeof(sn76489_noise_jump));
+	if ( t == NULL )
+		return NULL;
+	t->feedback = feedback;
+	t->width = width;
 
-		for( i = 0; i <= 3; i++ )
-			centre_panning(chip->panning[i]);
-		//SN76489_Reset(chip);
+	for ( white = 0; white <= 1; white++ )
+	{
+		for ( b = 0; b <= 1; b++ )
+			for ( v = 0; v <= 0xff; v++ )
+			{
+				nsr = v << ( b * 8 );
+				for ( i = 0; i < 8; i++ )
+					nsr = SN76489_NoiseShift(nsr, feedback, width, white);
+				t->jump[white][b][v] = (uint16_t)nsr;
+			}
+
+		/* 16 shifts leave any bits above the width behind, then measure the cycle */
+		start = NoiseInitialState;
+		for ( i = 0; i < 16; i++ )
+			start = SN76489_NoiseShift(start, feedback, width, white);
+		nsr = start;
+		t->period[white] = 0;
+		for ( n = 1; n <= 0x10000; n++ )
+		{
+			nsr = SN76489_NoiseShift(nsr, feedback, width, white);
+			if ( nsr == start )
+			{
+				t->period[white] = n;
+				break;
+			}
+		}
+	}
+
+	/* another thread may have published a table meanwhile */
+	for ( ; i < NOISE_JUMP_CACHE; i++ )
+	{
+		cached = NULL;
+		if ( __atomic_compare_exchange_n(&NoiseJumpCache[i], &cached, t, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) )
+			return t;
+		if ( cached->feedback == feedback && cached->width == width )
+		{
+			free(t);
+			return cached;
+		}
+	}
+	free(t);
+	return NULL;
+}
+
+/* Apply shifts LFSR shifts to nsr */
+static int SN76489_NoiseAdvance(SN76489_Context* chip, int nsr, uint64_t shifts)
+{
+	const sn76489_noise_jump* t = chip->NoiseJump;
+	int white = ( chip->Registers[6] & 0x4 ) ? 1 : 0;
+
+	if ( t != NULL )
+	{
+		if ( shifts > 16 && t->period[white] )
+			shifts = 16 + ( shifts - 16 ) % t->period[white];
+		for ( ; shifts >= 8; shifts -= 8 )
+			nsr = t->jump[white][0][nsr & 0xff] ^ t->jump[white][1][( nsr >> 8 ) & 0xff];
+	}
+	for ( ; shifts > 0; shifts-- )
+		nsr = SN76489_NoiseShift(nsr, chip->WhiteNoiseFeedback, chip->SRWidth, white);
+	return nsr;
+}
+
+/* Catch up on the shifts deferred while the noise channel was silent */
+INLINE void SN76489_NoiseFlush(SN76489_Context* chip)
+{
+	if ( chip->NoiseSkipped )
+	{
+		chip->NoiseShiftRegister = SN76489_NoiseAdvance(chip, chip->NoiseShiftRegister, chip->NoiseSkipped);
+		chip->NoiseSkipped = 0;
+	}
+}
+
+/*
+	Fold mute, volume, GG stereo and panning into per-channel volumes and
+	L/R gains. Called on every change of the inputs, so the mixer doesn't
+	have to branch on them per sample.
+*/
+static void SN76489_UpdateMixer(SN76489_Context* chip)
+{
+	int i;
 
-		if ((PSGClockValue & 0x80000000) && LastChipInit != NULL)
+	/* the noise channel may become audible */
+	SN76489_NoiseFlush(chip);
+
+	chip->Audible = 0;
+	chip->Centred = 1;
+	for( i = 0; i <= 3; i++ )
+	{
+		if ( ( ( chip->PSGStereo >> i ) & 0x11 ) == 0x11 )
 		{
-			// Activate special NeoGeoPocket Mode
-			LastChipInit->NgpFlags = 0x80 | 0x00;
-			chip->NgpFlags = 0x80 | 0x01;
-			chip->NgpChip2 = LastChipInit;
-			LastChipInit->NgpChip2 = chip;
-			LastChipInit = NULL;
+			/* no GG stereo for this channel */
+			chip->Gain[0][i] = chip->Pan[i][0];
+			chip->Gain[1][i] = chip->Pan[i][1];
 		}
 		else
 		{
-			chip->NgpFlags = 0x00;
-			chip->NgpChip2 = NULL;
-			LastChipInit = chip;
+			/* GG stereo overrides panning */
+			chip->Gain[0][i] = ( chip->PSGStereo >> (i+4) & 0x1 ) << PSG_PAN_SHIFT;
+			chip->Gain[1][i] = ( chip->PSGStereo >>  i    & 0x1 ) << PSG_PAN_SHIFT;
 		}
+
+		chip->Volume[i] = 0;
+		if ( ( ( chip->Mute >> i ) & 1 ) && ( chip->Gain[0][i] | chip->Gain[1][i] ) )
+			chip->Volume[i] = PSGVolumeValues[chip->Registers[2 * i + 1] & 0xf];
+		if ( chip->Volume[i] == 0 )
+			continue;
+
+		chip->Audible |= 1 << i;
+		if ( chip->Gain[0][i] != PSG_PAN_UNIT || chip->Gain[1][i] != PSG_PAN_UNIT )
+			chip->Centred = 0;
+	}
+}
+
+/* Unfiltered output of channel i at its current flip-flop state */
+INLINE int SN76489_Level(SN76489_Context* chip, int i)
+{
+	int level;
+
+	if ( i < 3 )
+		return chip->Volume[i] * chip->ToneFreqPos[i];
+
+	level = chip->Volume[3] * (( chip->NoiseShiftRegister & 0x1 ) * 2 - 1);
+	/* due to the way the white noise works here, it seems twice as loud as it should be */
+	if (chip->Registers[6] & 0x4 )
+		level >>= 1;
+	return level;
+}
+
+/* Unfiltered L/R output of all channels */
+static void SN76489_MixLevels(SN76489_Context* chip, int *left, int *right)
+{
+	int i, level;
+
+	*left = *right = 0;
+	for ( i = 0; i <= 3; ++i )
+	{
+		level = SN76489_Level(chip, i);
+		*left  += ( chip->Gain[0][i] * level ) >> PSG_PAN_SHIFT;
+		*right += ( chip->Gain[1][i] * level ) >> PSG_PAN_SHIFT;
 	}
+}
+
+/* Drop pending steps and settle on the current output level */
+static void SN76489_BlepReset(SN76489_Context* chip)
+{
+	memset(chip->BlepRing, 0, sizeof(chip->BlepRing));
+	chip->BlepPos = 0;
+	chip->BlepPending = 0;
+	SN76489_MixLevels(chip, &chip->BlepLevel[0], &chip->BlepLevel[1]);
+	chip->BlepOut[0] = chip->BlepLevel[0];
+	chip->BlepOut[1] = chip->BlepLevel[1];
+}
+
+SN76489_Context* SN76489_Init( int PSGClockValue, int SamplingRate)
+{
+	SN76489_Context* chip = (SN76489_Context*)malloc(sizeof(SN76489_Context));
+	if(chip)
+		SN76489_InitAt(chip, PSGClockValue, SamplingRate);
 	return chip;
 }
 
+SN76489_Context* SN76489_InitAt(void* mem, int PSGClockValue, int SamplingRate)
+{
+	int i;
+	SN76489_Context* chip = (SN76489_Context*)mem;
+	if(chip)
+	{
+		/* rounded, so the pitch error stays below 1/65536 chip clock per sample */
+		chip->dClock=(unsigned int)((((uint64_t)(PSGClockValue & 0x7FFFFFF) << PSG_CLOCK_SHIFT) + 8 * SamplingRate)/16/SamplingRate);
+
+		chip->Quality = QUALITY_INTERPOLATE;
+		chip->NoiseSkipped = 0;
+		chip->NoiseJump = NULL;
+		chip->Mute = MUTE_ALLON;
+		SN76489_Config(chip, /*MUTE_ALLON,*/ FB_SEGAVDP, SRW_SEGAVDP, 1);
+
+		for( i = 0; i <= 3; i++ )
+			chip->Pan[i][0] = chip->Pan[i][1] = PSG_PAN_UNIT;
+
+		/* NeoGeoPocket pairs are set up with SN76489_PairNgp */
+		chip->NgpFlags = 0x00;
+		chip->NgpChip2 = NULL;
+
+		/* the mixer reads the registers, so they are set before it runs */
+		SN76489_Reset(chip);
+	}
+	return chip;
+}
+
+void SN76489_PairNgp(SN76489_Context* chip1, SN76489_Context* chip2)
+{
+	// Activate special NeoGeoPocket Mode
+	/* each chip renders from the partner's state, so no noise shifts may be pending */
+	SN76489_NoiseFlush(chip1);
+	SN76489_NoiseFlush(chip2);
+	chip1->NgpFlags = 0x80 | 0x00;
+	chip2->NgpFlags = 0x80 | 0x01;
+	chip1->NgpChip2 = chip2;
+	chip2->NgpChip2 = chip1;
+}
+
+void SN76489_UnpairNgp(SN76489_Context* chip)
+{
+	SN76489_Context* chip2 = (SN76489_Context*)chip->NgpChip2;
+
+	if (chip2 != NULL)
+	{
+		chip2->NgpFlags = 0x00;
+		chip2->NgpChip2 = NULL;
+	}
+	chip->NgpFlags = 0x00;
+	chip->NgpChip2 = NULL;
+}
+
+/*
+	Chip pool.
+
+	Contexts live in one caller-supplied block followed by a 32-bit in-use
+	flag per slot. Slots are claimed with a compare-and-swap, so chips can
+	be allocated and released from several threads without locks or heap
+	traffic.
+*/
+
+int SN76489_PoolInit(SN76489_Pool* pool, void* mem, size_t size)
+{
+	int i;
+
+	pool->count = (int)(size / (sizeof(SN76489_Context) + sizeof(uint32_t)));
+	pool->chips = (SN76489_Context*)mem;
+	pool->used = (uint32_t*)(pool->chips + pool->count);
+	for( i = 0; i < pool->count; i++ )
+		pool->used[i] = 0;
+	return pool->count;
+}
+
+SN76489_Context* SN76489_PoolAlloc(SN76489_Pool* pool, int PSGClockValue, int SamplingRate)
+{
+	uint32_t expected;
+	int i;
+
+	for( i = 0; i < pool->count; i++ )
+	{
+		expected = 0;
+		if (__atomic_compare_exchange_n(&pool->used[i], &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return SN76489_InitAt(&pool->chips[i], PSGClockValue, SamplingRate);
+	}
+	return NULL;
+}
+
+void SN76489_PoolFree(SN76489_Pool* pool, SN76489_Context* chip)
+{
+	int i;
+
+	if (chip == NULL)
+		return;
+	i = (int)(chip - pool->chips);
+	if (i < 0 || i >= pool->count)
+		return;
+	SN76489_Release(chip);
+	__atomic_store_n(&pool->used[i], 0, __ATOMIC_RELEASE);
+}
+
 void SN76489_Reset(SN76489_Context* chip)
 {
 	int i;
@@ -98,7 +446,10 @@ void SN76489_Reset(SN76489_Context* chip)
 		chip->ToneFreqPos[i] = 1;
 
 		/* Set intermediate positions to do-not-use value */
-		chip->IntermediatePos[i] = FLT_MIN;
+		chip->IntermediatePos[i] = PSG_FLAT;
+
+		/* an NGP partner reads these before this chip renders */
+		chip->Channels[i] = 0;
 
 		/* Set panning to centre */
 		//centre_panning( chip->panning[i] );
@@ -108,21 +459,42 @@ void SN76489_Reset(SN76489_Context* chip)
 
 	/* Initialise noise generator */
 	chip->NoiseShiftRegister = NoiseInitialState;
+	chip->NoiseSkipped = 0;
 
 	/* Zero clock */
 	chip->Clock = 0;
+
+	/* Rebuild the register hash from scratch */
+	chip->RegHash = statehash_entry(HASH_LATCH, chip->LatchedRegister)
+		^ statehash_entry(HASH_STEREO, chip->PSGStereo);
+	for( i = 0; i <= 7; i++ )
+		chip->RegHash ^= statehash_entry(i, chip->Registers[i]);
+
+	SN76489_UpdateMixer(chip);
+	SN76489_BlepReset(chip);
 }
 
+/* for chips from SN76489_Init only */
 void SN76489_Shutdown(SN76489_Context* chip)
 {
+	SN76489_Release(chip);
 	free(chip);
 }
 
+/* for chips from SN76489_InitAt, the memory stays the caller's */
+void SN76489_Release(SN76489_Context* chip)
+{
+	if (chip != NULL)
+		SN76489_UnpairNgp(chip);
+}
+
 void SN76489_Config(SN76489_Context* chip, /*int mute,*/ int feedback, int sr_width, int boost_noise)
 {
 	//chip->Mute = mute;
+	SN76489_NoiseFlush(chip);
 	chip->WhiteNoiseFeedback = feedback;
 	chip->SRWidth = sr_width;
+	chip->NoiseJump = SN76489_NoiseJumpTables(feedback, sr_width);
 }
 
 /*
@@ -148,15 +520,20 @@ int SN76489_GetContextSize(void)
 */
 void SN76489_Write(SN76489_Context* chip, int data)
 {
+	int old_latch = chip->LatchedRegister;
+	int old_value;
+
 	if ( data & 0x80 )
 	{
 		/* Latch/data byte  %1 cc t dddd */
 		chip->LatchedRegister = ( data >> 4 ) & 0x07;
+		old_value = chip->Registers[chip->LatchedRegister];
 		chip->Registers[chip->LatchedRegister] =
 			( chip->Registers[chip->LatchedRegister] & 0x3f0 ) /* zero low 4 bits */
 			| ( data & 0xf );                            /* and replace with data */
 	} else {
 		/* Data byte        %0 - dddddd */
+		old_value = chip->Registers[chip->LatchedRegister];
 		if ( !( chip->LatchedRegister % 2 ) && ( chip->LatchedRegister < 5 ) )
 			/* Tone register */
 			chip->Registers[chip->LatchedRegister] =
@@ -175,18 +552,661 @@ void SN76489_Write(SN76489_Context* chip, int data)
 		break;
 	case 6: /* Noise */
 		chip->NoiseShiftRegister = NoiseInitialState;        /* reset shift register */
+		chip->NoiseSkipped = 0;
 		chip->NoiseFreq = 0x10 << ( chip->Registers[6] & 0x3 ); /* set noise signal generator frequency */
 		break;
 	}
+
+	chip->RegHash = statehash_update(chip->RegHash, HASH_LATCH, old_latch, chip->LatchedRegister);
+	chip->RegHash = statehash_update(chip->RegHash, chip->LatchedRegister,
+		old_value, chip->Registers[chip->LatchedRegister]);
+
+	if ( chip->LatchedRegister & 1 )
+		/* Volume */
+		SN76489_UpdateMixer(chip);
 }
 
 void SN76489_GGStereoWrite(SN76489_Context* chip, int data)
 {
+	chip->RegHash = statehash_update(chip->RegHash, HASH_STEREO, chip->PSGStereo, data);
 	chip->PSGStereo=data;
+	SN76489_UpdateMixer(chip);
+}
+
+/*
+	Per-sample building blocks of SN76489_Update.
+	They are the reference kernel split up, so every path through the
+	update produces exactly the same samples and state.
+*/
+
+/* Advance the sample clock and the channel counters by one output sample */
+INLINE void SN76489_ClockCounters(SN76489_Context* chip)
+{
+	int i;
+
+	/* Increment clock by 1 sample length */
+	chip->Clock += chip->dClock;
+	chip->NumClocksForSample = chip->Clock >> PSG_CLOCK_SHIFT;  /* truncate */
+	chip->Clock &= PSG_CLOCK_MASK;                              /* remove integer part */
+
+	/* Decrement tone channel counters */
+	for ( i = 0; i <= 2; ++i )
+		chip->ToneFreqVals[i] -= chip->NumClocksForSample;
+
+	/* Noise channel: match to tone2 or decrement its counter */
+	if ( chip->NoiseFreq == 0x80 )
+		chip->ToneFreqVals[3] = chip->ToneFreqVals[2];
+	else
+		chip->ToneFreqVals[3] -= chip->NumClocksForSample;
+}
+
+/* Nonzero when any channel counter has run out in this sample */
+INLINE int SN76489_CountersExpired(SN76489_Context* chip)
+{
+	return ( chip->ToneFreqVals[0] <= 0 ) | ( chip->ToneFreqVals[1] <= 0 )
+		| ( chip->ToneFreqVals[2] <= 0 ) | ( chip->ToneFreqVals[3] <= 0 );
+}
+
+/*
+	Fraction of the last sample spent at the old flip-flop level, as
+	(NumClocksForSample - Clock + 2 * counter) / (NumClocksForSample + Clock)
+	in Q15 with the sign of the old level. Only evaluated on a transition.
+*/
+static int SN76489_TransitionPos(SN76489_Context* chip, int i)
+{
+	int64_t num, den;
+
+	/* multiplies rather than shifts, num can be negative */
+	num = (int64_t)( chip->NumClocksForSample + 2 * chip->ToneFreqVals[i] ) * ( 1 << PSG_CLOCK_SHIFT ) - chip->Clock;
+	den = (int64_t)chip->NumClocksForSample * ( 1 << PSG_CLOCK_SHIFT ) + chip->Clock;
+	if ( den <= 0 )
+		return chip->ToneFreqPos[i] * ( 1 << PSG_POS_SHIFT );
+	return (int)( num * ( 1 << PSG_POS_SHIFT ) / den ) * chip->ToneFreqPos[i];
+}
+
+/* Flip the channels whose counters ran out and clock the noise generator */
+INLINE void SN76489_Transitions(SN76489_Context* chip)
+{
+	int i;
+
+	/* Tone channels: */
+	for ( i = 0; i <= 2; ++i ) {
+		if ( chip->ToneFreqVals[i] <= 0 ) {   /* If the counter gets below 0... */
+			if (chip->Registers[i*2]>=PSG_CUTOFF) {
+				/* For tone-generating values, calculate how much of the sample is + and how much is - */
+				/* This is optimised into an even more confusing state than it was in the first place... */
+				chip->IntermediatePos[i] = SN76489_TransitionPos(chip, i);
+				/* Flip the flip-flop */
+				chip->ToneFreqPos[i] = -chip->ToneFreqPos[i];
+			} else {
+				/* stuck value */
+				chip->ToneFreqPos[i] = 1;
+				chip->IntermediatePos[i] = PSG_FLAT;
+			}
+			chip->ToneFreqVals[i] += chip->Registers[i*2] * ( chip->NumClocksForSample / chip->Registers[i*2] + 1 );
+		}
+		else
+			/* signal no antialiasing needed */
+			chip->IntermediatePos[i] = PSG_FLAT;
+	}
+
+	/* Noise channel */
+	if ( chip->ToneFreqVals[3] <= 0 ) {
+		/* If the counter gets below 0... */
+		/* Flip the flip-flop */
+		chip->ToneFreqPos[3] = -chip->ToneFreqPos[3];
+		if (chip->NoiseFreq != 0x80)
+			/* If not matching tone2, decrement counter */
+			chip->ToneFreqVals[3] += chip->NoiseFreq * ( chip->NumClocksForSample / chip->NoiseFreq + 1 );
+		if (chip->ToneFreqPos[3] == 1) {
+			/* On the positive edge of the square wave (only once per cycle) */
+			if ( !( chip->Audible & 0x08 ) && !chip->NgpFlags )
+				/* nobody looks at a silent noise channel, shift later */
+				chip->NoiseSkipped++;
+			else
+				chip->NoiseShiftRegister = SN76489_NoiseShift(chip->NoiseShiftRegister,
+					chip->WhiteNoiseFeedback, chip->SRWidth, chip->Registers[6] & 0x4);
+		}
+	}
+}
+
+/*
+	Mix one output sample. Inaudible channels have a zero volume, so they
+	drop out without a test; centred chips skip the gain multiplies.
+*/
+#ifdef SN76489_SIMD
+INLINE void SN76489_Mix(SN76489_Context* chip, int centred, int *left, int *right)
+{
+	const sn_v4si flat = { PSG_FLAT, PSG_FLAT, PSG_FLAT, PSG_FLAT };
+	sn_v4si volume, pos, ip, interp, c, l, r;
+
+	memcpy(&volume, chip->Volume, sizeof(volume));
+	memcpy(&pos, chip->ToneFreqPos, sizeof(pos));
+	memcpy(&ip, chip->IntermediatePos, sizeof(ip));
+
+	/* lane 3 is the noise channel, which is never antialiased */
+	pos[3] = ( chip->NoiseShiftRegister & 0x1 ) * 2 - 1;
+	ip[3] = PSG_FLAT;
+
+	interp = ip != flat;
+	c = ( ( ( volume * ( ip & interp ) ) >> PSG_POS_SHIFT ) & interp ) | ( volume * pos & ~interp );
+	/* due to the way the white noise works here, it seems twice as loud as it should be */
+	if (chip->Registers[6] & 0x4 )
+		c[3] >>= 1;
+	memcpy(chip->Channels, &c, sizeof(c));
+
+	if ( centred )
+	{
+		*left = *right = c[0] + c[1] + c[2] + c[3];
+		return;
+	}
+
+	memcpy(&l, chip->Gain[0], sizeof(l));
+	memcpy(&r, chip->Gain[1], sizeof(r));
+	l = ( l * c ) >> PSG_PAN_SHIFT;
+	r = ( r * c ) >> PSG_PAN_SHIFT;
+	*left = l[0] + l[1] + l[2] + l[3];
+	*right = r[0] + r[1] + r[2] + r[3];
+}
+#else
+INLINE void SN76489_Mix(SN76489_Context* chip, int centred, int *left, int *right)
+{
+	int i;
+	int l, r;
+
+	/* Tone channels */
+	for ( i = 0; i <= 2; ++i )
+	{
+		if ( chip->IntermediatePos[i] != PSG_FLAT )
+			/* Intermediate position (antialiasing) */
+			chip->Channels[i] = ( chip->Volume[i] * chip->IntermediatePos[i] ) >> PSG_POS_SHIFT;
+		else
+			/* Flat (no antialiasing needed) */
+			chip->Channels[i] = chip->Volume[i] * chip->ToneFreqPos[i];
+	}
+
+	/* Noise channel */
+	chip->Channels[3] = chip->Volume[3] * (( chip->NoiseShiftRegister & 0x1 ) * 2 - 1);
+	/* due to the way the white noise works here, it seems twice as loud as it should be */
+	if (chip->Registers[6] & 0x4 )
+		chip->Channels[3] >>= 1;
+
+	if ( centred )
+	{
+		l = chip->Channels[0] + chip->Channels[1] + chip->Channels[2] + chip->Channels[3];
+		r = l;
+	}
+	else
+	{
+		l = r = 0;
+		for ( i = 0; i <= 3; ++i )
+		{
+			l += ( chip->Gain[0][i] * chip->Channels[i] ) >> PSG_PAN_SHIFT;
+			r += ( chip->Gain[1][i] * chip->Channels[i] ) >> PSG_PAN_SHIFT;
+		}
+	}
+
+	*left = l;
+	*right = r;
+}
+#endif
+
+/*
+	Flat runs. Counters of silent channels run out all the time (a reset
+	tone register of 1 does so every sample), but nothing can be heard
+	from them, so their reloads are done inside the run and only counted.
+	The flip-flops catch up when the run ends.
+*/
+typedef struct
+{
+	int reload[2][4];   /* counter reload for a sample of max_clocks - 1 / max_clocks clocks */
+	int silent[4];      /* -1 for lanes whose transitions can't be heard */
+	int max_clocks;
+} sn76489_flat;
+
+static void SN76489_FlatSetup(SN76489_Context* chip, sn76489_flat* flat)
+{
+	int i, n, reg;
+
+	flat->max_clocks = ( chip->dClock >> PSG_CLOCK_SHIFT ) + 1;
+	for ( i = 0; i <= 3; ++i )
+	{
+		reg = i < 3 ? chip->Registers[i*2] : chip->NoiseFreq;
+		for ( n = 0; n <= 1; n++ )
+			flat->reload[n][i] = reg * ( ( flat->max_clocks - 1 + n ) / reg + 1 );
+		flat->silent[i] = ( ( chip->Audible >> i ) & 1 ) ? 0 : -1;
+	}
+	/* noise matching tone2 isn't reloaded, it copies the tone2 counter */
+	if ( chip->NoiseFreq == 0x80 )
+		flat->reload[0][3] = flat->reload[1][3] = 0;
+}
+
+/* Apply the flip-flop changes of reloads counted during a run */
+static void SN76489_FlatToggles(SN76489_Context* chip, const int *toggles)
+{
+	int i;
+
+	for ( i = 0; i <= 2; ++i )
+	{
+		if ( toggles[i] == 0 )
+			continue;
+		if ( chip->Registers[i*2] < PSG_CUTOFF )
+			chip->ToneFreqPos[i] = 1; /* stuck value */
+		else if ( toggles[i] & 1 )
+			chip->ToneFreqPos[i] = -chip->ToneFreqPos[i];
+	}
+	if ( toggles[3] )
+	{
+		/* one shift per positive edge, deferred since the noise is silent */
+		chip->NoiseSkipped += ( toggles[3] + ( chip->ToneFreqPos[3] == 1 ? 0 : 1 ) ) / 2;
+		if ( toggles[3] & 1 )
+			chip->ToneFreqPos[3] = -chip->ToneFreqPos[3];
+	}
+}
+
+/*
+	Clock samples in which no audible counter runs out, writing the flat
+	value for each. Returns 1 when the counters of a sample with audible
+	(or final) transitions have been clocked, leaving those transitions to
+	the caller, or 0 once the block is full.
+*/
+#ifdef SN76489_SIMD
+INLINE int SN76489_RunFlat(SN76489_Context* chip, const sn76489_flat* flat,
+	int **buffer, int *j, int length, int left, int right)
+{
+	const sn_v4si zero = { 0, 0, 0, 0 };
+	sn_v4si counters, expired, silent, toggles, reload[2];
+	unsigned int clock = chip->Clock;
+	int follow = chip->NoiseFreq == 0x80;
+	int n = *j;
+	int clocks, ret;
+
+	memcpy(&counters, chip->ToneFreqVals, sizeof(counters));
+	memcpy(&silent, flat->silent, sizeof(silent));
+	memcpy(&reload[0], flat->reload[0], sizeof(reload[0]));
+	memcpy(&reload[1], flat->reload[1], sizeof(reload[1]));
+	toggles = zero;
+	for (;;)
+	{
+		clock += chip->dClock;
+		clocks = clock >> PSG_CLOCK_SHIFT;
+		clock &= PSG_CLOCK_MASK;
+
+		counters -= clocks;
+		/* noise matching tone2 */
+		if ( follow )
+			counters[3] = counters[2];
+
+		expired = counters <= zero;
+		if ( sn_v4si_any(expired) )
+		{
+			if ( n == length || sn_v4si_any(expired & ~silent) )
+			{
+				ret = 1;
+				break;
+			}
+			counters += reload[clocks - flat->max_clocks + 1] & expired;
+			toggles -= expired;
+		}
+		if ( n == length )
+		{
+			ret = 0;
+			break;
+		}
+		buffer[0][n] = left;
+		buffer[1][n] = right;
+		n++;
+	}
+	memcpy(chip->ToneFreqVals, &counters, sizeof(counters));
+	chip->Clock = clock;
+	chip->NumClocksForSample = clocks;
+	/* signal no antialiasing needed, transitions set their own */
+	chip->IntermediatePos[0] = PSG_FLAT;
+	chip->IntermediatePos[1] = PSG_FLAT;
+	chip->IntermediatePos[2] = PSG_FLAT;
+	if ( sn_v4si_any(toggles) )
+	{
+		int t[4];
+
+		memcpy(t, &toggles, sizeof(t));
+		SN76489_FlatToggles(chip, t);
+	}
+	*j = n;
+	return ret;
+}
+#else
+INLINE int SN76489_RunFlat(SN76489_Context* chip, const sn76489_flat* flat,
+	int **buffer, int *j, int length, int left, int right)
+{
+	int toggles[4] = { 0, 0, 0, 0 };
+	int i, expired, ret;
+
+	for (;;)
+	{
+		SN76489_ClockCounters(chip);
+		expired = ( chip->ToneFreqVals[0] <= 0 ) | ( ( chip->ToneFreqVals[1] <= 0 ) << 1 )
+			| ( ( chip->ToneFreqVals[2] <= 0 ) << 2 ) | ( ( chip->ToneFreqVals[3] <= 0 ) << 3 );
+		if ( expired )
+		{
+			if ( *j == length || ( expired & chip->Audible ) )
+			{
+				ret = 1;
+				break;
+			}
+			for ( i = 0; i <= 3; ++i )
+				if ( ( expired >> i ) & 1 )
+				{
+					chip->ToneFreqVals[i] += flat->reload[chip->NumClocksForSample - flat->max_clocks + 1][i];
+					toggles[i]++;
+				}
+		}
+
+		if ( *j == length )
+		{
+			ret = 0;
+			break;
+		}
+		buffer[0][*j] = left;
+		buffer[1][*j] = right;
+		(*j)++;
+	}
+
+	/* signal no antialiasing needed, transitions set their own */
+	chip->IntermediatePos[0] = PSG_FLAT;
+	chip->IntermediatePos[1] = PSG_FLAT;
+	chip->IntermediatePos[2] = PSG_FLAT;
+	SN76489_FlatToggles(chip, toggles);
+	return ret;
+}
+#endif
+
+/* Nonzero when no audible tone channel sits on an antialiased transition */
+INLINE int SN76489_IsFlat(SN76489_Context* chip, int audible)
+{
+	int i;
+
+	for ( i = 0; i <= 2; ++i )
+		if ( ( ( audible >> i ) & 1 ) && chip->IntermediatePos[i] != PSG_FLAT )
+			return 0;
+	return 1;
+}
+
+/*
+	Span renderer for a single chip.
+
+	Between transitions the output is constant, so after mixing a flat
+	sample the following samples only advance the clock and the counters
+	and repeat the mixed value. A span ends when a transition changes
+	something audible; transitions of silent channels (volume 0xF, muted,
+	GG stereo off) are applied without leaving the span.
+*/
+INLINE void SN76489_UpdateSpans(SN76489_Context* chip, int **buffer, int length, int centred)
+{
+	int i, j;
+	int audible;
+	int left, right;
+	int pos[4];
+	int nsr;
+	sn76489_flat flat;
+
+	audible = chip->Audible;
+	SN76489_FlatSetup(chip, &flat);
+
+	j = 0;
+	while ( j < length )
+	{
+		SN76489_Mix(chip, centred, &left, &right);
+		buffer[0][j] = left;
+		buffer[1][j] = right;
+		j++;
+
+		if ( ! SN76489_IsFlat(chip, audible) )
+		{
+			SN76489_ClockCounters(chip);
+			SN76489_Transitions(chip);
+			continue;
+		}
+
+		/* Repeat the flat value until an audible transition */
+		for (;;)
+		{
+			if ( ! SN76489_RunFlat(chip, &flat, buffer, &j, length, left, right) )
+				break;
+
+			for ( i = 0; i <= 3; ++i )
+				pos[i] = chip->ToneFreqPos[i];
+			nsr = chip->NoiseShiftRegister;
+
+			SN76489_Transitions(chip);
+
+			if ( ( ( audible >> 3 ) & 1 ) && ( ( nsr ^ chip->NoiseShiftRegister ) & 1 ) )
+				break;
+			for ( i = 0; i <= 2; ++i )
+				if ( ( ( audible >> i ) & 1 )
+					&& ( chip->IntermediatePos[i] != PSG_FLAT || chip->ToneFreqPos[i] != pos[i] ) )
+					break;
+			if ( i <= 2 )
+				break;
+
+			if ( j == length )
+				break;
+			buffer[0][j] = left;
+			buffer[1][j] = right;
+			j++;
+		}
+	}
+}
+
+/* NeoGeo Pocket pair: tone and noise come from different chips */
+static void SN76489_UpdateNgp(SN76489_Context* chip, int **buffer, int length)
+{
+	int i, j;
+	SN76489_Context* chip2;
+	SN76489_Context* chip_t;
+	SN76489_Context* chip_n;
+
+	chip2 = (SN76489_Context*)chip->NgpChip2;
+	if (! ((chip->NgpFlags >> 7) & 0x01))
+	{
+		chip_t = chip_n = chip;
+	}
+	else if (! (chip->NgpFlags & 0x01))
+	{
+		chip_t = chip;
+		chip_n = chip2;
+	}
+	else
+	{
+		chip_t = chip2;
+		chip_n = chip;
+	}
+
+	for( j = 0; j < length; j++ )
+	{
+		/* Tone channels */
+		for ( i = 0; i <= 2; ++i )
+			if ( (chip_t->Mute >> i) & 1 )
+			{
+				if ( chip_t->IntermediatePos[i] != PSG_FLAT )
+					/* Intermediate position (antialiasing) */
+					chip->Channels[i] = ( PSGVolumeValues[chip->Registers[2 * i + 1]] * chip_t->IntermediatePos[i] ) >> PSG_POS_SHIFT;
+				else
+					/* Flat (no antialiasing needed) */
+					chip->Channels[i]= PSGVolumeValues[chip->Registers[2 * i + 1]] * chip_t->ToneFreqPos[i];
+			}
+			else
+				/* Muted channel */
+				chip->Channels[i] = 0;
+
+		/* Noise channel */
+		if ( (chip_t->Mute >> 3) & 1 )
+		{
+			chip->Channels[3] = PSGVolumeValues[chip->Registers[7]] * (( chip_n->NoiseShiftRegister & 0x1 ) * 2 - 1);
+			// due to the way the white noise works here, it seems twice as loud as it should be
+			if (chip->Registers[6] & 0x4 )
+				chip->Channels[3] >>= 1;
+		}
+		else
+			chip->Channels[i] = 0;
+
+		// Build stereo result into buffer
+		buffer[0][j] = 0;
+		buffer[1][j] = 0;
+		if (! (chip->NgpFlags & 0x01))
+		{
+			// For all 3 tone channels
+			for (i = 0; i < 3; i ++)
+			{
+				buffer[0][j] += (chip->PSGStereo >> (i+4) & 0x1 ) * chip ->Channels[i]; // left
+				buffer[1][j] += (chip->PSGStereo >>  i    & 0x1 ) * chip2->Channels[i]; // right
+			}
+		}
+		else
+		{
+			// noise channel
+			i = 3;
+			buffer[0][j] += (chip->PSGStereo >> (i+4) & 0x1 ) * chip2->Channels[i]; // left
+			buffer[1][j] += (chip->PSGStereo >>  i    & 0x1 ) * chip ->Channels[i]; // right
+		}
+
+		SN76489_ClockCounters(chip);
+		SN76489_Transitions(chip);
+	}
+}
+
+/*
+	Band-limited step renderer (QUALITY_BLEP).
+
+	The output is integrated from a ring of pending increments. Every
+	audible flip-flop change adds the step between the old and the new
+	channel level as a band-limited kernel, placed by where in the sample
+	the counter ran out. Between transitions the ring drains and the output
+	stays constant. The output runs BLEP_TAPS / 2 samples late.
+*/
+
+/* Sub-sample position of the transition of channel i, before its counter is reloaded */
+INLINE int SN76489_BlepPhase(SN76489_Context* chip, int i)
+{
+	int64_t num, den;
+	int phase;
+
+	/* fraction (NumClocksForSample + counter) / (NumClocksForSample + Clock) */
+	num = (int64_t)( chip->NumClocksForSample + chip->ToneFreqVals[i] ) * ( 1 << PSG_CLOCK_SHIFT );
+	den = (int64_t)chip->NumClocksForSample * ( 1 << PSG_CLOCK_SHIFT ) + chip->Clock;
+	if ( num <= 0 || den <= 0 )
+		return 0;
+	phase = (int)( num * BLEP_PHASES / den );
+	return phase < BLEP_PHASES ? phase : BLEP_PHASES - 1;
+}
+
+/* Add an L/R step starting with the next output sample */
+static void SN76489_BlepStep(SN76489_Context* chip, int phase, int dl, int dr)
+{
+	const short *kernel = SN76489_BlepTable[phase];
+	int pos = chip->BlepPos;
+	int sl = 0, sr = 0;
+	int i, l, r;
+
+	for ( i = 0; i < BLEP_TAPS - 1; i++ )
+	{
+		l = ( dl * kernel[i] ) >> 15;
+		r = ( dr * kernel[i] ) >> 15;
+		chip->BlepRing[0][( pos + i ) & ( SN76489_BLEP_RING - 1 )] += l;
+		chip->BlepRing[1][( pos + i ) & ( SN76489_BLEP_RING - 1 )] += r;
+		sl += l;
+		sr += r;
+	}
+	/* last tap takes the rounding, so the output settles exactly */
+	chip->BlepRing[0][( pos + i ) & ( SN76489_BLEP_RING - 1 )] += dl - sl;
+	chip->BlepRing[1][( pos + i ) & ( SN76489_BLEP_RING - 1 )] += dr - sr;
+
+	chip->BlepLevel[0] += dl;
+	chip->BlepLevel[1] += dr;
+	chip->BlepPending = BLEP_TAPS;
 }
 
+static void SN76489_UpdateBlep(SN76489_Context* chip, int **buffer, int length)
+{
+	int i, j, pos;
+	int level[4];
+	int phase[4];
+	int left, right, next;
+
+	/* Register writes since the last block become steps at its start */
+	SN76489_MixLevels(chip, &left, &right);
+	if ( left != chip->BlepLevel[0] || right != chip->BlepLevel[1] )
+		SN76489_BlepStep(chip, 0, left - chip->BlepLevel[0], right - chip->BlepLevel[1]);
+
+	for ( i = 0; i <= 3; ++i )
+		level[i] = SN76489_Level(chip, i);
+
+	for ( j = 0; j < length; j++ )
+	{
+		if ( chip->BlepPending )
+		{
+			pos = chip->BlepPos;
+			chip->BlepOut[0] += chip->BlepRing[0][pos];
+			chip->BlepOut[1] += chip->BlepRing[1][pos];
+			chip->BlepRing[0][pos] = 0;
+			chip->BlepRing[1][pos] = 0;
+			chip->BlepPos = ( pos + 1 ) & ( SN76489_BLEP_RING - 1 );
+			chip->BlepPending--;
+		}
+		buffer[0][j] = chip->BlepOut[0];
+		buffer[1][j] = chip->BlepOut[1];
+
+		SN76489_ClockCounters(chip);
+		if ( ! SN76489_CountersExpired(chip) )
+			continue;
+
+		for ( i = 0; i <= 3; ++i )
+			phase[i] = chip->ToneFreqVals[i] <= 0 ? SN76489_BlepPhase(chip, i) : 0;
+
+		SN76489_Transitions(chip);
+
+		for ( i = 0; i <= 3; ++i )
+		{
+			if ( !( ( chip->Audible >> i ) & 1 ) )
+				continue;
+			next = SN76489_Level(chip, i);
+			if ( next == level[i] )
+				continue;
+			SN76489_BlepStep(chip, phase[i],
+				( ( chip->Gain[0][i] * next ) >> PSG_PAN_SHIFT ) - ( ( chip->Gain[0][i] * level[i] ) >> PSG_PAN_SHIFT ),
+				( ( chip->Gain[1][i] * next ) >> PSG_PAN_SHIFT ) - ( ( chip->Gain[1][i] * level[i] ) >> PSG_PAN_SHIFT ));
+			level[i] = next;
+		}
+	}
+}
+
+/*
+	The mixing mode is picked once per block. GG stereo and panning are both
+	plain L/R gains, so only centred chips and NGP pairs get their own path.
+*/
 //void SN76489_Update(SN76489_Context* chip, INT16 **buffer, int length)
 void SN76489_Update(SN76489_Context* chip, int **buffer, int length)
+{
+	if (chip->NgpFlags)
+		SN76489_UpdateNgp(chip, buffer, length);
+	else if (chip->Quality == QUALITY_BLEP)
+		SN76489_UpdateBlep(chip, buffer, length);
+	else if (chip->Centred)
+		SN76489_UpdateSpans(chip, buffer, length, 1);
+	else
+		SN76489_UpdateSpans(chip, buffer, length, 0);
+}
+
+#ifdef SYNTH_REFERENCE_KERNELS
+/*
+	Reference scalar kernel.
+	The original per-sample loop, one sample per iteration, on the chip's
+	current arithmetic (fixed-point Clock, Q14 Pan gains). synth_verify.c
+	compares the span, vector and skip paths of SN76489_Update against it
+	sample by sample. The arithmetic is shared, so its precision is checked
+	separately against the original float core (sn76489_float.c), within
+	a tolerance.
+*/
+void SN76489_Update_Ref(SN76489_Context* chip, int **buffer, int length)
 {
 	int i, j;
 	int NGPMode;
@@ -221,9 +1241,9 @@ void SN76489_Update(SN76489_Context* chip, int **buffer, int length)
 		for ( i = 0; i <= 2; ++i )
 			if ( (chip_t->Mute >> i) & 1 )
 			{
-				if ( chip_t->IntermediatePos[i] != FLT_MIN )
+				if ( chip_t->IntermediatePos[i] != PSG_FLAT )
 					/* Intermediate position (antialiasing) */
-					chip->Channels[i] = (short)( PSGVolumeValues[chip->Registers[2 * i + 1]] * chip_t->IntermediatePos[i] );
+					chip->Channels[i] = ( PSGVolumeValues[chip->Registers[2 * i + 1]] * chip_t->IntermediatePos[i] ) >> PSG_POS_SHIFT;
 				else
 					/* Flat (no antialiasing needed) */
 					chip->Channels[i]= PSGVolumeValues[chip->Registers[2 * i + 1]] * chip_t->ToneFreqPos[i];
@@ -256,16 +1276,8 @@ void SN76489_Update(SN76489_Context* chip, int **buffer, int length)
 				if ( ( ( chip->PSGStereo >> i ) & 0x11 ) == 0x11 )
 				{
 					// no GG stereo for this channel
-					if ( chip->panning[i][0] == 1.0f )
-					{
-						buffer[0][j] += chip->Channels[i]; // left
-						buffer[1][j] += chip->Channels[i]; // right
-					}
-					else
-					{
-						buffer[0][j] += (INT32)( chip->panning[i][0] * chip->Channels[i] ); // left
-						buffer[1][j] += (INT32)( chip->panning[i][1] * chip->Channels[i] ); // right
-					}
+					buffer[0][j] += ( chip->Pan[i][0] * chip->Channels[i] ) >> PSG_PAN_SHIFT; // left
+					buffer[1][j] += ( chip->Pan[i][1] * chip->Channels[i] ) >> PSG_PAN_SHIFT; // right
 				}
 				else
 				{
@@ -297,8 +1309,8 @@ void SN76489_Update(SN76489_Context* chip, int **buffer, int length)
 
 		/* Increment clock by 1 sample length */
 		chip->Clock += chip->dClock;
-		chip->NumClocksForSample = (int)chip->Clock;  /* truncate */
-		chip->Clock -= chip->NumClocksForSample;      /* remove integer part */
+		chip->NumClocksForSample = chip->Clock >> PSG_CLOCK_SHIFT;  /* truncate */
+		chip->Clock &= PSG_CLOCK_MASK;                              /* remove integer part */
 
 		/* Decrement tone channel counters */
 		for ( i = 0; i <= 2; ++i )
@@ -316,19 +1328,19 @@ void SN76489_Update(SN76489_Context* chip, int **buffer, int length)
 				if (chip->Registers[i*2]>=PSG_CUTOFF) {
 					/* For tone-generating values, calculate how much of the sample is + and how much is - */
 					/* This is optimised into an even more confusing state than it was in the first place... */
-					chip->IntermediatePos[i] = ( chip->NumClocksForSample - chip->Clock + 2 * chip->ToneFreqVals[i] ) * chip->ToneFreqPos[i] / ( chip->NumClocksForSample + chip->Clock );
+					chip->IntermediatePos[i] = SN76489_TransitionPos(chip, i);
 					/* Flip the flip-flop */
 					chip->ToneFreqPos[i] = -chip->ToneFreqPos[i];
 				} else {
 					/* stuck value */
 					chip->ToneFreqPos[i] = 1;
-					chip->IntermediatePos[i] = FLT_MIN;
+					chip->IntermediatePos[i] = PSG_FLAT;
 				}
 				chip->ToneFreqVals[i] += chip->Registers[i*2] * ( chip->NumClocksForSample / chip->Registers[i*2] + 1 );
 			}
 			else
 				/* signal no antialiasing needed */
-				chip->IntermediatePos[i] = FLT_MIN;
+				chip->IntermediatePos[i] = PSG_FLAT;
 		}
 
 		/* Noise channel */
@@ -373,6 +1385,7 @@ void SN76489_Update(SN76489_Context* chip, int **buffer, int length)
 		}
 	}
 }
+#endif /* SYNTH_REFERENCE_KERNELS */
 
 /*void SN76489_UpdateOne(SN76489_Context* chip, int *l, int *r)
 {
@@ -392,12 +1405,197 @@ void SN76489_Update(SN76489_Context* chip, int **buffer, int length)
 void SN76489_SetMute(SN76489_Context* chip, int val)
 {
   chip->Mute=val;
+  SN76489_UpdateMixer(chip);
 }
 
 void SN76489_SetPanning(SN76489_Context* chip, int ch0, int ch1, int ch2, int ch3)
 {
-	calc_panning( chip->panning[0], ch0 );
-	calc_panning( chip->panning[1], ch1 );
-	calc_panning( chip->panning[2], ch2 );
-	calc_panning( chip->panning[3], ch3 );
+	int pos[4];
+	float panning[2];
+	int i;
+
+	pos[0] = ch0;
+	pos[1] = ch1;
+	pos[2] = ch2;
+	pos[3] = ch3;
+	for( i = 0; i <= 3; i++ )
+	{
+		calc_panning( panning, pos[i] );
+		chip->Pan[i][0] = (int)( panning[0] * PSG_PAN_UNIT + 0.5f );
+		chip->Pan[i][1] = (int)( panning[1] * PSG_PAN_UNIT + 0.5f );
+	}
+	SN76489_UpdateMixer(chip);
+}
+
+void SN76489_SetQuality(SN76489_Context* chip, int quality)
+{
+	chip->Quality = quality;
+	SN76489_BlepReset(chip);
+}
+
+/*
+	Counter after clocks chip clocks when every reload adds exactly reg,
+	i.e. reg is above the clocks of any one sample. Returns the reloads.
+*/
+INLINE int64_t SN76489_JumpCounter(int *counter, int reg, int64_t clocks)
+{
+	int64_t reloads = 0;
+
+	if ( clocks >= *counter )
+		reloads = ( clocks - *counter ) / reg + 1;
+	*counter = (int)( *counter - clocks + reloads * reg );
+	return reloads;
+}
+
+/*
+	Advance the chip by samples output samples without rendering them, with
+	the same end state as SN76489_Update. A channel whose period is longer
+	than one sample reloads its counter at most once per sample, so its
+	counter and flip-flop jump there in closed form. Stuck and very high
+	channels walk their counter sample by sample, which is still far cheaper
+	than rendering. The noise LFSR jumps by its number of positive edges.
+*/
+void SN76489_Skip(SN76489_Context* chip, int samples)
+{
+	int64_t reloads[4] = { 0, 0, 0, 0 };
+	int64_t clocks;
+	uint64_t end, shifts;
+	unsigned int clock;
+	int reload[4][2];
+	int max_clocks, walk, reg, i, n;
+	int noise_pos;
+
+	if ( samples <= 0 )
+		return;
+
+	/* channels that can reload more than once in a sample */
+	max_clocks = ( chip->dClock >> PSG_CLOCK_SHIFT ) + 1;
+	walk = 0;
+	for ( i = 0; i <= 2; ++i )
+		if ( chip->Registers[i*2] <= max_clocks || chip->Registers[i*2] < PSG_CUTOFF )
+			walk |= 1 << i;
+	if ( chip->NoiseFreq != 0x80 && chip->NoiseFreq <= max_clocks )
+		walk |= 1 << 3;
+
+	/* a sample is max_clocks - 1 or max_clocks clocks, so the reloads are known up front */
+	for ( i = 0; i <= 3; ++i )
+	{
+		reg = i < 3 ? chip->Registers[i*2] : chip->NoiseFreq;
+		reload[i][0] = reg * ( ( max_clocks - 1 ) / reg + 1 );
+		reload[i][1] = reg * ( max_clocks / reg + 1 );
+	}
+
+	/* all but the last sample */
+	clock = chip->Clock;
+	for ( n = 1; n < samples && walk; n++ )
+	{
+		clock += chip->dClock;
+		chip->NumClocksForSample = clock >> PSG_CLOCK_SHIFT;
+		clock &= PSG_CLOCK_MASK;
+		for ( i = 0; i <= 3; ++i )
+		{
+			if ( !( ( walk >> i ) & 1 ) )
+				continue;
+			chip->ToneFreqVals[i] -= chip->NumClocksForSample;
+			if ( chip->ToneFreqVals[i] <= 0 )
+			{
+				chip->ToneFreqVals[i] += reload[i][chip->NumClocksForSample - max_clocks + 1];
+				reloads[i]++;
+			}
+		}
+	}
+
+	end = chip->Clock + (uint64_t)chip->dClock * ( samples - 1 );
+	clocks = (int64_t)( end >> PSG_CLOCK_SHIFT );
+	chip->Clock = (unsigned int)( end & PSG_CLOCK_MASK );
+	for ( i = 0; i <= 3; ++i )
+	{
+		if ( ( walk >> i ) & 1 )
+			continue;
+		if ( i < 3 )
+			reloads[i] = SN76489_JumpCounter(&chip->ToneFreqVals[i], chip->Registers[i*2], clocks);
+		else if ( chip->NoiseFreq != 0x80 )
+			reloads[i] = SN76489_JumpCounter(&chip->ToneFreqVals[i], chip->NoiseFreq, clocks);
+	}
+	if ( chip->NoiseFreq == 0x80 )
+		reloads[3] = reloads[2]; /* noise follows tone 2 */
+
+	for ( i = 0; i <= 2; ++i )
+	{
+		if ( chip->Registers[i*2] < PSG_CUTOFF )
+		{
+			if ( reloads[i] )
+				chip->ToneFreqPos[i] = 1; /* stuck value */
+		}
+		else if ( reloads[i] & 1 )
+			chip->ToneFreqPos[i] = -chip->ToneFreqPos[i];
+	}
+
+	/* one shift per positive edge of the noise flip-flop */
+	noise_pos = chip->ToneFreqPos[3];
+	shifts = (uint64_t)( reloads[3] + ( noise_pos == 1 ? 0 : 1 ) ) / 2 + chip->NoiseSkipped;
+	chip->NoiseSkipped = 0;
+	chip->NoiseShiftRegister = SN76489_NoiseAdvance(chip, chip->NoiseShiftRegister, shifts);
+	if ( reloads[3] & 1 )
+		chip->ToneFreqPos[3] = -noise_pos;
+
+	/* the last sample sets IntermediatePos */
+	SN76489_ClockCounters(chip);
+	SN76489_Transitions(chip);
+
+	if ( chip->Quality == QUALITY_BLEP )
+		/* the skipped output is gone, so is its tail */
+		SN76489_BlepReset(chip);
+}
+
+/*
+	Only what can be heard is hashed, so a loop start with the same sound
+	matches although the counters ran on: the counters and flip-flops of
+	silent channels (their phase can't be heard when they come back in)
+	and the noise register while the noise is silent. The sub-sample Clock
+	fraction is left out too; with an odd dClock it only repeats every
+	65536 samples, and it moves edges by less than a sample. A paired NGP
+	chip hashes everything.
+*/
+uint64_t SN76489_GetStateHash(SN76489_Context* chip)
+{
+	uint64_t hash;
+	int audible;
+	int i;
+
+	SN76489_NoiseFlush(chip);
+	hash = chip->RegHash;
+
+	audible = chip->NgpFlags ? 0x0f : chip->Audible;
+	/* the noise may be clocked by tone 2 */
+	if ( ( audible & 0x08 ) && chip->NoiseFreq == 0x80 )
+		audible |= 0x04;
+	hash = statehash_fold(hash, audible);
+	for ( i = 0; i <= 3; i++ )
+	{
+		if ( !( ( audible >> i ) & 1 ) )
+			continue;
+		hash = statehash_fold(hash, chip->ToneFreqVals[i]);
+		hash = statehash_fold(hash, chip->ToneFreqPos[i]);
+		hash = statehash_fold(hash, chip->IntermediatePos[i]);
+	}
+	if ( audible & 0x08 )
+		hash = statehash_fold(hash, chip->NoiseShiftRegister);
+	hash = statehash_fold(hash, chip->NoiseFreq);
+	hash = statehash_fold(hash, chip->Mute);
+
+	if ( chip->Quality == QUALITY_BLEP )
+	{
+		hash = statehash_fold_array(hash, chip->BlepOut, 2);
+		hash = statehash_fold_array(hash, chip->BlepLevel, 2);
+		hash = statehash_fold(hash, chip->BlepPending);
+		/* slots past BlepPending are always zero */
+		for ( i = 0; i < chip->BlepPending; i++ )
+		{
+			hash = statehash_fold(hash, chip->BlepRing[0][(chip->BlepPos + i) & (SN76489_BLEP_RING - 1)]);
+			hash = statehash_fold(hash, chip->BlepRing[1][(chip->BlepPos + i) & (SN76489_BLEP_RING - 1)]);
+		}
+	}
+
+	return statehash_mix(hash);
 }
@@ -1,6 +1,9 @@
 #ifndef _SN76489_H_
 #define _SN76489_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 // all these defines are defined in mamedef.h, but GCC's #ifdef doesn't seem to know typedefs
 /*#ifndef INT32
 #define INT32 signed long
@@ -41,6 +44,14 @@ enum volume_modes {
     VOL_FULL    =   1,      /* Volume levels 13-15 are unique */
 };
 
+enum quality_modes {
+    QUALITY_INTERPOLATE = 0, /* blend the sample at each transition (default) */
+    QUALITY_BLEP        = 1, /* band-limited steps, see sn76489_blep.h */
+};
+
+#define SN76489_BLEP_RING 32 /* power of two, at least BLEP_TAPS */
+#define SN76489_BLEP_DELAY 8 /* samples QUALITY_BLEP output lags the writes, the kernel centre */
+
 enum mute_values {
     MUTE_ALLOFF =   0,      /* All channels muted */
     MUTE_TONE1  =   1,      /* Tone 1 mute control */
@@ -56,8 +67,8 @@ typedef struct
     int BoostNoise; // double noise volume when non-zero
 
     /* Variables */
-    float Clock;
-    float dClock;
+    unsigned int Clock;       /* fraction of a chip clock, Q16 */
+    unsigned int dClock;      /* chip clocks per output sample, Q16 */
     int PSGStereo;
     int NumClocksForSample;
     int WhiteNoiseFeedback;
@@ -68,23 +79,66 @@ typedef struct
     int LatchedRegister;
     int NoiseShiftRegister;
     int NoiseFreq;            /* Noise channel signal generator frequency */
+    unsigned int NoiseSkipped; /* shifts not applied yet while the noise is silent */
+    const struct sn76489_noise_jump* NoiseJump; /* 8-shift lookup tables, may be NULL */
 
     /* Output calculation variables */
     int ToneFreqVals[4];      /* Frequency register values (counters) */
     int ToneFreqPos[4];        /* Frequency channel flip-flops */
     int Channels[4];          /* Value of each channel, before stereo is applied */
-    float IntermediatePos[4];   /* intermediate values used at boundaries between + and - (does not need double accuracy)*/
+    int IntermediatePos[4];   /* intermediate values used at boundaries between + and - (Q15, INT_MIN when not needed) */
 
-    float panning[4][2];            /* fake stereo */
+    int Pan[4][2];            /* fake stereo, L/R gains in Q14 */
+
+    /* Mixer inputs folded together, updated on register and panning writes */
+    int Volume[4];            /* channel volume, 0 when it can't be heard */
+    int Gain[2][4];           /* L/R gains in Q14, GG stereo applied */
+    int Audible;              /* bit n set when Volume[n] != 0 */
+    int Centred;              /* all audible channels at unit gain */
+
+    /* Band-limited step mode */
+    int Quality;
+    int BlepRing[2][SN76489_BLEP_RING]; /* pending L/R output increments */
+    int BlepPos;
+    int BlepPending;          /* samples until the ring is empty */
+    int BlepOut[2];           /* current L/R output */
+    int BlepLevel[2];         /* L/R output once the ring is empty */
 
 	int NgpFlags;		/* bit 7 - NGP Mode on/off, bit 0 - is 2nd NGP chip */
 	void* NgpChip2;
+
+	uint64_t RegHash;	/* incremental hash of Registers, LatchedRegister and PSGStereo */
 } SN76489_Context;
 
+/* Pool of chip contexts in caller-supplied memory */
+typedef struct
+{
+	SN76489_Context* chips;
+	uint32_t* used;		/* per slot in-use flag, claimed with compare-and-swap */
+	int count;
+} SN76489_Pool;
+
+/* Bytes of pool memory for count chips */
+#define SN76489_POOL_SIZE(count) ((count) * (sizeof(SN76489_Context) + sizeof(uint32_t)))
+
 /* Function prototypes */
 SN76489_Context* SN76489_Init(int PSGClockValue, int SamplingRate);
+/* Init in caller memory of sizeof(SN76489_Context) bytes, nothing to free */
+SN76489_Context* SN76489_InitAt(void* mem, int PSGClockValue, int SamplingRate);
 void SN76489_Reset(SN76489_Context* chip);
+/* Shutdown frees a chip from SN76489_Init; Release only unpairs a chip
+   from SN76489_InitAt, pool chips go back with SN76489_PoolFree */
 void SN76489_Shutdown(SN76489_Context* chip);
+void SN76489_Release(SN76489_Context* chip);
+
+/* NeoGeoPocket mode: chip1 plays the tone channels, chip2 the noise channel */
+void SN76489_PairNgp(SN76489_Context* chip1, SN76489_Context* chip2);
+void SN76489_UnpairNgp(SN76489_Context* chip);
+
+/* mem must be aligned for SN76489_Context; returns the number of slots */
+int SN76489_PoolInit(SN76489_Pool* pool, void* mem, size_t size);
+SN76489_Context* SN76489_PoolAlloc(SN76489_Pool* pool, int PSGClockValue, int SamplingRate);
+void SN76489_PoolFree(SN76489_Pool* pool, SN76489_Context* chip);
 void SN76489_Config(SN76489_Context* chip, /*int mute,*/ int feedback, int sw_width, int boost_noise);
 /*
 void SN76489_SetContext(SN76489_Context* chip, uint8 *data);
@@ -95,12 +149,20 @@ void SN76489_Write(SN76489_Context* chip, int data);
 void SN76489_GGStereoWrite(SN76489_Context* chip, int data);
 //void SN76489_Update(SN76489_Context* chip, INT16 **buffer, int length);
 void SN76489_Update(SN76489_Context* chip, int **buffer, int length);
+void SN76489_Skip(SN76489_Context* chip, int samples);
+#ifdef SYNTH_REFERENCE_KERNELS
+void SN76489_Update_Ref(SN76489_Context* chip, int **buffer, int length);
+#endif
 
 /* Non-standard getters and setters */
 //int  SN76489_GetMute(SN76489_Context* chip);
 void SN76489_SetMute(SN76489_Context* chip, int val);
 
 void SN76489_SetPanning(SN76489_Context* chip, int ch0, int ch1, int ch2, int ch3);
+void SN76489_SetQuality(SN76489_Context* chip, int quality);
+
+/* 64-bit hash of the registers and running counters, cheap enough to read per block */
+uint64_t SN76489_GetStateHash(SN76489_Context* chip);
 
 /* and a non-standard data getter */
 //void SN76489_UpdateOne(SN76489_Context* chip, int *l, int *r);
@@ -0,0 +1,55 @@
+/*
+	sn76489_blep.h
+	Band-limited step kernels for the SN76489 BLEP quality mode.
+
+	Row p is the step response of a Blackman-windowed sinc (cutoff 0.45 fs,
+	8 samples each side) for a transition at (p + 0.5) / 32 of a sample,
+	stored as per-sample increments in Q15. Every row sums to exactly 32768,
+	so the integrated output always settles on the new level.
+	The table is fixed rather than computed at init so the ESP32 and host
+	builds render identical samples.
+*/
+
+#ifndef _SN76489_BLEP_H_
+#define _SN76489_BLEP_H_
+
+#define BLEP_PHASE_BITS   5
+#define BLEP_PHASES       (1 << BLEP_PHASE_BITS)
+#define BLEP_TAPS         17
+
+static const short SN76489_BlepTable[BLEP_PHASES][BLEP_TAPS] = {
+	{ 0, 8, -71, 255, -631, 1228, -2065, 4206, 26276, 5007, -2295, 1308, -653, 257, -69, 7, 0 },
+	{ 0, 9, -72, 251, -605, 1141, -1830, 3435, 26211, 5836, -2515, 1381, -670, 256, -67, 6, 1 },
+	{ 0, 9, -73, 246, -576, 1049, -1591, 2696, 26083, 6690, -2726, 1446, -682, 254, -63, 5, 1 },
+	{ 0, 10, -72, 238, -543, 953, -1351, 1992, 25893, 7566, -2924, 1501, -689, 249, -59, 3, 1 },
+	{ 0, 10, -71, 229, -508, 854, -1110, 1325, 25640, 8460, -3106, 1546, -690, 241, -54, 1, 1 },
+	{ 0, 10, -70, 219, -470, 752, -872, 696, 25326, 9370, -3271, 1580, -686, 231, -47, -1, 1 },
+	{ 0, 10, -68, 207, -431, 648, -638, 107, 24953, 10291, -3416, 1603, -675, 218, -40, -3, 2 },
+	{ 0, 10, -65, 195, -390, 544, -410, -442, 24523, 11220, -3539, 1613, -658, 202, -32, -5, 2 },
+	{ 0, 10, -62, 181, -347, 441, -189, -948, 24037, 12154, -3638, 1609, -635, 184, -23, -8, 2 },
+	{ 0, 9, -59, 167, -304, 338, 24, -1412, 23497, 13088, -3709, 1592, -605, 163, -13, -11, 3 },
+	{ 0, 9, -56, 153, -261, 238, 226, -1833, 22908, 14019, -3752, 1560, -568, 139, -3, -14, 3 },
+	{ 0, 8, -52, 137, -218, 140, 417, -2211, 22272, 14942, -3764, 1513, -525, 113, 9, -17, 4 },
+	{ 0, 8, -48, 122, -176, 46, 596, -2547, 21592, 15854, -3744, 1452, -475, 84, 21, -21, 4 },
+	{ 0, 7, -44, 107, -134, -44, 762, -2839, 20866, 16751, -3688, 1375, -418, 53, 34, -25, 5 },
+	{ 0, 7, -40, 92, -93, -130, 914, -3089, 20106, 17628, -3597, 1282, -355, 19, 48, -29, 5 },
+	{ 0, 6, -36, 77, -54, -210, 1052, -3298, 19308, 18482, -3467, 1175, -286, -17, 62, -32, 6 },
+	{ 0, 6, -32, 62, -17, -286, 1175, -3467, 18482, 19308, -3298, 1052, -210, -54, 77, -36, 6 },
+	{ 0, 5, -29, 48, 19, -355, 1282, -3597, 17628, 20106, -3089, 914, -130, -93, 92, -40, 7 },
+	{ 0, 5, -25, 34, 53, -418, 1375, -3688, 16751, 20866, -2839, 762, -44, -134, 107, -44, 7 },
+	{ 0, 4, -21, 21, 84, -475, 1452, -3744, 15854, 21592, -2547, 596, 46, -176, 122, -48, 8 },
+	{ 0, 4, -17, 9, 113, -525, 1513, -3764, 14942, 22272, -2211, 417, 140, -218, 137, -52, 8 },
+	{ 0, 3, -14, -3, 139, -568, 1560, -3752, 14019, 22908, -1833, 226, 238, -261, 153, -56, 9 },
+	{ 0, 3, -11, -13, 163, -605, 1592, -3709, 13088, 23497, -1412, 24, 338, -304, 167, -59, 9 },
+	{ 0, 2, -8, -23, 184, -635, 1609, -3638, 12154, 24037, -948, -189, 441, -347, 181, -62, 10 },
+	{ 0, 2, -5, -32, 202, -658, 1613, -3539, 11220, 24523, -442, -410, 544, -390, 195, -65, 10 },
+	{ 0, 2, -3, -40, 218, -675, 1603, -3416, 10291, 24953, 107, -638, 648, -431, 207, -68, 10 },
+	{ 0, 1, -1, -47, 231, -686, 1580, -3271, 9370, 25326, 696, -872, 752, -470, 219, -70, 10 },
+	{ 0, 1, 1, -54, 241, -690, 1546, -3106, 8460, 25640, 1325, -1110, 854, -508, 229, -71, 10 },
+	{ 0, 1, 3, -59, 249, -689, 1501, -2924, 7566, 25893, 1992, -1351, 953, -543, 238, -72, 10 },
+	{ 0, 1, 5, -63, 254, -682, 1446, -2726, 6690, 26082, 2696, -1591, 1049, -576, 246, -73, 10 },
+	{ 0, 1, 6, -67, 256, -670, 1381, -2515, 5836, 26211, 3435, -1830, 1141, -605, 251, -72, 9 },
+	{ 0, 0, 7, -69, 257, -653, 1308, -2295, 5007, 26276, 4206, -2065, 1228, -631, 255, -71, 8 },
+};
+
+#endif /* _SN76489_BLEP_H_ */
@@ -0,0 +1,65 @@
+/*
+	sn76489_float.c
+	The original float SN76489 core, kept as a precision reference for
+	synth_verify.c. reference/sn76489.c and reference/sn76489.h are the
+	files as they were before the fixed-point timebase and the integer
+	mixer went in, and must stay untouched; this file only renames their
+	entry points so they link next to the current core.
+*/
+
+#ifdef SYNTH_REFERENCE_KERNELS
+
+#define SN76489_Init            sn76489_float_init
+#define SN76489_Reset           sn76489_float_reset
+#define SN76489_Shutdown        sn76489_float_shutdown
+#define SN76489_Config          sn76489_float_config
+#define SN76489_Write           sn76489_float_write
+#define SN76489_GGStereoWrite   sn76489_float_ggstereo
+#define SN76489_Update          sn76489_float_update
+#define SN76489_SetMute         sn76489_float_setmute
+#define SN76489_SetPanning      sn76489_float_setpanning
+
+#include "reference/sn76489.c"
+
+#include "sn76489_float.h"
+
+void *SN76489Float_Init(int PSGClockValue, int SamplingRate)
+{
+	SN76489_Context *chip = sn76489_float_init(PSGClockValue, SamplingRate);
+
+	if (chip)
+		sn76489_float_reset(chip);
+	return chip;
+}
+
+void SN76489Float_Reset(void *chip)
+{
+	sn76489_float_reset((SN76489_Context *)chip);
+}
+
+void SN76489Float_Shutdown(void *chip)
+{
+	sn76489_float_shutdown((SN76489_Context *)chip);
+}
+
+void SN76489Float_Write(void *chip, int data)
+{
+	sn76489_float_write((SN76489_Context *)chip, data);
+}
+
+void SN76489Float_GGStereoWrite(void *chip, int data)
+{
+	sn76489_float_ggstereo((SN76489_Context *)chip, data);
+}
+
+void SN76489Float_SetPanning(void *chip, int ch0, int ch1, int ch2, int ch3)
+{
+	sn76489_float_setpanning((SN76489_Context *)chip, ch0, ch1, ch2, ch3);
+}
+
+void SN76489Float_Update(void *chip, int **buffer, int length)
+{
+	sn76489_float_update((SN76489_Context *)chip, buffer, length);
+}
+
+#endif /* SYNTH_REFERENCE_KERNELS */
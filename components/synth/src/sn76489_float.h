@@ -0,0 +1,30 @@
+/*
+	sn76489_float.h
+	The original float SN76489 core (reference/sn76489.c) behind an
+	opaque handle, for the precision check in synth_verify.c
+	(build with -DSYNTH_REFERENCE_KERNELS).
+*/
+
+#ifndef _SN76489_FLOAT_H_
+#define _SN76489_FLOAT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef SYNTH_REFERENCE_KERNELS
+/* Init also resets, NULL when out of memory */
+void *SN76489Float_Init(int PSGClockValue, int SamplingRate);
+void SN76489Float_Reset(void *chip);
+void SN76489Float_Shutdown(void *chip);
+void SN76489Float_Write(void *chip, int data);
+void SN76489Float_GGStereoWrite(void *chip, int data);
+void SN76489Float_SetPanning(void *chip, int ch0, int ch1, int ch2, int ch3);
+void SN76489Float_Update(void *chip, int **buffer, int length);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SN76489_FLOAT_H_ */
@@ -0,0 +1,59 @@
+/*
+	statehash.h
+	64-bit hashing helpers for the incremental chip state hashes.
+
+	Registers are hashed as an XOR of one entry per (slot, value) pair, so a
+	register write only has to swap the old entry for the new one. Running
+	counters change every sample and are folded in when the hash is read.
+*/
+
+#ifndef _STATEHASH_H_
+#define _STATEHASH_H_
+
+#include <stdint.h>
+
+/* splitmix64 finaliser */
+static inline uint64_t statehash_mix(uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/* Hash entry of one register slot holding value */
+static inline uint64_t statehash_entry(uint32_t slot, uint32_t value)
+{
+	return statehash_mix(((uint64_t)slot << 32) | value);
+}
+
+/* Replace the entry of slot from old_value to new_value */
+static inline uint64_t statehash_update(uint64_t hash, uint32_t slot, uint32_t old_value, uint32_t new_value)
+{
+	return hash ^ statehash_entry(slot, old_value) ^ statehash_entry(slot, new_value);
+}
+
+/* Fold one counter word into a running hash (FNV-1a style, 32 bits at a time) */
+static inline uint64_t statehash_fold(uint64_t hash, uint32_t value)
+{
+	return (hash ^ value) * 0x100000001b3ULL;
+}
+
+static inline uint64_t statehash_fold_array(uint64_t hash, const int *values, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		hash = statehash_fold(hash, (uint32_t)values[i]);
+	return hash;
+}
+
+/* Combine the hashes of several chips (order dependent) */
+static inline uint64_t statehash_combine(uint64_t hash, uint64_t value)
+{
+	return statehash_mix(hash ^ (value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2)));
+}
+
+#endif /* _STATEHASH_H_ */
@@ -0,0 +1,526 @@
+/*
+	synth_verify.c
+	Differential check of the optimised chip kernels against the
+	reference scalar kernels.
+
+	Both kernels are driven from identical chip states with randomised
+	register writes and block lengths, and the rendered buffers are compared
+	sample by sample. On the first mismatch the diverging sample and the
+	register state that produced it are printed.
+
+	Everything here is plain C without platform dependencies, so the same
+	code runs on the M5Stack (called from setup()) and on a host build of
+	the synth sources.
+*/
+
+#ifdef SYNTH_REFERENCE_KERNELS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sn76489.h"
+#include "sn76489_float.h"
+#include "ym2612.hpp"
+#include "synth_verify.h"
+
+#define VERIFY_BLOCK_MAX    1024
+#define VERIFY_WRITES_MAX   8
+
+#define VERIFY_SN76489_CLOCK    3579545
+#define VERIFY_YM2612_CLOCK     7670453
+#define VERIFY_RATE             44100
+
+/* tolerance against the float SN76489 core, see verify_drift_add() */
+#define VERIFY_DRIFT_SNR        50      /* dB */
+#define VERIFY_DRIFT_SAMPLE     16
+#define VERIFY_DRIFT_OUTLIERS   200     /* per million samples */
+
+static unsigned int verify_state;
+
+static unsigned int verify_rand(void)
+{
+	/* Numerical Recipes LCG, upper bits are the useful ones */
+	verify_state = verify_state * 1664525 + 1013904223;
+	return verify_state >> 8;
+}
+
+static int verify_alloc(int **buf, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		buf[i] = (int *)malloc(VERIFY_BLOCK_MAX * sizeof(int));
+		if (buf[i] == NULL)
+		{
+			printf("verify: buffer alloc fail.\n");
+			while (i--)
+				free(buf[i]);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void verify_free(int **buf, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		free(buf[i]);
+}
+
+/* Return the first diverging sample, or -1 when the blocks are identical */
+static int verify_compare(int **a, int **b, int length)
+{
+	int i;
+
+	for (i = 0; i < length; i++)
+	{
+		if (a[0][i] != b[0][i] || a[1][i] != b[1][i])
+			return i;
+	}
+	return -1;
+}
+
+static void verify_print_writes(const int *writes, int count)
+{
+	int i;
+
+	printf("  writes:");
+	for (i = 0; i < count; i++)
+		printf(" %03x", writes[i]);
+	printf("\n");
+}
+
+/*
+	SN76489
+*/
+
+static void verify_sn76489_report(SN76489_Context *chip, int round, int sample,
+	int **opt, int **ref, const int *writes, int nwrites)
+{
+	int i;
+
+	if (sample >= 0)
+		printf("sn76489 mismatch: round %d sample %d opt (%d, %d) ref (%d, %d)\n",
+			round, sample, opt[0][sample], opt[1][sample], ref[0][sample], ref[1][sample]);
+	else
+		printf("sn76489 mismatch: round %d chip state diverged\n", round);
+	printf("  regs:");
+	for (i = 0; i < 8; i++)
+		printf(" %03x", chip->Registers[i]);
+	printf(" latch %d stereo %02x nsr %04x\n",
+		chip->LatchedRegister, chip->PSGStereo, chip->NoiseShiftRegister);
+	printf("  counters:");
+	for (i = 0; i < 4; i++)
+		printf(" %d/%d", chip->ToneFreqVals[i], chip->ToneFreqPos[i]);
+	printf("\n");
+	verify_print_writes(writes, nwrites);
+}
+
+/*
+	Precision against the original float core. Its float Clock gathers a
+	different rounding error than the Q16 one, so the two drift apart
+	(about 0.004 chip clocks per 1000 samples): antialiased edge values
+	differ a little, and now and then an edge lands a sample early or late.
+	The outputs are never bit exact, so both chips restart in phase for
+	every block, and the check is on the error energy against the signal
+	energy and on how often a sample is off by more than VERIFY_DRIFT_SAMPLE.
+*/
+struct verify_drift
+{
+	double signal;
+	double error;
+	long samples;
+	long outliers;
+	int max_error;
+};
+
+static void verify_drift_add(struct verify_drift *drift, int **ref, int **flt, int length)
+{
+	int i, ch, diff;
+
+	for (i = 0; i < length; i++)
+	{
+		for (ch = 0; ch < 2; ch++)
+		{
+			diff = abs(ref[ch][i] - flt[ch][i]);
+			drift->signal += (double)ref[ch][i] * ref[ch][i];
+			drift->error += (double)diff * diff;
+			if (diff > VERIFY_DRIFT_SAMPLE)
+				drift->outliers++;
+			if (diff > drift->max_error)
+				drift->max_error = diff;
+		}
+		drift->samples += 2;
+	}
+}
+
+/* Both chips from power-on with the registers of chip, clocks in phase */
+static void verify_drift_restart(SN76489_Context *seg_chip, void *flt_chip, const SN76489_Context *chip)
+{
+	int writes[11];
+	int i;
+
+	for (i = 0; i < 3; i++)
+	{
+		writes[i * 3] = 0x80 | (i << 5) | (chip->Registers[i * 2] & 0x0f);
+		writes[i * 3 + 1] = (chip->Registers[i * 2] >> 4) & 0x3f;
+		writes[i * 3 + 2] = 0x90 | (i << 5) | chip->Registers[i * 2 + 1];
+	}
+	writes[9] = 0xe0 | chip->Registers[6];
+	writes[10] = 0xf0 | chip->Registers[7];
+
+	SN76489_Reset(seg_chip);
+	SN76489Float_Reset(flt_chip);
+	for (i = 0; i < 11; i++)
+	{
+		SN76489_Write(seg_chip, writes[i]);
+		SN76489Float_Write(flt_chip, writes[i]);
+	}
+	SN76489_GGStereoWrite(seg_chip, chip->PSGStereo);
+	SN76489Float_GGStereoWrite(flt_chip, chip->PSGStereo);
+}
+
+static int verify_drift_report(const struct verify_drift *drift)
+{
+	double snr = drift->error > 0 ? 10 * log10(drift->signal / drift->error) : 999;
+	double outliers = drift->samples ? 1e6 * drift->outliers / drift->samples : 0;
+	int fail = snr < VERIFY_DRIFT_SNR || outliers > VERIFY_DRIFT_OUTLIERS;
+
+	printf("sn76489 float core: %.1f dB SNR, %.0f ppm samples off by more than %d (max %d)%s\n",
+		snr, outliers, VERIFY_DRIFT_SAMPLE, drift->max_error, fail ? ", FAIL" : "");
+	return fail;
+}
+
+/* The state hash leaves out silent channels, here they have to agree too */
+static int verify_sn76489_same(SN76489_Context *a, SN76489_Context *b)
+{
+	/* reading the hash also brings a skipped noise register up to date */
+	if (SN76489_GetStateHash(a) != SN76489_GetStateHash(b))
+		return 0;
+	return a->Clock == b->Clock && a->NoiseShiftRegister == b->NoiseShiftRegister
+		&& memcmp(a->ToneFreqVals, b->ToneFreqVals, sizeof(a->ToneFreqVals)) == 0
+		&& memcmp(a->ToneFreqPos, b->ToneFreqPos, sizeof(a->ToneFreqPos)) == 0
+		&& memcmp(a->IntermediatePos, b->IntermediatePos, sizeof(a->IntermediatePos)) == 0;
+}
+
+static int verify_sn76489_write(void)
+{
+	unsigned int r = verify_rand();
+
+	switch (r & 7)
+	{
+	case 0:
+		/* GG stereo, flagged with bit 8 */
+		return 0x100 | ((r >> 3) & 0xff);
+	case 1:
+	case 2:
+		/* data byte */
+		return (r >> 3) & 0x7f;
+	default:
+		/* latch byte, keep volumes mostly audible */
+		return 0x80 | ((r >> 3) & 0x7f);
+	}
+}
+
+int synth_verify_sn76489(unsigned int seed, int rounds)
+{
+	SN76489_Pool pool;
+	void *pool_mem;
+	SN76489_Context *opt_chip;
+	SN76489_Context *ref_chip;
+	SN76489_Context *seg_chip;
+	void *flt_chip;
+	int *opt[2];
+	int *ref[2];
+	int *seg[2];
+	int *flt[2];
+	struct verify_drift drift;
+	int writes[VERIFY_WRITES_MAX];
+	int nwrites;
+	int pan[4];
+	int round, i, length, sample;
+	int errors = 0;
+
+	if (!verify_alloc(opt, 2))
+		return 1;
+	if (!verify_alloc(ref, 2))
+	{
+		verify_free(opt, 2);
+		return 1;
+	}
+	if (!verify_alloc(seg, 2))
+	{
+		verify_free(opt, 2);
+		verify_free(ref, 2);
+		return 1;
+	}
+	if (!verify_alloc(flt, 2))
+	{
+		verify_free(opt, 2);
+		verify_free(ref, 2);
+		verify_free(seg, 2);
+		return 1;
+	}
+
+	pool_mem = malloc(SN76489_POOL_SIZE(3));
+	flt_chip = SN76489Float_Init(VERIFY_SN76489_CLOCK, VERIFY_RATE);
+	if (pool_mem == NULL || flt_chip == NULL)
+	{
+		printf("verify: context alloc fail.\n");
+		free(pool_mem);
+		if (flt_chip)
+			SN76489Float_Shutdown(flt_chip);
+		verify_free(opt, 2);
+		verify_free(ref, 2);
+		verify_free(seg, 2);
+		verify_free(flt, 2);
+		return 1;
+	}
+	SN76489_PoolInit(&pool, pool_mem, SN76489_POOL_SIZE(3));
+
+	verify_state = seed;
+	memset(&drift, 0, sizeof(drift));
+	opt_chip = SN76489_PoolAlloc(&pool, VERIFY_SN76489_CLOCK, VERIFY_RATE);
+	ref_chip = SN76489_PoolAlloc(&pool, VERIFY_SN76489_CLOCK, VERIFY_RATE);
+	seg_chip = SN76489_PoolAlloc(&pool, VERIFY_SN76489_CLOCK, VERIFY_RATE);
+	SN76489_Reset(opt_chip);
+	SN76489_Reset(ref_chip);
+
+	for (round = 0; round < rounds; round++)
+	{
+		verify_drift_restart(seg_chip, flt_chip, ref_chip);
+		nwrites = verify_rand() % VERIFY_WRITES_MAX;
+		for (i = 0; i < nwrites; i++)
+		{
+			writes[i] = verify_sn76489_write();
+			if (writes[i] & 0x100)
+			{
+				SN76489_GGStereoWrite(opt_chip, writes[i] & 0xff);
+				SN76489_GGStereoWrite(ref_chip, writes[i] & 0xff);
+				SN76489_GGStereoWrite(seg_chip, writes[i] & 0xff);
+				SN76489Float_GGStereoWrite(flt_chip, writes[i] & 0xff);
+			}
+			else
+			{
+				SN76489_Write(opt_chip, writes[i]);
+				SN76489_Write(ref_chip, writes[i]);
+				SN76489_Write(seg_chip, writes[i]);
+				SN76489Float_Write(flt_chip, writes[i]);
+			}
+		}
+
+		if (verify_rand() % 16 == 0)
+		{
+			/* fake stereo, mostly centred so both mixing paths are hit */
+			for (i = 0; i < 4; i++)
+				pan[i] = (verify_rand() & 1) ? 0 : (int)(verify_rand() % 513) - 256;
+			SN76489_SetPanning(opt_chip, pan[0], pan[1], pan[2], pan[3]);
+			SN76489_SetPanning(ref_chip, pan[0], pan[1], pan[2], pan[3]);
+			SN76489_SetPanning(seg_chip, pan[0], pan[1], pan[2], pan[3]);
+			SN76489Float_SetPanning(flt_chip, pan[0], pan[1], pan[2], pan[3]);
+		}
+
+		length = 1 + verify_rand() % VERIFY_BLOCK_MAX;
+		if (verify_rand() % 8 == 0)
+		{
+			/* fast-forward must end in the rendered state */
+			SN76489_Skip(opt_chip, length);
+			SN76489_Update_Ref(ref_chip, ref, length);
+			memcpy(opt[0], ref[0], length * sizeof(int));
+			memcpy(opt[1], ref[1], length * sizeof(int));
+		}
+		else
+		{
+			SN76489_Update(opt_chip, opt, length);
+			SN76489_Update_Ref(ref_chip, ref, length);
+		}
+
+		SN76489_Update(seg_chip, seg, length);
+		SN76489Float_Update(flt_chip, flt, length);
+		verify_drift_add(&drift, seg, flt, length);
+
+		sample = verify_compare(opt, ref, length);
+		if (sample >= 0 || !verify_sn76489_same(opt_chip, ref_chip))
+		{
+			verify_sn76489_report(ref_chip, round, sample, opt, ref, writes, nwrites);
+			errors++;
+			/* resynchronise so one bug doesn't flood the log */
+			memcpy(opt_chip, ref_chip, sizeof(SN76489_Context));
+		}
+	}
+
+	SN76489_PoolFree(&pool, opt_chip);
+	SN76489_PoolFree(&pool, ref_chip);
+	SN76489_PoolFree(&pool, seg_chip);
+	SN76489Float_Shutdown(flt_chip);
+	free(pool_mem);
+	verify_free(opt, 2);
+	verify_free(ref, 2);
+	verify_free(seg, 2);
+	verify_free(flt, 2);
+
+	printf("sn76489 verify: %d rounds, %d mismatches\n", rounds, errors);
+	return errors + verify_drift_report(&drift);
+}
+
+/*
+	YM2612
+*/
+
+static void verify_ym2612_report(const ym2612_ *ctx, int round, int sample,
+	int **opt, int **ref, const int *writes, int nwrites)
+{
+	int port, reg;
+
+	if (sample >= 0)
+		printf("ym2612 mismatch: round %d sample %d opt (%d, %d) ref (%d, %d)\n",
+			round, sample, opt[0][sample], opt[1][sample], ref[0][sample], ref[1][sample]);
+	else
+		printf("ym2612 mismatch: round %d chip state diverged\n", round);
+
+	for (port = 0; port < 2; port++)
+	{
+		for (reg = 0x20; reg < 0xB8; reg++)
+		{
+			if ((reg & 0x0F) == 0)
+				printf("  %d:%02x", port, reg);
+			if (ctx->REG[port][reg] < 0)
+				printf(" --");
+			else
+				printf(" %02x", ctx->REG[port][reg]);
+			if ((reg & 0x0F) == 0x0F || reg == 0xB7)
+				printf("\n");
+		}
+	}
+	/* port << 16 | reg << 8 | data */
+	printf("  writes:");
+	for (reg = 0; reg < nwrites; reg++)
+		printf(" %05x", writes[reg]);
+	printf("\n");
+}
+
+/* without modulation AMS/FMS stay 0, as the song pre-scan guarantees */
+static int verify_ym2612_write(int modulation)
+{
+	unsigned int r = verify_rand();
+	int port = (r >> 20) & 1;
+	int reg;
+	int data = (r >> 8) & 0xff;
+
+	switch (r & 7)
+	{
+	case 0:
+		/* key on/off */
+		return (0x28 << 8) | data;
+	case 1:
+		/* LFO, ch3 mode, DAC enable */
+		reg = 0x22 + ((r >> 3) & 1) * 5;
+		if ((r >> 4) & 1)
+			reg = 0x2B;
+		return (reg << 8) | data;
+	case 2:
+	case 3:
+		/* channel registers */
+		reg = 0xA0 + ((r >> 3) & 0x17);
+		if (!modulation && reg >= 0xB4)
+			data &= 0xC0;
+		return (port << 16) | (reg << 8) | data;
+	default:
+		/* slot registers */
+		reg = 0x30 + ((r >> 3) % 0x70);
+		return (port << 16) | (reg << 8) | data;
+	}
+}
+
+int synth_verify_ym2612(unsigned int seed, int rounds)
+{
+	ym2612_ *start;
+	ym2612_ *after;
+	int *opt[2];
+	int *ref[2];
+	int writes[VERIFY_WRITES_MAX];
+	int nwrites;
+	int interpolation, modulation, round, i, length, sample;
+	int errors = 0;
+
+	start = (ym2612_ *)malloc(sizeof(ym2612_));
+	after = (ym2612_ *)malloc(sizeof(ym2612_));
+	if (start == NULL || after == NULL)
+	{
+		printf("verify: context alloc fail.\n");
+		free(start);
+		free(after);
+		return 1;
+	}
+	if (!verify_alloc(opt, 2))
+	{
+		free(start);
+		free(after);
+		return 1;
+	}
+	if (!verify_alloc(ref, 2))
+	{
+		verify_free(opt, 2);
+		free(start);
+		free(after);
+		return 1;
+	}
+
+	verify_state = seed;
+
+	/* LFO_Modulation 0 takes the LFO skip, the reference never does */
+	for (modulation = 0; modulation < 2; modulation++)
+	for (interpolation = 0; interpolation < 2; interpolation++)
+	{
+		YM2612_Init(VERIFY_YM2612_CLOCK, VERIFY_RATE, interpolation);
+		LFO_Modulation = modulation;
+
+		for (round = 0; round < rounds / 4; round++)
+		{
+			nwrites = verify_rand() % VERIFY_WRITES_MAX;
+			for (i = 0; i < nwrites; i++)
+			{
+				writes[i] = verify_ym2612_write(modulation);
+				YM2612_Write(0 + ((writes[i] >> 15) & 2), (writes[i] >> 8) & 0xff);
+				YM2612_Write(1 + ((writes[i] >> 15) & 2), writes[i] & 0xff);
+			}
+
+			length = 1 + verify_rand() % VERIFY_BLOCK_MAX;
+			YM2612_GetContext(start);
+
+			YM2612_ClearBuffer(opt, length);
+			YM2612_Update(opt, length);
+			YM2612_GetContext(after);
+
+			YM2612_SetContext(start);
+			YM2612_ClearBuffer(ref, length);
+			YM2612_Update_Ref(ref, length);
+
+			/* registers are not touched by an update, so start can be reused */
+			YM2612_GetContext(start);
+
+			sample = verify_compare(opt, ref, length);
+			if (sample >= 0 || memcmp(after, start, sizeof(ym2612_)) != 0)
+			{
+				verify_ym2612_report(start, round, sample, opt, ref, writes, nwrites);
+				errors++;
+			}
+		}
+	}
+
+	LFO_Modulation = 1;
+	YM2612_End();
+	verify_free(opt, 2);
+	verify_free(ref, 2);
+	free(start);
+	free(after);
+
+	printf("ym2612 verify: %d rounds, %d mismatches\n", rounds, errors);
+	return errors;
+}
+
+#endif /* SYNTH_REFERENCE_KERNELS */
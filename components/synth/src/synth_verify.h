@@ -0,0 +1,24 @@
+/*
+	synth_verify.h
+	Differential check of the optimised chip kernels against the
+	reference scalar kernels (build with -DSYNTH_REFERENCE_KERNELS).
+*/
+
+#ifndef _SYNTH_VERIFY_H_
+#define _SYNTH_VERIFY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef SYNTH_REFERENCE_KERNELS
+/* Return the number of mismatching blocks, 0 when both kernels agree. */
+int synth_verify_sn76489(unsigned int seed, int rounds);
+int synth_verify_ym2612(unsigned int seed, int rounds);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SYNTH_VERIFY_H_ */
@@ -33,6 +33,7 @@
  ***********************************************************/
 
 #include "ym2612.hpp"
+#include "statehash.h"
 
 // C includes.
 #include <stdio.h>
@@ -260,6 +261,7 @@ static int int_cnt;	// Interpolation calculation
 int YM2612_Enable;
 int YM2612_Improv;
 int DAC_Enable = 1;
+int LFO_Modulation = 1;		// 0: no channel is ever modulated, the LFO only counts
 int *YM_Buf[2];
 int YM_Len = 0;
 
@@ -1593,7 +1595,8 @@ int YM2612_Init(int Clock, int Rate, int Interpolation)
 	// [12288 - 16383] = -output  [16384 - ...] = -output overflow (fill with 0)
 
     #ifdef ESP32_SYNTH
-    TL_TAB = (int *)heap_caps_malloc(TL_LENGTH * 2 * sizeof(int), MALLOC_CAP_8BIT);
+    // allocated once, a later init (another clock) refills the same tables
+    if(TL_TAB == NULL) TL_TAB = (int *)heap_caps_malloc(TL_LENGTH * 2 * sizeof(int), MALLOC_CAP_8BIT);
     if(TL_TAB == NULL) printf("TL_TAB alloc error!\n");
     memset(TL_TAB, 0x00, TL_LENGTH * 2 * sizeof(int));
     #endif
@@ -1670,7 +1673,7 @@ int YM2612_Init(int Clock, int Rate, int Interpolation)
 	// ENV_TAB[ENV_LENGTH] -> ENV_TAB[2 * ENV_LENGTH - 1]   = decay curve
 
     #ifdef ESP32_SYNTH
-    ENV_TAB = (unsigned int *)heap_caps_malloc((2 * ENV_LENGTH + 8) * sizeof(unsigned int), MALLOC_CAP_8BIT);
+    if(ENV_TAB == NULL) ENV_TAB = (unsigned int *)heap_caps_malloc((2 * ENV_LENGTH + 8) * sizeof(unsigned int), MALLOC_CAP_8BIT);
     if(ENV_TAB == NULL) printf("ENV_TAB alloc error!\n");
     memset(ENV_TAB, 0x00, (2 * ENV_LENGTH + 8) * sizeof(unsigned int));
     #endif
@@ -1863,10 +1866,13 @@ int YM2612_Reset(void)
 		}
 	}
 
+	YM2612.RegHash = 0;
 	for (i = 0; i < 0x100; i++)
 	{
 		YM2612.REG[0][i] = -1;
 		YM2612.REG[1][i] = -1;
+		YM2612.RegHash ^= statehash_entry(0x000 + i, (uint32_t)-1);
+		YM2612.RegHash ^= statehash_entry(0x100 + i, (uint32_t)-1);
 	}
 
 	for (i = 0xB6; i >= 0xB4; i--)
@@ -1919,6 +1925,15 @@ uint8_t YM2612_Read(void)
 }
 
 
+// Store a register value and keep the incremental register hash in step.
+static inline void REG_SET(int bank, int adr, int data)
+{
+	YM2612.RegHash = statehash_update(YM2612.RegHash, (bank << 8) | adr,
+					  (uint32_t)YM2612.REG[bank][adr], (uint32_t)data);
+	YM2612.REG[bank][adr] = data;
+}
+
+
 /**
  * YM2612_Write(): Write to a YM2612 register.
  * @param adr Address.
@@ -1957,7 +1972,7 @@ int YM2612_Write(unsigned int adr, uint8_t data)
 			{
 				if (YM2612.REG[0][YM2612.OPNAadr] == data)
 					return 2;
-				YM2612.REG[0][YM2612.OPNAadr] = data;
+				REG_SET(0, YM2612.OPNAadr, data);
 
 				// if (GYM_Dumping)
 				// 	gym_dump_update(1, (uint8_t)YM2612.OPNAadr, data);
@@ -1973,7 +1988,7 @@ int YM2612_Write(unsigned int adr, uint8_t data)
 			}
 			else			// YM2612
 			{
-				YM2612.REG[0][YM2612.OPNAadr] = data;
+				REG_SET(0, YM2612.OPNAadr, data);
 
 				// if ((GYM_Dumping) &&
 				//     ((YM2612.OPNAadr == 0x22) ||
@@ -1998,7 +2013,7 @@ int YM2612_Write(unsigned int adr, uint8_t data)
 			{
 				if (YM2612.REG[1][YM2612.OPNBadr] == data)
 					return 2;
-				YM2612.REG[1][YM2612.OPNBadr] = data;
+				REG_SET(1, YM2612.OPNBadr, data);
 
 				// if (GYM_Dumping)
 				// 	gym_dump_update(2, (uint8_t)YM2612.OPNBadr, data);
@@ -2021,7 +2036,7 @@ int YM2612_Write(unsigned int adr, uint8_t data)
 }
 
 
-void YM2612_Update(int **buf, int length)
+static void Update_Chips(int **buf, int length, int lfo_modulation)
 {
 	int i, j, algo_type;
 
@@ -2087,7 +2102,13 @@ void YM2612_Update(int **buf, int length)
 	else
 		algo_type = 16;
 
-	if (YM2612.LFOinc)
+	if (YM2612.LFOinc && !lfo_modulation)
+	{
+		// AMS/FMS 0 everywhere: the LFO kernels would add 0,
+		// keep the counter where the precalcul leaves it
+		YM2612.LFOcnt = (int) ((unsigned int) YM2612.LFOcnt + (unsigned int) YM2612.LFOinc * length);
+	}
+	else if (YM2612.LFOinc)
 	{
 		// Precalcul LFO wav
 
@@ -2122,6 +2143,152 @@ void YM2612_Update(int **buf, int length)
 }
 
 
+void YM2612_Update(int **buf, int length)
+{
+	Update_Chips(buf, length, LFO_Modulation);
+}
+
+
+#ifdef SYNTH_REFERENCE_KERNELS
+// Reference update, as before LFO_Modulation: the LFO is always precalculated
+// and the LFO kernels run whenever it is enabled. The channel kernels are
+// the original Gens ones in both paths.
+void YM2612_Update_Ref(int **buf, int length)
+{
+	Update_Chips(buf, length, 1);
+}
+#endif
+
+
+/**
+ * YM2612_GetContext(): Copy the complete emulator state.
+ * The copy holds pointers into the static rate tables, so it is only
+ * valid inside the running program.
+ * @param ctx Destination.
+ */
+void YM2612_GetContext(ym2612_ *ctx)
+{
+	memcpy(ctx, &YM2612, sizeof(YM2612));
+}
+
+
+/**
+ * YM2612_GetStateHash(): 64-bit hash of the registers and running counters.
+ * The register part is maintained incrementally by YM2612_Write(),
+ * only the counters are folded in here. Counters that can't change what
+ * is heard are left out: the phase of a slot whose release has ended
+ * (it outputs 0 and KEY_ON restarts it from 0) and the LFO counter when
+ * no channel is modulated.
+ * @return State hash.
+ */
+uint64_t YM2612_GetStateHash(void)
+{
+	uint64_t hash = YM2612.RegHash;
+	int i, j;
+
+	hash = statehash_fold(hash, YM2612.status);
+	hash = statehash_fold(hash, YM2612.OPNAadr);
+	hash = statehash_fold(hash, YM2612.OPNBadr);
+	if (LFO_Modulation)
+		hash = statehash_fold(hash, YM2612.LFOcnt);
+	hash = statehash_fold(hash, YM2612.TimerAcnt);
+	hash = statehash_fold(hash, YM2612.TimerBcnt);
+	hash = statehash_fold(hash, YM2612.DACdata);
+	hash = statehash_fold(hash, YM2612.Inter_Cnt);
+
+	for (i = 0; i < 6; i++)
+	{
+		channel_ *CH = &YM2612.CHANNEL[i];
+
+		hash = statehash_fold_array(hash, CH->S0_OUT, 4);
+		hash = statehash_fold(hash, CH->Old_OUTd);
+		hash = statehash_fold(hash, CH->OUTd);
+
+		for (j = 0; j < 4; j++)
+		{
+			slot_ *SL = &CH->SLOT[j];
+
+			if (SL->Ecurp != RELEASE || SL->Ecnt < ENV_END)
+				hash = statehash_fold(hash, SL->Fcnt);
+			hash = statehash_fold(hash, SL->Finc);
+			hash = statehash_fold(hash, SL->Ecurp);
+			hash = statehash_fold(hash, SL->Ecnt);
+			hash = statehash_fold(hash, SL->Einc);
+			hash = statehash_fold(hash, SL->Ecmp);
+			hash = statehash_fold(hash, SL->SEG);
+			hash = statehash_fold(hash, SL->KSR);
+			hash = statehash_fold(hash, SL->ChgEnM);
+		}
+	}
+
+	return statehash_mix(hash);
+}
+
+
+/**
+ * YM2612_SetContext(): Restore a state taken with YM2612_GetContext().
+ * @param ctx Source.
+ */
+void YM2612_SetContext(const ym2612_ *ctx)
+{
+	memcpy(&YM2612, ctx, sizeof(YM2612));
+}
+
+
+/**
+ * YM2612_SaveState(): Copy the complete emulator state without pointers.
+ * The rate table pointers are stored as offsets into the rate tables, so
+ * the copy can be kept on storage and restored by a later run of the same
+ * build at the same clock and sample rate.
+ * @param state Destination.
+ */
+void YM2612_SaveState(ym2612_ *state)
+{
+	const char *base = (const char *)&Rate_Tabs;
+	int i, j;
+
+	memcpy(state, &YM2612, sizeof(YM2612));
+	for (i = 0; i < 6; i++)
+	{
+		for (j = 0; j < 4; j++)
+		{
+			slot_ *SL = &state->CHANNEL[i].SLOT[j];
+			SL->DT = (unsigned int *)(uintptr_t)((const char *)SL->DT - base);
+			SL->AR = (unsigned int *)(uintptr_t)((const char *)SL->AR - base);
+			SL->DR = (unsigned int *)(uintptr_t)((const char *)SL->DR - base);
+			SL->SR = (unsigned int *)(uintptr_t)((const char *)SL->SR - base);
+			SL->RR = (unsigned int *)(uintptr_t)((const char *)SL->RR - base);
+			SL->OUTp = NULL;
+		}
+	}
+}
+
+
+/**
+ * YM2612_LoadState(): Restore a state taken with YM2612_SaveState().
+ * @param state Source.
+ */
+void YM2612_LoadState(const ym2612_ *state)
+{
+	char *base = (char *)&Rate_Tabs;
+	int i, j;
+
+	memcpy(&YM2612, state, sizeof(YM2612));
+	for (i = 0; i < 6; i++)
+	{
+		for (j = 0; j < 4; j++)
+		{
+			slot_ *SL = &YM2612.CHANNEL[i].SLOT[j];
+			SL->DT = (unsigned int *)(base + (uintptr_t)SL->DT);
+			SL->AR = (unsigned int *)(base + (uintptr_t)SL->AR);
+			SL->DR = (unsigned int *)(base + (uintptr_t)SL->DR);
+			SL->SR = (unsigned int *)(base + (uintptr_t)SL->SR);
+			SL->RR = (unsigned int *)(base + (uintptr_t)SL->RR);
+		}
+	}
+}
+
+
 int YM2612_Save(unsigned char SAVE[0x200])
 {
 	int i;
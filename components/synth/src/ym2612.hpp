@@ -126,6 +126,8 @@ typedef struct ym2612__
 
 	int REG[2][0x100];	// Sauvegardes des valeurs de tout les registres, c'est facultatif
 				// cela nous rend le débuggage plus facile
+
+	uint64_t RegHash;	// Incremental hash of REG, see YM2612_GetStateHash()
 } ym2612_;
 
 /* Gens */
@@ -133,6 +135,7 @@ typedef struct ym2612__
 extern int YM2612_Enable;
 extern int YM2612_Improv;
 extern int DAC_Enable;
+extern int LFO_Modulation;
 extern int *YM_Buf[2];
 extern int YM_Len;
 
@@ -144,6 +147,9 @@ int YM2612_Reset(void);
 uint8_t YM2612_Read(void);
 int YM2612_Write(unsigned int adr, uint8_t data);
 void YM2612_Update(int **buf, int length);
+#ifdef SYNTH_REFERENCE_KERNELS
+void YM2612_Update_Ref(int **buf, int length);
+#endif
 
 /* Gens */
 
@@ -154,6 +160,11 @@ int YM2612_Get_Reg(int regID);
 /* Savestate functionality. */
 int YM2612_Save(unsigned char SAVE[0x200]);
 int YM2612_Restore(unsigned char SAVE[0x200]);
+void YM2612_GetContext(ym2612_ *ctx);
+void YM2612_SetContext(const ym2612_ *ctx);
+void YM2612_SaveState(ym2612_ *state);
+void YM2612_LoadState(const ym2612_ *state);
+uint64_t YM2612_GetStateHash(void);
 
 /* GSX v7 savestate functionality. */
 // struct _gsx_v7_ym2612;
@@ -1,3 +1,10 @@
 #!/bin/bash
+# one song is written as it is, several are packed into a VGA archive first
 . ${IDF_PATH}/add_path.sh
-esptool.py --chip esp32 --port "/dev/ttyUSB0" --baud 115200 write_flash -fs 4MB 0x211000 "$1"
+IMAGE="$1"
+if [ $# -gt 1 ]; then
+    IMAGE=build/sound.vga
+    mkdir -p build
+    tools/vga_pack "${IMAGE}" "$@" || exit 1
+fi
+esptool.py --chip esp32 --port "/dev/ttyUSB0" --baud 115200 write_flash -fs 4MB 0x211000 "${IMAGE}"
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include "audio_output.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#include "driver/i2s.h"
+
+#define I2S_PORT I2S_NUM_0
+#endif
+
+static inline int16_t clip(int sample)
+{
+    if(sample < -0x7fff) return -0x7fff;
+    if(sample > 0x7fff) return 0x7fff;
+    return sample;
+}
+
+void audio_frames(int **buffer, int16_t *frames, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+        frames[i * 2 + 0] = clip(buffer[0][i]);
+        frames[i * 2 + 1] = clip(buffer[1][i]);
+    }
+}
+
+void dac_frames(const int16_t *frames, uint16_t *dac, size_t count)
+{
+    for(size_t i = 0; i < count * 2; i++) dac[i] = (uint16_t)frames[i] ^ 0x8000;
+}
+
+#ifdef ESP_PLATFORM
+I2sDacOutput::I2sDacOutput(uint32_t block_frames)
+    : block_frames(block_frames), staging(NULL), installed(false)
+{
+}
+
+I2sDacOutput::~I2sDacOutput()
+{
+    close();
+}
+
+bool I2sDacOutput::open(uint32_t sample_rate)
+{
+    i2s_config_t i2s_config = {
+        .mode = static_cast<i2s_mode_t>(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_DAC_BUILT_IN),
+        .sample_rate = (int)sample_rate,
+        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
+        .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
+        .communication_format = static_cast<i2s_comm_format_t>(I2S_COMM_FORMAT_I2S_MSB),
+        .intr_alloc_flags = 0,
+        .dma_buf_count = 16,
+        .dma_buf_len = 512,
+        .use_apll = false,
+        .tx_desc_auto_clear = true,
+        .fixed_mclk = 0
+    };
+
+    close();
+    // internal RAM, converted every block
+    staging = (uint16_t *)heap_caps_malloc(block_frames * 2 * sizeof(uint16_t), MALLOC_CAP_8BIT);
+    if(staging == NULL) return false;
+    if(i2s_driver_install(I2S_PORT, &i2s_config, 0, NULL) != ESP_OK) {
+        close();
+        return false;
+    }
+    installed = true;
+    i2s_set_pin(I2S_PORT, NULL);
+    return true;
+}
+
+void I2sDacOutput::close()
+{
+    if(installed) i2s_driver_uninstall(I2S_PORT);
+    installed = false;
+    free(staging);
+    staging = NULL;
+}
+
+void I2sDacOutput::write(const int16_t *frames, size_t count)
+{
+    size_t written;
+
+    if(!installed) return;
+    while(count > 0) {
+        size_t length = count < block_frames ? count : block_frames;
+        dac_frames(frames, staging, length);
+        i2s_write(I2S_PORT, staging, length * 2 * sizeof(uint16_t), &written, portMAX_DELAY);
+        write_count++;
+        frame_count += length;
+        frames += length * 2;
+        count -= length;
+    }
+}
+#else
+void HostOutput::write(const int16_t *frames, size_t count)
+{
+    if(file != NULL) fwrite(frames, 2 * sizeof(int16_t), count, file);
+    write_count++;
+    frame_count += count;
+}
+#endif
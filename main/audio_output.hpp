@@ -0,0 +1,91 @@
+#ifndef AUDIO_OUTPUT_HPP
+#define AUDIO_OUTPUT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+//
+// Where the rendered audio goes, a block at a time.
+//
+// The player clips a rendered block into interleaved signed 16-bit stereo
+// frames with audio_frames() (the loop cache records and replays these as
+// they are) and hands the whole block to write(). The driver converts it
+// to what its hardware takes and submits it in one call, rather than one
+// driver call per frame.
+//
+class AudioOutput
+{
+public:
+    virtual ~AudioOutput() {}
+
+    virtual bool open(uint32_t sample_rate) = 0;
+    virtual void close() = 0;
+    // count frames (left, right), returns once all of them are queued
+    virtual void write(const int16_t *frames, size_t count) = 0;
+
+    // driver calls and frames so far
+    uint32_t writes() const { return write_count; }
+    uint64_t frames() const { return frame_count; }
+
+protected:
+    AudioOutput() : write_count(0), frame_count(0) {}
+
+    uint32_t write_count;
+    uint64_t frame_count;
+};
+
+// left and right render buffers to interleaved frames, clipped
+void audio_frames(int **buffer, int16_t *frames, size_t count);
+// count frames to the built-in DAC's offset binary (-32768 is 0x0000,
+// 0 is 0x8000)
+void dac_frames(const int16_t *frames, uint16_t *dac, size_t count);
+
+#ifdef ESP_PLATFORM
+//
+// M5Stack internal DAC (GPIO25) through I2S DMA. A block is converted to
+// the DAC's offset binary in a staging buffer of block_frames and queued
+// with one i2s_write().
+//
+class I2sDacOutput : public AudioOutput
+{
+public:
+    I2sDacOutput(uint32_t block_frames);
+    ~I2sDacOutput();
+
+    bool open(uint32_t sample_rate);
+    void close();
+    void write(const int16_t *frames, size_t count);
+
+private:
+    I2sDacOutput(const I2sDacOutput &);
+    I2sDacOutput &operator=(const I2sDacOutput &);
+
+    uint32_t block_frames;
+    uint16_t *staging;
+    bool installed;
+};
+#else
+//
+// Host stand-in for the DAC: raw 16-bit PCM to a file, or nowhere, with
+// the same counters, so the render path can be run and timed on Linux
+// (test/audio_output_test.cpp).
+//
+class HostOutput : public AudioOutput
+{
+public:
+    HostOutput(FILE *file = NULL) : file(file) {}
+
+    bool open(uint32_t sample_rate) { (void)sample_rate; return true; }
+    void close() {}
+    void write(const int16_t *frames, size_t count);
+
+private:
+    HostOutput(const HostOutput &);
+    HostOutput &operator=(const HostOutput &);
+
+    FILE *file;
+};
+#endif
+
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <string.h>
+#include "audio_pipeline.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+// it mostly sleeps in the driver
+#define OUTPUT_STACK 3072
+
+AudioPipeline::AudioPipeline(AudioOutput *driver, uint32_t block_frames, uint32_t depth, int core, int priority)
+    : driver(driver), block_frames(block_frames), depth(depth), core(core), priority(priority),
+      blocks(NULL), lengths(NULL), filled(0), head(0), tail(0), running(false),
+      producer_waiting(false), consumer_waiting(false), starve_count(0)
+{
+}
+
+AudioPipeline::~AudioPipeline()
+{
+    close();
+}
+
+bool AudioPipeline::open(uint32_t sample_rate)
+{
+    size_t size = (size_t)depth * block_frames * 2 * sizeof(int16_t);
+
+    close();
+    if(!driver->open(sample_rate)) return false;
+#ifdef ESP_PLATFORM
+    // internal RAM, the driver copies every block out of it again
+    blocks = (int16_t *)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+#else
+    blocks = (int16_t *)malloc(size);
+#endif
+    lengths = (uint32_t *)malloc(depth * sizeof(uint32_t));
+    if(blocks == NULL || lengths == NULL) {
+        close();
+        return false;
+    }
+    filled = 0;
+    head = tail = 0;
+    producer_waiting = consumer_waiting = false;
+    starve_count = 0;
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+    if(!task.start("audio_out", output_entry, this, core, priority, OUTPUT_STACK)) {
+        running = false;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void AudioPipeline::close()
+{
+    // the last block is played even when it isn't full
+    if(filled > 0 && __atomic_load_n(&running, __ATOMIC_ACQUIRE)) publish();
+    if(__atomic_exchange_n(&running, false, __ATOMIC_ACQ_REL)) {
+        ready.signal();
+        task.join();
+    }
+    driver->close();
+    free(blocks);
+    free(lengths);
+    blocks = NULL;
+    lengths = NULL;
+    filled = 0;
+}
+
+void AudioPipeline::output_entry(void *self)
+{
+    ((AudioPipeline *)self)->output();
+}
+
+void AudioPipeline::output()
+{
+    uint32_t h;
+    uint32_t slot;
+
+    for(;;) {
+        h = head;
+        if(h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) {
+            __atomic_store_n(&consumer_waiting, true, __ATOMIC_RELAXED);
+            // the flag has to be visible before tail is read again
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if(h != __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) continue;
+            if(!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+                // close() may have queued the last block just before
+                if(h != __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) continue;
+                break;
+            }
+            starve_count++;
+            ready.wait();
+            continue;
+        }
+        __atomic_store_n(&consumer_waiting, false, __ATOMIC_RELAXED);
+
+        slot = h % depth;
+        driver->write(blocks + (size_t)slot * block_frames * 2, lengths[slot]);
+        __atomic_store_n(&head, h + 1, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&producer_waiting, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&producer_waiting, false, __ATOMIC_RELAXED);
+            space.signal();
+        }
+    }
+}
+
+// until the block at tail is free
+void AudioPipeline::wait_space()
+{
+    while(tail - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == depth) {
+        __atomic_store_n(&producer_waiting, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(tail - __atomic_load_n(&head, __ATOMIC_ACQUIRE) != depth) break;
+        space.wait();
+    }
+    __atomic_store_n(&producer_waiting, false, __ATOMIC_RELAXED);
+}
+
+void AudioPipeline::publish()
+{
+    lengths[tail % depth] = filled;
+    filled = 0;
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    write_count++;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&consumer_waiting, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&consumer_waiting, false, __ATOMIC_RELAXED);
+        ready.signal();
+    }
+}
+
+void AudioPipeline::write(const int16_t *frames, size_t count)
+{
+    uint32_t length;
+
+    if(blocks == NULL) return;
+    while(count > 0) {
+        if(filled == 0) wait_space();
+        length = block_frames - filled;
+        if(length > count) length = count;
+        memcpy(blocks + ((size_t)(tail % depth) * block_frames + filled) * 2, frames, length * 2 * sizeof(int16_t));
+        filled += length;
+        frame_count += length;
+        frames += length * 2;
+        count -= length;
+        if(filled == block_frames) publish();
+    }
+}
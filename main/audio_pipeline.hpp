@@ -0,0 +1,79 @@
+#ifndef AUDIO_PIPELINE_HPP
+#define AUDIO_PIPELINE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "audio_output.hpp"
+#include "task.hpp"
+
+//
+// Output on a task of its own, in front of a driver.
+//
+// The renderer's write() copies frames into a ring of depth blocks of
+// block_frames each and returns; a full block is handed to the output task
+// (a FreeRTOS task on the device, a thread on the host), which writes it to
+// the driver and blocks there on the DMA. The renderer only waits when all
+// blocks are queued, so a slow stretch of rendering (a seek, a table
+// rebuild, a burst of PCM) is covered by the blocks in front of it, and
+// small writes between events reach the driver as whole blocks.
+//
+// This doesn't need a second core. On the device both tasks share one;
+// the output task runs at a higher priority, pre-empts the renderer when
+// the DMA has room, and is otherwise asleep.
+//
+// The ring is lock-free between exactly one producer and one consumer, as
+// SpscQueue but with its depth set at run time. Either side only blocks
+// on an Event when the other one has to catch up.
+//
+class AudioPipeline : public AudioOutput
+{
+public:
+    AudioPipeline(AudioOutput *driver, uint32_t block_frames, uint32_t depth, int core, int priority);
+    ~AudioPipeline();
+
+    // opens the driver and starts the output task
+    bool open(uint32_t sample_rate);
+    // plays what is queued, then stops the task and closes the driver
+    void close();
+    void write(const int16_t *frames, size_t count);
+
+    // blocks in the ring, from the next open() on
+    void set_depth(uint32_t depth) { this->depth = depth; }
+
+    // times the output task waited for a block
+    uint32_t starved() const { return starve_count; }
+
+private:
+    AudioPipeline(const AudioPipeline &);
+    AudioPipeline &operator=(const AudioPipeline &);
+
+    static void output_entry(void *self);
+    void output();
+    void publish();
+    void wait_space();
+
+    AudioOutput *driver;
+    uint32_t block_frames;
+    uint32_t depth;
+    int core;
+    int priority;
+
+    int16_t *blocks;
+    uint32_t *lengths;
+    // frames in the block being filled
+    uint32_t filled;
+
+    // shared, atomic: blocks written by the renderer, played by the task
+    uint32_t head;
+    uint32_t tail;
+    bool running;
+    bool producer_waiting;
+    bool consumer_waiting;
+
+    uint32_t starve_count;
+    Event ready;            // a block was queued, or close()
+    Event space;            // a block was played
+    Task task;
+};
+
+#endif
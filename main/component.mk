@@ -6,3 +6,12 @@
 # in the build directory. This behaviour is entirely configurable,
 # please read the ESP-IDF documents if you need to do this.
 #
+
+ifdef SYNTH_REFERENCE_KERNELS
+CPPFLAGS += -DSYNTH_REFERENCE_KERNELS
+endif
+
+# make VGM_STREAM_UART=2 plays live input from that UART
+ifdef VGM_STREAM_UART
+CPPFLAGS += -DVGM_STREAM_UART=$(VGM_STREAM_UART)
+endif
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include "crossfade.hpp"
+
+Crossfade::Crossfade(uint32_t frame_max)
+    : frame_max(frame_max), events(NULL), event_count(0), next(0), state(NULL), live(NULL), psg(NULL),
+      render_psg(false), render_fm(false), render_dac(false), lfo(0), start_time(0), time(0), end_time(0)
+{
+    tail[0] = tail[1] = NULL;
+}
+
+Crossfade::~Crossfade()
+{
+    end();
+}
+
+bool Crossfade::begin(ParseAhead &queue, uint32_t time, uint32_t end_time, SN76489_Context *psg,
+    bool render_psg, bool render_fm, bool render_dac, int lfo)
+{
+    const ChipEvent *event;
+
+    end();
+    // everything left fits the queue, so it fits here
+    events = (ChipEvent *)malloc(PARSE_QUEUE_SIZE * sizeof(ChipEvent));
+    state = (ym2612_ *)malloc(sizeof(ym2612_));
+    live = (ym2612_ *)malloc(sizeof(ym2612_));
+    tail[0] = (int *)malloc(frame_max * sizeof(int));
+    tail[1] = (int *)malloc(frame_max * sizeof(int));
+    if(events == NULL || state == NULL || live == NULL || tail[0] == NULL || tail[1] == NULL) {
+        end();
+        return false;
+    }
+
+    // chip writes only, the old track's markers don't matter any more
+    for(;;) {
+        event = queue.next();
+        if(event->type == EVENT_END) break;
+        if(event->type <= EVENT_GG_STEREO) events[event_count++] = *event;
+        queue.pop();
+    }
+    YM2612_GetContext(state);
+    this->psg = psg;
+    this->render_psg = render_psg;
+    this->render_fm = render_fm;
+    this->render_dac = render_dac;
+    this->lfo = lfo;
+    this->start_time = time;
+    this->time = time;
+    this->end_time = end_time;
+    return true;
+}
+
+void Crossfade::render(uint32_t offset, uint32_t length)
+{
+    int *buffer[2] = { tail[0] + offset, tail[1] + offset };
+
+    if(render_psg) {
+        SN76489_Update(psg, buffer, length);
+    } else {
+        YM2612_ClearBuffer(buffer, length);
+    }
+    if(render_fm) YM2612_Update(buffer, length);
+    if(render_dac) YM2612_DacAndTimers_Update(buffer, length);
+}
+
+void Crossfade::mix(int **buffer, uint32_t length)
+{
+    uint32_t count;
+    uint32_t done;
+    uint32_t span;
+    uint32_t position;
+    int live_lfo;
+
+    if(!active()) return;
+    count = end_time - time;
+    if(count > length) count = length;
+    if(count > frame_max) count = frame_max;
+
+    live_lfo = LFO_Modulation;
+    YM2612_GetContext(live);
+    YM2612_SetContext(state);
+    LFO_Modulation = lfo;
+    for(done = 0; done < count; done += span) {
+        while(next < event_count && events[next].time == time) {
+            const ChipEvent &event = events[next++];
+            if(event.type == EVENT_YM2612) {
+                YM2612_Write(event.port << 1, event.reg);
+                YM2612_Write((event.port << 1) + 1, event.data);
+            } else if(event.type == EVENT_SN76489) {
+                SN76489_Write(psg, event.data);
+            } else {
+                SN76489_GGStereoWrite(psg, event.data);
+            }
+        }
+        // up to the next write
+        span = count - done;
+        if(next < event_count && events[next].time - time < span) span = events[next].time - time;
+        render(done, span);
+        time += span;
+    }
+    YM2612_GetContext(state);
+    YM2612_SetContext(live);
+    LFO_Modulation = live_lfo;
+
+    // the new track comes in as the old one goes
+    position = time - count - start_time;
+    for(uint32_t i = 0; i < count; i++) {
+        int64_t gain = position + i;
+        int64_t fade = end_time - start_time;
+        buffer[0][i] = tail[0][i] + (int)((buffer[0][i] - tail[0][i]) * gain / fade);
+        buffer[1][i] = tail[1][i] + (int)((buffer[1][i] - tail[1][i]) * gain / fade);
+    }
+    if(time == end_time) end();
+}
+
+void Crossfade::end()
+{
+    SN76489_Shutdown(psg);
+    psg = NULL;
+    free(events);
+    free(state);
+    free(live);
+    free(tail[0]);
+    free(tail[1]);
+    events = NULL;
+    state = live = NULL;
+    tail[0] = tail[1] = NULL;
+    event_count = 0;
+    next = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef CROSSFADE_HPP
+#define CROSSFADE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ym2612.hpp"
+extern "C" {
+#include "sn76489.h"
+}
+#include "parse_ahead.hpp"
+
+//
+// Crossfade from the end of one track into the start of the next.
+//
+// Once the parser of the ending track is done, all its remaining events
+// are in the queue. begin() takes them off and keeps the track's chips: a
+// copy of the YM2612 context and its SN76489 context. The next track then
+// starts on the live chips as usual, and mix() renders the old track under
+// each of its blocks, swapping the YM2612 context in and out around it,
+// with a linear ramp that reaches the new track where the old one ends.
+//
+// Both tracks have to run the YM2612 at the same clock, the context refers
+// to the tables of the last YM2612_Init().
+//
+class Crossfade
+{
+public:
+    Crossfade(uint32_t frame_max);
+    ~Crossfade();
+
+    // at time of the old track, it ends at end_time; keeps psg and the
+    // flags it is rendered with, false without memory
+    bool begin(ParseAhead &queue, uint32_t time, uint32_t end_time, SN76489_Context *psg,
+        bool render_psg, bool render_fm, bool render_dac, int lfo);
+    // the new track's block, at most frame_max samples
+    void mix(int **buffer, uint32_t length);
+    // drop the old track, also when a seek or a skip cuts the fade short
+    void end();
+
+    bool active() const { return psg != NULL; }
+
+private:
+    Crossfade(const Crossfade &);
+    Crossfade &operator=(const Crossfade &);
+
+    void render(uint32_t offset, uint32_t length);
+
+    uint32_t frame_max;
+    ChipEvent *events;
+    uint32_t event_count;
+    uint32_t next;
+
+    // old track
+    ym2612_ *state;
+    ym2612_ *live;
+    SN76489_Context *psg;
+    bool render_psg;
+    bool render_fm;
+    bool render_dac;
+    int lfo;
+    int *tail[2];
+
+    uint32_t start_time;
+    uint32_t time;
+    uint32_t end_time;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "keyframe.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+#define KEYFRAME_MAGIC 0x31464b56   // "VKF1"
+
+// keep some internal RAM for the rest of the player
+#define INTERNAL_RESERVE 48 * 1024
+
+struct KeyframeFileHeader
+{
+    uint32_t magic;
+    uint32_t record_size;
+    uint64_t song;
+    uint32_t count;
+    uint32_t interval;
+};
+
+KeyframeIndex::KeyframeIndex(uint32_t interval, size_t budget)
+    : keys(NULL), key_count(0), key_capacity(0), base_interval(interval), interval(interval), budget(budget),
+      complete(false)
+{
+}
+
+KeyframeIndex::~KeyframeIndex()
+{
+    clear();
+}
+
+void KeyframeIndex::clear()
+{
+    for(uint32_t i = 0; i < key_count; i++) free(keys[i]);
+    free(keys);
+    keys = NULL;
+    key_count = key_capacity = 0;
+    // undo the thinning of the last song
+    interval = base_interval;
+    complete = false;
+}
+
+Keyframe *KeyframeIndex::allocate()
+{
+#ifdef ESP_PLATFORM
+    // about 6.5 KB each, internal RAM (no PSRAM in this build)
+    if(heap_caps_get_free_size(MALLOC_CAP_8BIT) < INTERNAL_RESERVE + sizeof(Keyframe)) return NULL;
+    return (Keyframe *)heap_caps_malloc(sizeof(Keyframe), MALLOC_CAP_8BIT);
+#else
+    return (Keyframe *)malloc(sizeof(Keyframe));
+#endif
+}
+
+bool KeyframeIndex::append(Keyframe *key)
+{
+    if(key_count == key_capacity) {
+        uint32_t capacity = key_capacity ? key_capacity * 2 : 32;
+        Keyframe **grown = (Keyframe **)realloc(keys, capacity * sizeof(*keys));
+        if(grown == NULL) return false;
+        keys = grown;
+        key_capacity = capacity;
+    }
+    keys[key_count++] = key;
+    return true;
+}
+
+// every other keyframe, the first one stays
+void KeyframeIndex::thin()
+{
+    uint32_t n = 0;
+
+    for(uint32_t i = 0; i < key_count; i++) {
+        if(i & 1) {
+            free(keys[i]);
+        } else {
+            keys[n++] = keys[i];
+        }
+    }
+    key_count = n;
+    interval *= 2;
+}
+
+void KeyframeIndex::capture(uint32_t time, uint32_t offset, uint32_t pcm, SN76489_Context *psg)
+{
+    // past the indexed part only, seeks play indexed parts again
+    if(complete) return;
+    if(key_count > 0 && time - keys[key_count - 1]->time < interval) return;
+    if(key_count > 0 && time < keys[key_count - 1]->time) return;
+
+    if((size_t)(key_count + 1) * sizeof(Keyframe) > budget) {
+        thin();
+        if(key_count > 0 && time - keys[key_count - 1]->time < interval) return;
+    }
+    Keyframe *key = allocate();
+    if(key == NULL && key_count > 1) {
+        // the heap is short before the budget is used up, the same way
+        thin();
+        if(time - keys[key_count - 1]->time < interval) return;
+        key = allocate();
+    }
+    if(key == NULL) return;
+    key->time = time;
+    key->offset = offset;
+    key->pcm = pcm;
+    YM2612_SaveState(&key->ym2612);
+    memcpy(&key->sn76489, psg, sizeof(*psg));
+    if(!append(key)) free(key);
+}
+
+const Keyframe *KeyframeIndex::find(uint32_t time) const
+{
+    uint32_t low = 0, high = key_count;
+
+    // first keyframe after time
+    while(low < high) {
+        uint32_t mid = (low + high) / 2;
+        if(keys[mid]->time <= time) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low > 0 ? keys[low - 1] : NULL;
+}
+
+uint32_t KeyframeIndex::reach() const
+{
+    if(complete) return UINT32_MAX;
+    if(key_count == 0) return 0;
+    return keys[key_count - 1]->time + interval;
+}
+
+void KeyframeIndex::restore(const Keyframe *key, SN76489_Context *psg) const
+{
+    // the noise tables and NGP pairing belong to the running chip
+    const sn76489_noise_jump *jump = psg->NoiseJump;
+    void *ngp = psg->NgpChip2;
+
+    YM2612_LoadState(&key->ym2612);
+    memcpy(psg, &key->sn76489, sizeof(*psg));
+    psg->NoiseJump = jump;
+    psg->NgpChip2 = ngp;
+}
+
+bool KeyframeIndex::save(const char *path, uint64_t song) const
+{
+    KeyframeFileHeader header;
+    bool ok;
+
+    FILE *file = fopen(path, "wb");
+    if(file == NULL) return false;
+    header.magic = KEYFRAME_MAGIC;
+    header.record_size = sizeof(Keyframe);
+    header.song = song;
+    header.count = key_count;
+    header.interval = interval;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for(uint32_t i = 0; ok && i < key_count; i++) {
+        ok = fwrite(keys[i], sizeof(Keyframe), 1, file) == 1;
+    }
+    ok = fclose(file) == 0 && ok;
+    // a partial file would fail the next load anyway
+    if(!ok) remove(path);
+    return ok;
+}
+
+bool KeyframeIndex::load(const char *path, uint64_t song)
+{
+    KeyframeFileHeader header;
+
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return false;
+    clear();
+    if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != KEYFRAME_MAGIC ||
+        header.record_size != sizeof(Keyframe) || header.song != song || header.count == 0 ||
+        (size_t)header.count * sizeof(Keyframe) > budget) {
+        fclose(file);
+        return false;
+    }
+    for(uint32_t i = 0; i < header.count; i++) {
+        Keyframe *key = allocate();
+        if(key == NULL || fread(key, sizeof(Keyframe), 1, file) != 1 || !append(key)) {
+            free(key);
+            fclose(file);
+            clear();
+            return false;
+        }
+    }
+    fclose(file);
+    interval = header.interval;
+    complete = true;
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef KEYFRAME_HPP
+#define KEYFRAME_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ym2612.hpp"
+extern "C" {
+#include "sn76489.h"
+}
+
+// everything the player needs to continue from a point in the song
+struct Keyframe
+{
+    uint32_t time;          // sample position
+    uint32_t offset;        // stream offset of the next command
+    uint32_t pcm;           // DAC stream position
+    ym2612_ ym2612;         // YM2612_SaveState()
+    SN76489_Context sn76489;
+};
+
+//
+// Seek index: chip snapshots at regular intervals of the first pass.
+//
+// Keyframes are captured by the renderer as the song plays (or fast
+// forwards), so a seek restores the last keyframe before the target and
+// renders at most one interval forward. When the index outgrows its budget,
+// or internal RAM runs short first, every other keyframe is dropped and the
+// interval doubles.
+//
+// A complete index can be saved next to the song and loaded the next time,
+// keyed by the song and the player build.
+//
+class KeyframeIndex
+{
+public:
+    KeyframeIndex(uint32_t interval, size_t budget);
+    ~KeyframeIndex();
+
+    void clear();
+
+    // chips are at time, the parser continues at offset
+    void capture(uint32_t time, uint32_t offset, uint32_t pcm, SN76489_Context *psg);
+    // last keyframe at or before time, NULL when there is none
+    const Keyframe *find(uint32_t time) const;
+    void restore(const Keyframe *key, SN76489_Context *psg) const;
+
+    // a seek up to here renders at most one interval, the whole song once finished
+    uint32_t reach() const;
+
+    // the first pass is indexed, nothing is added any more
+    void finish() { complete = true; }
+    bool finished() const { return complete; }
+    uint32_t count() const { return key_count; }
+
+    bool save(const char *path, uint64_t song) const;
+    bool load(const char *path, uint64_t song);
+
+private:
+    KeyframeIndex(const KeyframeIndex &);
+    KeyframeIndex &operator=(const KeyframeIndex &);
+
+    Keyframe *allocate();
+    bool append(Keyframe *key);
+    void thin();
+
+    Keyframe **keys;
+    uint32_t key_count;
+    uint32_t key_capacity;
+    uint32_t base_interval;
+    uint32_t interval;
+    size_t budget;
+    bool complete;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <string.h>
+#include "loop_cache.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+#define CHUNK_SHIFT 12
+#define CHUNK_WORDS (1 << CHUNK_SHIFT)
+#define CHUNK_MASK (CHUNK_WORDS - 1)
+
+// keep some internal RAM for the rest of the player
+#define INTERNAL_RESERVE 48 * 1024
+
+// block header: bit 15 = run of one frame, bits 0-14 = frame count - 1
+#define BLOCK_RUN 0x8000
+#define BLOCK_MAX 0x8000
+
+static uint16_t *alloc_chunk()
+{
+#ifdef ESP_PLATFORM
+    uint16_t *chunk = (uint16_t *)heap_caps_malloc(CHUNK_WORDS * sizeof(uint16_t), MALLOC_CAP_SPIRAM);
+    if(chunk != NULL) return chunk;
+    if(heap_caps_get_free_size(MALLOC_CAP_8BIT) < INTERNAL_RESERVE + CHUNK_WORDS * sizeof(uint16_t)) {
+        return NULL;
+    }
+    return (uint16_t *)heap_caps_malloc(CHUNK_WORDS * sizeof(uint16_t), MALLOC_CAP_8BIT);
+#else
+    return (uint16_t *)malloc(CHUNK_WORDS * sizeof(uint16_t));
+#endif
+}
+
+LoopCache::LoopCache(size_t budget, bool compress)
+    : state(IDLE), budget(budget), compress(compress), start_hash(0),
+      chunks(NULL), chunk_count(0), chunk_capacity(0), words(0),
+      literal_header(0), literal_count(0), run_count(0),
+      read_pos(0), block_left(0), block_run(false)
+{
+}
+
+LoopCache::~LoopCache()
+{
+    release();
+}
+
+void LoopCache::release()
+{
+    for(size_t i = 0; i < chunk_count; i++) {
+        free(chunks[i]);
+    }
+    free(chunks);
+    chunks = NULL;
+    chunk_count = chunk_capacity = 0;
+    words = 0;
+}
+
+void LoopCache::disable()
+{
+    release();
+    state = DISABLED;
+}
+
+void LoopCache::restart(uint64_t hash)
+{
+    // keep the allocated chunks, a retried pass has a similar size
+    words = 0;
+    literal_count = 0;
+    run_count = 0;
+    start_hash = hash;
+    state = RECORDING;
+}
+
+//
+// Called every time the parser is at the loop offset.
+// Returns true once the cached pass replaces synthesis.
+//
+bool LoopCache::loop_point(uint64_t hash)
+{
+    switch(state) {
+        case IDLE:
+            restart(hash);
+            return false;
+        case RECORDING:
+            if(!flush()) {
+                disable();
+                return false;
+            }
+            if(hash == start_hash && words > 0) {
+                state = REPLAY;
+                read_pos = 0;
+                block_left = 0;
+                return true;
+            }
+            // state differs from the previous loop start, try the next pass
+            restart(hash);
+            return false;
+        case REPLAY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool LoopCache::put(uint16_t word)
+{
+    if((words + 1) * sizeof(uint16_t) > budget) return false;
+    if((words >> CHUNK_SHIFT) >= chunk_count) {
+        if(chunk_count == chunk_capacity) {
+            size_t capacity = chunk_capacity ? chunk_capacity * 2 : 16;
+            uint16_t **grown = (uint16_t **)realloc(chunks, capacity * sizeof(uint16_t *));
+            if(grown == NULL) return false;
+            chunks = grown;
+            chunk_capacity = capacity;
+        }
+        uint16_t *chunk = alloc_chunk();
+        if(chunk == NULL) return false;
+        chunks[chunk_count++] = chunk;
+    }
+    chunks[words >> CHUNK_SHIFT][words & CHUNK_MASK] = word;
+    words++;
+    return true;
+}
+
+uint16_t LoopCache::get(size_t pos) const
+{
+    return chunks[pos >> CHUNK_SHIFT][pos & CHUNK_MASK];
+}
+
+bool LoopCache::emit_literal(const int16_t *frame)
+{
+    if(literal_count == 0 || literal_count == BLOCK_MAX) {
+        literal_header = words;
+        literal_count = 0;
+        if(!put(0)) return false;
+    }
+    literal_count++;
+    chunks[literal_header >> CHUNK_SHIFT][literal_header & CHUNK_MASK] = literal_count - 1;
+    return put((uint16_t)frame[0]) && put((uint16_t)frame[1]);
+}
+
+bool LoopCache::emit_run()
+{
+    literal_count = 0;
+    return put(BLOCK_RUN | (run_count - 1)) && put((uint16_t)run_frame[0]) && put((uint16_t)run_frame[1]);
+}
+
+// emit the pending run of identical frames
+bool LoopCache::flush()
+{
+    bool ok = true;
+    if(run_count == 1) {
+        ok = emit_literal(run_frame);
+    } else if(run_count > 1) {
+        ok = emit_run();
+    }
+    run_count = 0;
+    return ok;
+}
+
+bool LoopCache::put_frame(const int16_t *frame)
+{
+    if(!compress) return emit_literal(frame);
+
+    if(run_count > 0 && run_count < BLOCK_MAX && frame[0] == run_frame[0] && frame[1] == run_frame[1]) {
+        run_count++;
+        return true;
+    }
+    if(!flush()) return false;
+    run_frame[0] = frame[0];
+    run_frame[1] = frame[1];
+    run_count = 1;
+    return true;
+}
+
+void LoopCache::record(const int16_t *frames, size_t count)
+{
+    if(state != RECORDING) return;
+    for(size_t i = 0; i < count; i++) {
+        if(!put_frame(&frames[i * 2])) {
+            // loop doesn't fit, fall back to synthesis for good
+            disable();
+            return;
+        }
+    }
+}
+
+size_t LoopCache::replay(int16_t *frames, size_t count)
+{
+    if(state != REPLAY) return 0;
+    for(size_t i = 0; i < count; i++) {
+        if(block_left == 0) {
+            if(read_pos >= words) read_pos = 0;
+            uint16_t header = get(read_pos++);
+            block_run = (header & BLOCK_RUN) != 0;
+            block_left = (header & ~BLOCK_RUN) + 1;
+            if(block_run) {
+                block_frame[0] = (int16_t)get(read_pos++);
+                block_frame[1] = (int16_t)get(read_pos++);
+            }
+        }
+        if(block_run) {
+            frames[i * 2] = block_frame[0];
+            frames[i * 2 + 1] = block_frame[1];
+        } else {
+            frames[i * 2] = (int16_t)get(read_pos++);
+            frames[i * 2 + 1] = (int16_t)get(read_pos++);
+        }
+        block_left--;
+    }
+    return count;
+}
@@ -0,0 +1,69 @@
+#ifndef LOOP_CACHE_HPP
+#define LOOP_CACHE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// Rendered PCM cache for the song loop.
+//
+// The player calls loop_point() with the chip state hash every time the
+// parser reaches the loop offset. The first call starts recording the
+// rendered stereo frames; when the next loop start has the same chip state
+// the recorded pass is replayed instead of synthesising it again.
+//
+// Frames are stored in a chain of small chunks. With compression enabled
+// runs of identical frames (silence, constant PSG spans) are run-length
+// encoded, which is lossless so replay is bit exact.
+//
+class LoopCache
+{
+public:
+    LoopCache(size_t budget, bool compress);
+    ~LoopCache();
+
+    bool loop_point(uint64_t hash);
+    void record(const int16_t *frames, size_t count);
+    size_t replay(int16_t *frames, size_t count);
+
+    bool recording() const { return state == RECORDING; }
+    bool replaying() const { return state == REPLAY; }
+    size_t size() const { return words * sizeof(uint16_t); }
+
+private:
+    enum State { IDLE, RECORDING, REPLAY, DISABLED };
+
+    void restart(uint64_t hash);
+    void disable();
+    void release();
+    bool put(uint16_t word);
+    uint16_t get(size_t pos) const;
+    bool put_frame(const int16_t *frame);
+    bool emit_literal(const int16_t *frame);
+    bool emit_run();
+    bool flush();
+
+    State state;
+    size_t budget;
+    bool compress;
+    uint64_t start_hash;
+
+    uint16_t **chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    size_t words;
+
+    // encoder
+    size_t literal_header;
+    uint16_t literal_count;
+    int16_t run_frame[2];
+    uint16_t run_count;
+
+    // decoder
+    size_t read_pos;
+    uint16_t block_left;
+    bool block_run;
+    int16_t block_frame[2];
+};
+
+#endif
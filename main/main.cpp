@@ -1,12 +1,31 @@
 #include <M5Stack.h>
+#include <fcntl.h>
 #include "nvs_flash.h"
-#include "esp_partition.h"
 #include <esp_heap_caps.h>
-#include "driver/i2s.h"
+#include "driver/uart.h"
+#include "esp_vfs_dev.h"
 #include "ym2612.hpp"
 extern "C" {
 #include "sn76489.h"
 }
+#include "synth_verify.h"
+#include "statehash.h"
+#include "loop_cache.hpp"
+#include "vgm_command.hpp"
+#include "vgm_reader.hpp"
+#include "vgm_gzip.hpp"
+#include "vgm_file.hpp"
+#include "vgm_stream.hpp"
+#include "pcm_bank.hpp"
+#include "vgc_player.hpp"
+#include "parse_ahead.hpp"
+#include "keyframe.hpp"
+#include "song_features.hpp"
+#include "song_library.hpp"
+#include "song_archive.hpp"
+#include "crossfade.hpp"
+#include "audio_output.hpp"
+#include "audio_pipeline.hpp"
 
 #define SAMPLING_RATE 44100
 #define FRAME_SIZE_MAX 2048
@@ -14,79 +33,227 @@ extern "C" {
 #define STEREO 2
 #define MONO 0
 
-uint8_t *vgm;
-uint32_t vgmpos = 0x40;
+// QUALITY_BLEP for band-limited PSG edges (less aliasing on high tones).
+// its steps are centred SN76489_BLEP_DELAY (8) samples after the write,
+// so the PSG then plays about 0.2 ms behind the YM2612; that is left
+// uncompensated, as delaying the FM side would need a line of its own
+#define PSG_QUALITY QUALITY_INTERPOLATE
+
+// rendered loop cache, an upper bound: without PSRAM in this build it gets
+// what internal RAM has above a reserve (see loop_cache.cpp). it only engages
+// when the chips sound the same at two loop starts; an FM note or a PSG tone
+// still sounding over the loop point carries its free-running phase across,
+// so such songs rarely match and keep being synthesised. silent PSG channels
+// and the PSG clock fraction aren't compared (test/loop_cache_test.cpp)
+#define LOOP_CACHE_BUDGET (3 * 1024 * 1024)
+#define LOOP_CACHE_COMPRESS true
+
+// played from the SD card when present, else from the sound partition
+#define VGM_FILE_PATH "/sd/play.vgm"
+
+// how far the parser runs in front of the renderer
+#define PARSE_AHEAD_MS 40
+
+// the last part of an archive track fades into the next one, 0 for a
+// plain gapless switch. the parser runs that far ahead so it is done with
+// the old track by then (fewer ms when the event queue fills up first)
+#define PLAYLIST_CROSSFADE_MS 0
+
+// live input instead of a song: make VGM_STREAM_UART=2 (port C), the
+// sender is held off through RTS when the player falls behind
+#define VGM_STREAM_BAUD 921600
+#define VGM_STREAM_RX_PIN 16
+#define VGM_STREAM_TX_PIN 17
+#define VGM_STREAM_RTS_PIN 5
+#define VGM_STREAM_UART_BUFFER 4096
+// live input plays this far behind what has arrived
+#define VGM_STREAM_JITTER_MS 60
+
+// loop() renders into a ring of blocks, an output task writes them to I2S.
+// this build runs one core (CONFIG_FREERTOS_UNICORE), so the ring adds no
+// CPU: it lets loop() render ahead of the DMA instead of waiting in
+// i2s_write(), and covers a slow stretch of rendering with up to 93 ms on
+// top of the 186 ms in the DMA buffers
+#define AUDIO_BLOCK_FRAMES 512
+#define AUDIO_PIPELINE_DEPTH 8
+// live input already waits VGM_STREAM_JITTER_MS, the ring adds about 23 ms
+// to that instead of 93
+#define AUDIO_STREAM_PIPELINE_DEPTH 2
+// above loop() and the parser: it pre-empts the renderer as soon as the DMA
+// takes a block, and otherwise waits there
+#define AUDIO_OUTPUT_CORE 0
+#define AUDIO_OUTPUT_PRIORITY 5
+
+// decoded pages of compressed PCM blocks (1 KB each)
+#define PCM_CACHE_PAGES 32
+
+// chip snapshots for seeking (about 6.5 KB each, internal RAM), a seek
+// renders at most one interval silently, forward seeks stop where the first
+// pass is indexed. the index of an SD song is saved next to it. the budget
+// is about 40 snapshots; past it, or when the heap gets down to its reserve
+// first, the interval doubles (a 3 minute song ends up at 8 s or more)
+#define KEYFRAME_INTERVAL_MS 500
+#define KEYFRAME_BUDGET (256 * 1024)
+#define KEYFRAME_FILE_PATH "/sd/play.kfi"
+
+// button A seeks back, C forward, B skips to the next track of an archive
+#define SEEK_STEP_MS 10000
+
+// songs on the SD card, listed with their GD3 titles and lengths
+#define LIBRARY_DIR "/sd/vgm"
+
+VgmMap vgm_map;
+MemorySource vgm_memory;
+GzipSource vgm_gzip;
+FileSource vgm_file;
+StreamSource vgm_stream;
+VgmSource *vgm_source;
+VgmReader vgm;
+VgmHeader vgm_header;
 bool vgmend = false;
-uint32_t vgmloopoffset;
-uint32_t datpos;
+// parser side end of the song, the renderer gets there later
+bool parse_end = false;
+// YM2612 PCM data blocks (0x00, compressed 0x40)
+PcmBank pcm_bank(PCM_CACHE_PAGES);
 uint32_t pcmpos;
 uint32_t pcmoffset;
+// VGM commands decoded on a task of their own
+ParseAhead parse_ahead(SAMPLING_RATE * (PLAYLIST_CROSSFADE_MS > PARSE_AHEAD_MS ? PLAYLIST_CROSSFADE_MS : PARSE_AHEAD_MS) / 1000);
+uint32_t play_time;
+bool loop_pending;
+uint32_t loop_pcm_position;
 
-uint32_t clock_sn76489;
-uint32_t clock_ym2612;
-
-SN76489_Context *sn76489;
+// seek index over the first pass
+KeyframeIndex keyframes(SAMPLING_RATE * KEYFRAME_INTERVAL_MS / 1000, KEYFRAME_BUDGET);
+Task keyframe_saver;
+bool parse_looped;
+uint32_t next_keyframe;
+// stream sources: data blocks are indexed up to here
+size_t parse_high_water;
+// samples after the seek target, played before the next event
+uint32_t seek_leftover;
 
-uint8_t *get_vgmdata()
+// a song of the partition with what takes long to find out: the features
+// need a pass over the whole song, the data blocks an index
+struct PreparedTrack
 {
-    uint8_t* data;
-    const esp_partition_t* part;
-    spi_flash_mmap_handle_t hrom;
-    esp_err_t err;
+    PreparedTrack() : bank(PCM_CACHE_PAGES) {}
 
-    nvs_flash_init();
+    uint32_t track;
+    const uint8_t *data;
+    size_t size;
+    // set by the prefetch task when it is done
+    bool ready;
+    bool valid;
+    bool vgc_mode;
+    bool gzip;
+    VgcPlayer vgc;
+    VgmHeader header;
+    SongFeatures features;
+    PcmBank bank;
+};
 
-    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_PHY, NULL);
-    if (part == 0) {
-        printf("Couldn't find vgm part!\n");
-    }
+// several songs in the partition (tools/vga_pack)
+SongArchive archive;
+uint32_t track;
+bool next_track = false;
+// the next track, opened in the background while this one plays
+PreparedTrack prepared;
+Task track_prefetch;
+Crossfade crossfade(FRAME_SIZE_MAX);
+// sample the fade into the next track starts at, once the parser is done
+uint32_t crossfade_time = UINT32_MAX;
+// the YM2612 tables are only rebuilt for another clock
+uint32_t ym2612_clock;
 
-    err = esp_partition_mmap(part, 0, 0x1EF000, SPI_FLASH_MMAP_DATA, (const void**)&data, &hrom);
-    if (err != ESP_OK) {
-        printf("Couldn't map vgm part!\n");
-    }
-    printf("read vgm data @%p\n", data);
+// precompiled song in the partition (tools/vgc_compile)
+VgcPlayer vgc;
+bool vgc_mode = false;
+// keyframes and seeking, not for vgc songs and live input
+bool seekable = false;
 
-    return (uint8_t *)data;
-}
+// what the song uses, chips it never makes audible aren't rendered
+SongFeatures song_features;
+bool render_psg = true;
+bool render_fm = true;
+bool render_dac = true;
 
-uint8_t get_vgm_ui8()
-{
-    return vgm[vgmpos++];
-}
+// track list, indexed in the background
+SongLibrary library;
+Task library_indexer;
+
+// commands seen, and commands for chips that aren't emulated
+uint32_t vgm_command_count[256];
+uint32_t vgm_command_skipped;
 
-uint16_t get_vgm_ui16()
+SN76489_Context *sn76489;
+LoopCache *loop_cache;
+// the internal DAC, fed by the output task
+I2sDacOutput i2s_output(AUDIO_BLOCK_FRAMES);
+AudioPipeline audio_output(&i2s_output, AUDIO_BLOCK_FRAMES, AUDIO_PIPELINE_DEPTH, AUDIO_OUTPUT_CORE, AUDIO_OUTPUT_PRIORITY);
+
+void add_data_block(PcmBank &bank, VgmReader &reader, uint8_t type, uint32_t size)
 {
-    return get_vgm_ui8() + (get_vgm_ui8() << 8);
+    // YM2612 PCM and the decompression table, the other chips aren't emulated
+    if(type == 0x00 || type == 0x40 || type == 0x7f) {
+        bank.add(reader, type, size);
+    } else {
+        reader.skip(size);
+    }
 }
 
-uint32_t get_vgm_ui32()
+// index the data blocks before playing. a mapped image is scanned to the
+// end, a stream only up to the first wait (where the blocks usually are),
+// blocks further on are added when the parser gets there
+void index_data_blocks(PcmBank &bank, VgmReader &reader, uint32_t version, bool whole, size_t end = SIZE_MAX)
 {
-    return get_vgm_ui8() + (get_vgm_ui8() << 8) + (get_vgm_ui8() << 16) + (get_vgm_ui8() << 24);
+    uint8_t command;
+    uint32_t size;
+
+    while(!reader.failed() && reader.pos() < end) {
+        command = reader.u8();
+        if(command == 0x67) {
+            reader.u8();
+            command = reader.u8();
+            size = reader.u32();
+            add_data_block(bank, reader, command, size);
+        } else if(command == 0x66) {
+            break;
+        } else if(!whole && ((command >= 0x61 && command <= 0x63) || (command >= 0x70 && command <= 0x8f))) {
+            break;
+        } else {
+            reader.skip(vgm_command_size(command, version) - 1);
+        }
+    }
 }
 
-uint16_t parse_vgm()
+uint16_t parse_vgm(VgmReader &reader)
 {
     uint8_t command;
     uint16_t wait = 0;
     uint8_t reg;
     uint8_t dat;
+    uint32_t size;
 
-    command = get_vgm_ui8();
+    command = reader.u8();
+    vgm_command_count[command]++;
     switch (command) {
+        case 0x4f:
+            dat = reader.u8();
+            parse_ahead.emit(EVENT_GG_STEREO, 0, 0, dat);
+            break;
         case 0x50:
-            dat = get_vgm_ui8();
-            SN76489_Write(sn76489, dat);
+            dat = reader.u8();
+            parse_ahead.emit(EVENT_SN76489, 0, 0, dat);
             break;
         case 0x52:
         case 0x53:
-            reg = get_vgm_ui8();
-            dat = get_vgm_ui8();
-            YM2612_Write(0 + ((command & 1) << 1), reg);
-            YM2612_Write(1 + ((command & 1) << 1), dat);
+            reg = reader.u8();
+            dat = reader.u8();
+            parse_ahead.emit(EVENT_YM2612, command & 1, reg, dat);
             break;
         case 0x61:
-            wait = get_vgm_ui16();
+            wait = reader.u16();
             break;
         case 0x62:
             wait = 735;
@@ -95,17 +262,19 @@ uint16_t parse_vgm()
             wait = 882;
             break;
         case 0x66:
-            if(vgmloopoffset == 0) {
-                vgmend = true;
+            if(vgm_header.loop_offset == 0) {
+                parse_end = true;
             } else {
-                vgmpos = vgmloopoffset;
+                reader.seek(vgm_header.loop_offset);
+                parse_looped = true;
             }
             break;
         case 0x67:
-            get_vgm_ui8(); // 0x66
-            get_vgm_ui8(); // 0x00 data type
-            datpos = vgmpos + 4;
-            vgmpos += get_vgm_ui32(); // size of data, in bytes
+            // 0x66 tt ss ss ss ss, already indexed blocks are skipped
+            reader.u8();
+            dat = reader.u8();
+            size = reader.u32();
+            add_data_block(pcm_bank, reader, dat, size);
             break;
         case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
         case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
@@ -114,103 +283,660 @@ uint16_t parse_vgm()
         case 0x80: case 0x81: case 0x82: case 0x83: case 0x84: case 0x85: case 0x86: case 0x87:
         case 0x88: case 0x89: case 0x8a: case 0x8b: case 0x8c: case 0x8d: case 0x8e: case 0x8f:
             wait = (command & 0x0f);
-            YM2612_Write(0, 0x2a);
-            YM2612_Write(1, vgm[datpos + pcmpos + pcmoffset]);
+            // DAC centre outside the block
+            parse_ahead.emit(EVENT_YM2612, 0, 0x2a, pcm_bank.read(pcmpos + pcmoffset));
             pcmoffset++;
             break;
         case 0xe0:
-            pcmpos = get_vgm_ui32();
+            pcmpos = reader.u32();
             pcmoffset = 0;
             break;
         default:
-            printf("unknown cmd at 0x%x: 0x%x\n", vgmpos, vgm[vgmpos]);
-            vgmpos++;
+            // other chips, PCM RAM writes and DAC streams
+            reader.skip(vgm_command_size(command, vgm_header.version) - 1);
+            vgm_command_skipped++;
             break;
     }
+    // truncated or malformed data ends the song
+    if(reader.failed()) parse_end = true;
 
 	return wait;
 }
 
-static const i2s_port_t i2s_num = I2S_NUM_0; // i2s port number
+// one command, on the parse task
+uint32_t parse_command(void *arg)
+{
+    (void)arg;
+    // the renderer checks the loop cache here
+    if(vgm.pos() == vgm_header.loop_offset) parse_ahead.emit(EVENT_LOOP, 0, 0, 0, pcmpos + pcmoffset);
+    // seek points on the first pass, the renderer snapshots the chips there
+    if(seekable && !parse_looped && parse_ahead.parse_time() >= next_keyframe) {
+        parse_ahead.emit(EVENT_KEYFRAME, 0, 0, 0, pcmpos + pcmoffset, vgm.pos());
+        next_keyframe = parse_ahead.parse_time() + SAMPLING_RATE * KEYFRAME_INTERVAL_MS / 1000;
+    }
+    if(vgm.pos() > parse_high_water) parse_high_water = vgm.pos();
+    uint32_t wait = parse_vgm(vgm);
+    if(parse_end) parse_ahead.finish();
+    return wait;
+}
+
+// apply the events due now, returns the samples to the next one
+uint16_t play_events()
+{
+    const ChipEvent *event;
+    uint32_t wait;
+
+    for(;;) {
+        event = parse_ahead.next();
+        if(event->time != play_time) break;
+        switch(event->type) {
+            case EVENT_YM2612:
+                YM2612_Write(event->port << 1, event->reg);
+                YM2612_Write((event->port << 1) + 1, event->data);
+                break;
+            case EVENT_SN76489:
+                SN76489_Write(sn76489, event->data);
+                break;
+            case EVENT_GG_STEREO:
+                SN76489_GGStereoWrite(sn76489, event->data);
+                break;
+            case EVENT_LOOP:
+                loop_pending = true;
+                loop_pcm_position = event->value;
+                parse_ahead.pop();
+                return 0;
+            case EVENT_KEYFRAME:
+                keyframes.capture(play_time, event->offset, event->value, sn76489);
+                break;
+            default:
+                vgmend = true;
+                parse_ahead.pop();
+                return 0;
+        }
+        parse_ahead.pop();
+    }
+    wait = event->time - play_time;
+    if(wait > 0xffff) wait = 0xffff;
+    // a crossfade starts within the last wait of a track
+    if(crossfade_time > play_time && wait > crossfade_time - play_time) wait = crossfade_time - play_time;
+    play_time += wait;
+    parse_ahead.played(play_time);
+    return wait;
+}
+
+uint16_t next_event()
+{
+    loop_pending = false;
+    if(vgc_mode) {
+        uint16_t wait = vgc.step();
+        if(vgc.ended()) vgmend = true;
+        return wait;
+    }
+    return play_events();
+}
+
+bool at_loop_point()
+{
+    if(vgc_mode) return vgc.at_loop();
+    return loop_pending;
+}
+
+void print_command_counts()
+{
+    printf("vgm commands, %d skipped:\n", vgm_command_skipped);
+    for(uint32_t i = 0; i < 256; i++) {
+        if(vgm_command_count[i] != 0) printf("  0x%02x: %d\n", i, vgm_command_count[i]);
+    }
+}
+
+uint64_t chip_state_hash()
+{
+    uint64_t hash = YM2612_GetStateHash();
+    hash = statehash_combine(hash, SN76489_GetStateHash(sn76489));
+    // DAC stream position is part of what the song will play next
+    hash = statehash_combine(hash, vgc_mode ? vgc.pcm_position() : loop_pcm_position);
+    return hash;
+}
+
+// the saved index only fits this song and player build
+uint64_t song_key()
+{
+    const char *build = __DATE__ " " __TIME__;
+    uint64_t hash = statehash_combine(vgm_source->length(), vgm_header.eof_offset);
+
+    hash = statehash_combine(hash, vgm_header.total_samples);
+    hash = statehash_combine(hash, vgm_header.loop_offset);
+    hash = statehash_combine(hash, vgm_header.data_offset);
+    hash = statehash_combine(hash, vgm_header.gd3_offset);
+    hash = statehash_combine(hash, vgm_header.clock_ym2612);
+    hash = statehash_combine(hash, vgm_header.clock_sn76489);
+    hash = statehash_combine(hash, SAMPLING_RATE);
+    hash = statehash_combine(hash, PSG_QUALITY);
+    while(*build) hash = statehash_fold(hash, *build++);
+    return hash;
+}
+
+void save_keyframes(void *arg)
+{
+    (void)arg;
+    if(keyframes.save(KEYFRAME_FILE_PATH, song_key())) {
+        printf("keyframes saved: %d\n", keyframes.count());
+    } else {
+        printf("keyframes save fail.\n");
+    }
+}
 
-void init_dac(void)
+// the first pass has been played (or fast forwarded) through
+void check_keyframes_complete()
 {
-    i2s_config_t i2s_config = {
-        .mode = static_cast<i2s_mode_t>(I2S_MODE_MASTER | I2S_MODE_TX | I2S_MODE_DAC_BUILT_IN),
-        .sample_rate = SAMPLING_RATE,
-        .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-        .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
-        .communication_format = static_cast<i2s_comm_format_t>(I2S_COMM_FORMAT_I2S_MSB),
-        .intr_alloc_flags = 0,
-        .dma_buf_count = 16,
-        .dma_buf_len = 512,
-        .use_apll = false,
-        .tx_desc_auto_clear = true,
-        .fixed_mclk = 0
+    if(!seekable || keyframes.finished()) return;
+    if(!vgmend && (vgm_header.total_samples == 0 || play_time < vgm_header.total_samples)) return;
+    keyframes.finish();
+    // idle priority, below loop(); the card is shared with the prefetch
+    if(vgm_source == &vgm_file) keyframe_saver.start("kfi_save", save_keyframes, NULL, 0, 0, 4096);
+}
+
+// position on the first pass timeline, looped passes map back into it
+uint32_t song_position()
+{
+    uint32_t total = vgm_header.total_samples;
+    uint32_t loop = vgm_header.loop_samples;
+
+    if(total == 0 || play_time < total) return play_time;
+    if(vgm_header.loop_offset == 0 || loop == 0 || loop > total) return total;
+    return total - loop + (play_time - total) % loop;
+}
+
+// only new or changed files are read, the index is kept in the directory
+void index_library(void *arg)
+{
+    (void)arg;
+    if(!library.open(LIBRARY_DIR)) return;
+    uint32_t changed = library.update();
+    if(changed != 0 && !library.save()) printf("library index save fail.\n");
+    printf("library %s: %d songs, %d files read\n", LIBRARY_DIR, library.count(), changed);
+    library.print();
+}
+
+// live VGM from a host sequencer on a UART
+bool open_stream_input()
+{
+#ifdef VGM_STREAM_UART
+    uart_config_t uart_config = {
+        .baud_rate = VGM_STREAM_BAUD,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_RTS,
+        .rx_flow_ctrl_thresh = 100,
+        .use_ref_tick = false
     };
+    char path[16];
 
-    i2s_driver_install(i2s_num, &i2s_config, 0, NULL);
-    i2s_set_pin(i2s_num, NULL);
+    uart_param_config((uart_port_t)VGM_STREAM_UART, &uart_config);
+    uart_set_pin((uart_port_t)VGM_STREAM_UART, VGM_STREAM_TX_PIN, VGM_STREAM_RX_PIN, VGM_STREAM_RTS_PIN, UART_PIN_NO_CHANGE);
+    if(uart_driver_install((uart_port_t)VGM_STREAM_UART, VGM_STREAM_UART_BUFFER, 0, 0, NULL, 0) != ESP_OK) return false;
+    esp_vfs_dev_uart_use_driver(VGM_STREAM_UART);
+    snprintf(path, sizeof(path), "/dev/uart/%d", VGM_STREAM_UART);
+    if(!vgm_stream.open(open(path, O_RDONLY))) return false;
+    printf("vgm stream on %s\n", path);
+    return true;
+#else
+    return false;
+#endif
 }
 
-// The setup routine runs once when M5Stack starts up
-void setup()
+// the song's chips into buflr, at most FRAME_SIZE_MAX samples
+void render_chips(int **buflr, uint32_t length)
 {
-    // Initialize the M5Stack object
-    M5.begin();
+    if(render_psg) {
+        SN76489_Update(sn76489, buflr, length);
+    } else {
+        YM2612_ClearBuffer(buflr, length);
+    }
+    if(render_fm) YM2612_Update(buflr, length);
+    if(render_dac) YM2612_DacAndTimers_Update(buflr, length);
+}
 
-    // Initialize
-    M5.Lcd.fillScreen(BLACK);
-    M5.Lcd.print("MEGADRIVE/GENESIS sound emulation by M5Stack.\n\n");
+// advance the chips without output
+void render_silent(int **buflr, uint32_t samples)
+{
+    uint32_t length;
 
-    // Load vgm data
-    vgm = get_vgmdata();
+    while(samples > 0) {
+        length = samples > FRAME_SIZE_MAX ? FRAME_SIZE_MAX : samples;
+        if(render_psg) SN76489_Skip(sn76489, length);
+        YM2612_ClearBuffer(buflr, length);
+        if(render_fm) YM2612_Update(buflr, length);
+        if(render_dac) YM2612_DacAndTimers_Update(buflr, length);
+        samples -= length;
+    }
+}
 
-    // read vgm header
-    vgmpos = 0x0C; clock_sn76489 = get_vgm_ui32();
-    vgmpos = 0x2C; clock_ym2612 = get_vgm_ui32();
-    vgmpos = 0x1c; vgmloopoffset = get_vgm_ui32();
-    vgmpos = 0x34; vgmpos = 0x34 + get_vgm_ui32();
+// a fresh loop cache for a looping song, once it plays on its own
+void reset_loop_cache()
+{
+    delete loop_cache;
+    loop_cache = NULL;
+    if(vgm_header.loop_offset != 0 && !crossfade.active()) {
+        loop_cache = new LoopCache(LOOP_CACHE_BUDGET, LOOP_CACHE_COMPRESS);
+    }
+}
+
+// restore the last keyframe before target and render silently up to it
+void seek(uint32_t target, int **buflr)
+{
+    const Keyframe *key;
+    uint32_t start;
+    uint32_t wait;
+    uint32_t skip;
+
+    if(vgm_header.total_samples != 0 && target > vgm_header.total_samples) target = vgm_header.total_samples;
+    // past the index the whole gap would be rendered silently while the
+    // output runs dry, so such a seek waits until the first pass gets there
+    if(target > keyframes.reach()) {
+        printf("seek: not indexed yet\n");
+        return;
+    }
+    key = keyframes.find(target);
+    if(key == NULL) return;
+
+    parse_ahead.stop();
+    // the fade from the last track is cut short
+    crossfade.end();
+    keyframes.restore(key, sn76489);
+    // a loaded index can be ahead of the blocks a stream has indexed
+    if(key->offset > parse_high_water) {
+        vgm.seek(parse_high_water);
+        index_data_blocks(pcm_bank, vgm, vgm_header.version, true, key->offset);
+        parse_high_water = key->offset;
+    }
+    vgm.seek(key->offset);
+    pcmpos = key->pcm;
+    pcmoffset = 0;
+    parse_end = false;
+    parse_looped = false;
+    next_keyframe = key->time;
+    vgmend = false;
+    play_time = key->time;
+    seek_leftover = 0;
+    if(!parse_ahead.start(parse_command, NULL, key->time)) {
+        printf("parse task start fail.\n");
+        vgmend = true;
+        return;
+    }
 
-    if(clock_ym2612 == 0) clock_ym2612 = 7670453;
-    if(clock_sn76489 == 0) clock_sn76489 = 3579545;
+    // keyframes past the index are captured on the way
+    while(play_time < target && !vgmend) {
+        start = play_time;
+        wait = next_event();
+        skip = wait < target - start ? wait : target - start;
+        render_silent(buflr, skip);
+        seek_leftover = wait - skip;
+    }
+    loop_pending = false;
 
-    printf("clock_sn76489 : %d\n", clock_sn76489);
-    printf("clock_ym2612 : %d\n", clock_ym2612);
-    printf("vgmpos : %x\n", vgmpos);
+    // the cached pass no longer follows
+    reset_loop_cache();
+}
+
+// buttons, samples to seek by
+int32_t seek_request()
+{
+    M5.update();
+    if(M5.BtnB.wasPressed() && archive.count() > 1) next_track = true;
+    if(!seekable) return 0;
+    if(M5.BtnA.wasPressed()) return -(SAMPLING_RATE * SEEK_STEP_MS / 1000);
+    if(M5.BtnC.wasPressed()) return SAMPLING_RATE * SEEK_STEP_MS / 1000;
+    return 0;
+}
+
+void seek_relative(int32_t step, int **buflr)
+{
+    int64_t target = (int64_t)song_position() + step;
+
+    if(target < 0) target = 0;
+    seek((uint32_t)target, buflr);
+}
+
+// the song of the sound partition: the whole image, or a track of an
+// archive. the next track is prepared in the background while this one plays
+void prepare_track(PreparedTrack *next)
+{
+    ArchiveSong song;
+    GzipSource gzip;
+    MemorySource memory;
+    VgmSource *source = &memory;
+
+    next->data = vgm_map.data();
+    next->size = vgm_map.length();
+    if(archive.song(next->track, &song)) {
+        next->data = song.data;
+        next->size = song.size;
+    }
+    next->valid = true;
+    next->gzip = false;
+    next->bank.clear();
+    memset(&next->header, 0, sizeof(next->header));
+    next->vgc_mode = VgcPlayer::detect(next->data, next->size) && next->vgc.open(next->data, next->size);
+    if(next->vgc_mode) {
+        // the compiler already resolved PCM blocks and defaults
+        next->header.clock_sn76489 = next->vgc.header().clock_sn76489;
+        next->header.clock_ym2612 = next->vgc.header().clock_ym2612;
+        next->header.loop_offset = next->vgc.header().loop_offset;
+        next->header.data_offset = next->vgc.header().events_offset;
+        next->vgc.scan(&next->features);
+        return;
+    }
+
+    // .vgz images are inflated while playing, here only to scan them
+    if(GzipSource::detect(next->data, next->size) && gzip.open(next->data, next->size)) {
+        next->gzip = true;
+        source = &gzip;
+    } else {
+        memory = MemorySource(next->data, next->size);
+    }
+    VgmReader reader(source);
+    if(!reader.header(&next->header)) {
+        next->valid = false;
+        return;
+    }
+    VgmReader scan(source, next->header.eof_offset);
+    scan.seek(next->header.data_offset);
+    next->features.scan(scan, next->header.version);
+    reader = VgmReader(source, next->header.eof_offset);
+    reader.seek(next->header.data_offset);
+    index_data_blocks(next->bank, reader, next->header.version, !next->gzip);
+    if(next->header.clock_ym2612 == 0) next->header.clock_ym2612 = 7670453;
+    if(next->header.clock_sn76489 == 0) next->header.clock_sn76489 = 3579545;
+}
+
+void prefetch_track(void *arg)
+{
+    PreparedTrack *next = (PreparedTrack *)arg;
+
+    prepare_track(next);
+    __atomic_store_n(&next->ready, true, __ATOMIC_RELEASE);
+}
+
+// open the track after this one in the background
+void start_prefetch()
+{
+    if(archive.count() < 2) return;
+    prepared.track = (track + 1) % archive.count();
+    prepared.ready = false;
+    // idle priority, below loop(): inflating and scanning a .vgz takes
+    // seconds and must only get the time the renderer leaves over
+    if(!track_prefetch.start("prefetch", prefetch_track, &prepared, 0, 0, 4096)) prefetch_track(&prepared);
+}
+
+// the prepared track becomes the song
+void load_prepared()
+{
+    ArchiveSong song;
+
+    track = prepared.track;
+    if(archive.song(track, &song)) {
+        printf("track %d: %s\n", track, song.name);
+        M5.Lcd.printf("track %d: %s\n", track, song.name);
+    }
+    vgc_mode = prepared.vgc_mode;
+    vgm_header = prepared.header;
+    song_features = prepared.features;
+    pcm_bank.swap(prepared.bank);
+    if(vgc_mode) {
+        printf("precompiled vgc song\n");
+        vgc = prepared.vgc;
+        return;
+    }
+    if(prepared.gzip && vgm_gzip.open(prepared.data, prepared.size)) {
+        vgm_source = &vgm_gzip;
+    } else {
+        vgm_memory = MemorySource(prepared.data, prepared.size);
+        vgm_source = &vgm_memory;
+    }
+    if(!prepared.valid) {
+        printf("not a vgm file!\n");
+        M5.Lcd.print("not a vgm file.\n");
+        vgmend = true;
+    }
+    // the song ends at its EoF offset rather than the partition end
+    vgm = VgmReader(vgm_source, vgm_header.eof_offset);
+    vgm.seek(vgm_header.data_offset);
+    if(vgm_header.loop_offset != 0) vgm_source->retain(vgm_header.loop_offset);
+    seekable = true;
+}
+
+// header, features and data blocks of a song on the SD card or live input
+void open_song()
+{
+    // read vgm header, the song ends at its EoF offset
+    vgm = VgmReader(vgm_source);
+    if(!vgm.header(&vgm_header)) {
+        printf("not a vgm file!\n");
+        M5.Lcd.print("not a vgm file.\n");
+        vgmend = true;
+    }
+    // files and live input are read once, trust the header
+    song_features.from_header(vgm_header);
+    vgm = VgmReader(vgm_source, vgm_header.eof_offset);
+    vgm.seek(vgm_header.data_offset);
+    if(vgm_source == &vgm_stream) {
+        // no going back: no loop, data blocks are added as they arrive
+        vgm_header.loop_offset = 0;
+    } else {
+        index_data_blocks(pcm_bank, vgm, vgm_header.version, false);
+        vgm.seek(vgm_header.data_offset);
+        if(vgm_header.loop_offset != 0) vgm_source->retain(vgm_header.loop_offset);
+        seekable = true;
+    }
+}
+
+// chips of the opened song, then start parsing
+void start_song()
+{
+    if(vgm_header.clock_ym2612 == 0) vgm_header.clock_ym2612 = 7670453;
+    if(vgm_header.clock_sn76489 == 0) vgm_header.clock_sn76489 = 3579545;
+
+    printf("clock_sn76489 : %d\n", vgm_header.clock_sn76489);
+    printf("clock_ym2612 : %d\n", vgm_header.clock_ym2612);
+    printf("vgmpos : %x\n", vgm_header.data_offset);
+    printf("pcm bank : %d byte\n", pcm_bank.size());
+    song_features.print();
+
+    render_psg = song_features.has(FEATURE_PSG | FEATURE_NOISE);
+    render_fm = song_features.has(FEATURE_FM);
+    // timer A keys channel 3 on in CSM mode
+    render_dac = song_features.has(FEATURE_DAC | FEATURE_CSM);
+    LFO_Modulation = song_features.has(FEATURE_LFO);
 
     // init sound chip
-    sn76489 = SN76489_Init(clock_sn76489, SAMPLING_RATE);
+    sn76489 = SN76489_Init(vgm_header.clock_sn76489, SAMPLING_RATE);
     SN76489_Reset(sn76489);
-    YM2612_Init(clock_ym2612, SAMPLING_RATE, 0);
+    SN76489_SetQuality(sn76489, PSG_QUALITY);
+    vgc.set_psg(sn76489);
+    // the tables only depend on the clock, between tracks a reset does
+    if(vgm_header.clock_ym2612 != ym2612_clock) {
+        YM2612_Init(vgm_header.clock_ym2612, SAMPLING_RATE, 0);
+        ym2612_clock = vgm_header.clock_ym2612;
+    } else {
+        YM2612_Reset();
+    }
 
-    // init internal DAC
-    init_dac();
+    // the song start is the first seek point
+    if(seekable) {
+        parse_high_water = vgm_header.data_offset;
+        next_keyframe = SAMPLING_RATE * KEYFRAME_INTERVAL_MS / 1000;
+        if(vgm_source == &vgm_file && keyframes.load(KEYFRAME_FILE_PATH, song_key())) {
+            printf("keyframes loaded: %d\n", keyframes.count());
+        } else {
+            keyframes.capture(0, vgm_header.data_offset, 0, sn76489);
+        }
+    }
+
+    reset_loop_cache();
+
+    // decode ahead on the parse task while loop() renders
+    if(vgm_source == &vgm_stream) parse_ahead.set_prebuffer(SAMPLING_RATE * VGM_STREAM_JITTER_MS / 1000);
+    if(!vgc_mode && !parse_ahead.start(parse_command, NULL)) {
+        printf("parse task start fail.\n");
+        vgmend = true;
+    }
+
+    start_prefetch();
+}
+
+// stop the song and free what it holds, the YM2612 stays set up for the
+// next track
+void end_song()
+{
+    parse_ahead.stop();
+    keyframe_saver.join();
+    if(!vgc_mode) {
+        printf("parse ahead waits: %d\n", parse_ahead.starved());
+        printf("keyframes: %d\n", keyframes.count());
+    }
+    if(vgm_source == &vgm_file) printf("sd read waits: %d\n", vgm_file.underruns());
+    if(vgm_source == &vgm_stream) printf("stream input waits: %d, %d bytes\n", vgm_stream.underruns(), vgm_stream.received());
+
+    delete loop_cache;
+    loop_cache = NULL;
+    keyframes.clear();
+    pcm_bank.clear();
+    vgm_gzip.close();
+    SN76489_Shutdown(sn76489);
+    sn76489 = NULL;
+
+    memset(&vgm_header, 0, sizeof(vgm_header));
+    vgmend = false;
+    parse_end = false;
+    pcmpos = 0;
+    pcmoffset = 0;
+    play_time = 0;
+    loop_pending = false;
+    loop_pcm_position = 0;
+    parse_looped = false;
+    next_keyframe = 0;
+    parse_high_water = 0;
+    seek_leftover = 0;
+    crossfade_time = UINT32_MAX;
+    vgc_mode = false;
+    seekable = false;
+    memset(vgm_command_count, 0, sizeof(vgm_command_count));
+    vgm_command_skipped = 0;
+}
+
+// after the last song, the chips go too
+void close_song()
+{
+    track_prefetch.join();
+    prepared.bank.clear();
+    crossfade.end();
+    if(!vgc_mode) print_command_counts();
+    end_song();
+    YM2612_End();
+    ym2612_clock = 0;
+}
+
+// next song of an archive, false after the last one. the prefetch already
+// opened it, the switch is on the sample the last song ended
+bool advance_track()
+{
+    if(!next_track && track + 1 >= archive.count()) return false;
+    next_track = false;
+    track_prefetch.join();
+    crossfade.end();
+    end_song();
+    load_prepared();
+    start_song();
+    return true;
+}
+
+// the end of the track is parsed and close: it fades into the next one
+// while that starts playing
+bool start_crossfade()
+{
+    uint32_t end_time;
+
+    if(PLAYLIST_CROSSFADE_MS == 0 || vgc_mode || crossfade.active() || track + 1 >= archive.count()) return false;
+    if(!parse_ahead.ended(&end_time)) return false;
+    // play_events() stops there, later when the parser got done late
+    if(crossfade_time == UINT32_MAX) {
+        uint32_t fade = SAMPLING_RATE * PLAYLIST_CROSSFADE_MS / 1000;
+        crossfade_time = end_time > fade ? end_time - fade : 0;
+    }
+    if(play_time < crossfade_time || play_time >= end_time) return false;
+    // still scanning a long song: a plain switch at the end
+    if(!__atomic_load_n(&prepared.ready, __ATOMIC_ACQUIRE)) return false;
+    track_prefetch.join();
+    // the old track's snapshot needs the same YM2612 tables
+    if(prepared.header.clock_ym2612 != ym2612_clock) return false;
+    if(!crossfade.begin(parse_ahead, play_time, end_time, sn76489, render_psg, render_fm, render_dac, LFO_Modulation)) {
+        return false;
+    }
+    // the fade owns the PSG now
+    sn76489 = NULL;
+    end_song();
+    load_prepared();
+    start_song();
+    return true;
 }
 
-short audio_write_sound_stereo(int sample32)
+// The setup routine runs once when M5Stack starts up
+void setup()
 {
-    short sample16;
+    // Initialize the M5Stack object
+    M5.begin();
+
+    // Initialize
+    M5.Lcd.fillScreen(BLACK);
+    M5.Lcd.print("MEGADRIVE/GENESIS sound emulation by M5Stack.\n\n");
+
+#ifdef SYNTH_REFERENCE_KERNELS
+    // compare optimised kernels against the reference ones before playing
+    if(synth_verify_sn76489(esp_random(), 2000) + synth_verify_ym2612(esp_random(), 400) != 0) {
+        M5.Lcd.print("kernel verify: MISMATCH (see serial log)\n");
+    }
+#endif
 
-    if (sample32 < -0x7FFF) {
-        sample16 = -0x7FFF;
-    } else if (sample32 > 0x7FFF) {
-        sample16 = 0x7FFF;
+    // Load vgm data
+    if(open_stream_input()) {
+        // played as it arrives
+        M5.Lcd.print("waiting for vgm stream.\n");
+        vgm_source = &vgm_stream;
+        open_song();
+    } else if(vgm_file.open(VGM_FILE_PATH)) {
+        // streamed, no size limit
+        printf("read vgm file %s\n", VGM_FILE_PATH);
+        vgm_source = &vgm_file;
+        open_song();
     } else {
-        sample16 = (short)(sample32);
+        nvs_flash_init();
+        vgm_map.map_partition();
+        if(archive.open(vgm_map.data(), vgm_map.length())) {
+            printf("vga archive, %d songs:\n", archive.count());
+            archive.print();
+        }
+        // the first track here, the others while the one before plays
+        prepared.track = 0;
+        prepare_track(&prepared);
+        load_prepared();
     }
 
-    // for I2S_MODE_DAC_BUILT_IN
-    sample16 = sample16 ^ 0x8000U;
+    start_song();
+
+    // init internal DAC
+    if(vgm_source == &vgm_stream) audio_output.set_depth(AUDIO_STREAM_PIPELINE_DEPTH);
+    if(!audio_output.open(SAMPLING_RATE)) printf("i2s init fail.\n");
 
-    return sample16;
+    // idle priority, below loop() (1): it only runs while the renderer
+    // waits, and the card is shared with the prefetch
+    library_indexer.start("library", index_library, NULL, 0, 0, 6144);
 }
 
 // The loop routine runs over and over again forever
 void loop()
 {
-    size_t bytes_written = 0;
-
     uint16_t frame_size;
     uint32_t frame_all = 0;
 
@@ -229,42 +955,97 @@ void loop()
     M5.Lcd.printf("frame max size: %d\n", FRAME_SIZE_MAX);
     M5.Lcd.printf("free memory: %d byte\n", heap_caps_get_free_size(MALLOC_CAP_8BIT));
 
+    int16_t *frames = (int16_t *)heap_caps_malloc(FRAME_SIZE_MAX * sizeof(int16_t) * STEREO, MALLOC_CAP_8BIT);
+    if(frames == NULL) printf("frame buffer alloc fail.\n");
+
     int32_t last_frame_size;
     int32_t update_frame_size;
-    do {
-        frame_size = parse_vgm();
-        last_frame_size = frame_size;
+    uint32_t poll_frame = 0;
+    int32_t step;
+    for(;;) {
         do {
-            if(last_frame_size > FRAME_SIZE_MAX) {
-                update_frame_size = FRAME_SIZE_MAX;
-            } else {
-                update_frame_size = last_frame_size;
+            check_keyframes_complete();
+            // about every 100ms, vgc songs have no index but can be skipped
+            if((seekable || archive.count() > 1) && frame_all - poll_frame >= SAMPLING_RATE / 10) {
+                poll_frame = frame_all;
+                step = seek_request();
+                if(next_track) break;
+                if(step != 0) {
+                    seek_relative(step, buflr);
+                    continue;
+                }
             }
-            // get sampling
-            SN76489_Update(sn76489, (int **)buflr, update_frame_size);
-            YM2612_Update((int **)buflr, update_frame_size);
-            YM2612_DacAndTimers_Update((int **)buflr, update_frame_size);
-            for(uint32_t i = 0; i < update_frame_size; i++) {
-                short d[STEREO];
-                d[0] = audio_write_sound_stereo(buflr[0][i]);
-                d[1] = audio_write_sound_stereo(buflr[1][i]);
-                i2s_write((i2s_port_t)i2s_num, d, sizeof(short) * STEREO, &bytes_written, portMAX_DELAY);
+            // the end of the track overlaps the start of the next one
+            if(seek_leftover == 0) start_crossfade();
+            if(loop_cache != NULL && at_loop_point()) {
+                // same chip state as the last loop start: replay the cached pass
+                if(loop_cache->loop_point(chip_state_hash())) break;
             }
-            last_frame_size -= FRAME_SIZE_MAX;
-        } while(last_frame_size > 0);
-        frame_all += frame_size;
-    } while(!vgmend);
+            if(seek_leftover > 0) {
+                frame_size = seek_leftover;
+                seek_leftover = 0;
+            } else {
+                frame_size = next_event();
+            }
+            last_frame_size = frame_size;
+            do {
+                if(last_frame_size > FRAME_SIZE_MAX) {
+                    update_frame_size = FRAME_SIZE_MAX;
+                } else {
+                    update_frame_size = last_frame_size;
+                }
+                // get sampling
+                render_chips((int **)buflr, update_frame_size);
+                if(crossfade.active()) {
+                    crossfade.mix((int **)buflr, update_frame_size);
+                    // the loop cache records the new track alone
+                    if(!crossfade.active()) reset_loop_cache();
+                }
+                audio_frames((int **)buflr, frames, update_frame_size);
+                if(loop_cache != NULL) loop_cache->record(frames, update_frame_size);
+                audio_output.write(frames, update_frame_size);
+                last_frame_size -= FRAME_SIZE_MAX;
+            } while(last_frame_size > 0);
+            frame_all += frame_size;
+        } while(!vgmend);
+        check_keyframes_complete();
+
+        // the parser may still be ahead when the loop cache takes over
+        parse_ahead.stop();
+        if(loop_cache == NULL || !loop_cache->replaying()) {
+            if(!advance_track()) break;
+            continue;
+        }
 
+        printf("loop cached: %d bytes\n", loop_cache->size());
+        M5.Lcd.printf("loop cached: %d byte\n", loop_cache->size());
+        // until a seek goes back to the emulated song
+        step = 0;
+        while(step == 0 && !next_track) {
+            loop_cache->replay(frames, FRAME_SIZE_MAX);
+            audio_output.write(frames, FRAME_SIZE_MAX);
+            play_time += FRAME_SIZE_MAX;
+            step = seek_request();
+        }
+        if(next_track) {
+            advance_track();
+            continue;
+        }
+        seek_relative(step, buflr);
+    }
+
+    close_song();
+    library_indexer.join();
+
+    free(frames);
     free(buflr[0]);
     free(buflr[1]);
     free(buflr);
 
-    YM2612_End();
-    SN76489_Shutdown(sn76489);
-
     M5.Lcd.printf("\ntotal frame: %d %d\n", frame_all, frame_all / SAMPLING_RATE);
 
-    i2s_driver_uninstall((i2s_port_t)i2s_num); //stop & destroy i2s driver
+    audio_output.close(); //stop & destroy i2s driver
+    printf("i2s writes: %d for %d frames, output waits: %d\n", i2s_output.writes(), (uint32_t)i2s_output.frames(), audio_output.starved());
 
     M5.update();
 
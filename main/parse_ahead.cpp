@@ -0,0 +1,191 @@
+#include "parse_ahead.hpp"
+
+// this build runs one core (CONFIG_FREERTOS_UNICORE), shared with the
+// renderer; at the loopTask priority the parser doesn't pre-empt it, the
+// two take turns per tick and the parser runs whenever the renderer waits
+#define PARSE_CORE 0
+#define PARSE_PRIORITY 1
+#define PARSE_STACK 4096
+
+ParseAhead::ParseAhead(uint32_t ahead_samples)
+    : parse(NULL), arg(NULL), ahead_samples(ahead_samples), prebuffer(0), time(0), finished(true),
+      buffering(false), played_time(0), parsed_time(0), end_time(0), parse_done(false), running(false),
+      producer_waiting(false), consumer_waiting(false), starve_count(0)
+{
+}
+
+ParseAhead::~ParseAhead()
+{
+    stop();
+}
+
+bool ParseAhead::start(uint32_t (*parse)(void *arg), void *arg, uint32_t start_time)
+{
+    stop();
+    queue.clear();
+    this->parse = parse;
+    this->arg = arg;
+    time = start_time;
+    played_time = start_time;
+    parsed_time = start_time;
+    finished = false;
+    parse_done = false;
+    buffering = prebuffer != 0;
+    producer_waiting = consumer_waiting = false;
+    __atomic_store_n(&running, true, __ATOMIC_RELEASE);
+    if(!task.start("vgm_parse", parse_entry, this, PARSE_CORE, PARSE_PRIORITY, PARSE_STACK)) {
+        running = false;
+        return false;
+    }
+    return true;
+}
+
+void ParseAhead::stop()
+{
+    if(!__atomic_exchange_n(&running, false, __ATOMIC_ACQ_REL)) {
+        task.join();
+        return;
+    }
+    space.signal();
+    task.join();
+}
+
+void ParseAhead::set_prebuffer(uint32_t samples)
+{
+    prebuffer = samples;
+    // the parser has to be able to get that far ahead
+    if(ahead_samples < 2 * samples) ahead_samples = 2 * samples;
+}
+
+void ParseAhead::parse_entry(void *self)
+{
+    ((ParseAhead *)self)->run();
+}
+
+void ParseAhead::run()
+{
+    while(!finished && __atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        time += parse(arg);
+        if(prebuffer == 0) continue;
+        // a buffering renderer waits for the parse time, not for events
+        __atomic_store_n(&parsed_time, time, __ATOMIC_RELEASE);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&consumer_waiting, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&consumer_waiting, false, __ATOMIC_RELAXED);
+            ready.signal();
+        }
+    }
+}
+
+bool ParseAhead::ahead(uint32_t at) const
+{
+    return (int32_t)(at - __atomic_load_n(&played_time, __ATOMIC_ACQUIRE)) > (int32_t)ahead_samples;
+}
+
+// park the parse task until the renderer pops or plays something
+void ParseAhead::wait_consumer()
+{
+    __atomic_store_n(&producer_waiting, true, __ATOMIC_RELAXED);
+    // the flag has to be visible before the caller's condition is read again
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void ParseAhead::emit(uint8_t type, uint8_t port, uint8_t reg, uint8_t data, uint32_t value, uint32_t offset)
+{
+    ChipEvent event;
+
+    event.time = time;
+    event.value = value;
+    event.offset = offset;
+    event.type = type;
+    event.port = port;
+    event.reg = reg;
+    event.data = data;
+
+    while(!queue.push(event)) {
+        wait_consumer();
+        if(queue.push(event)) break;
+        // a full queue ends the renderer's prebuffering
+        if(__atomic_load_n(&consumer_waiting, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&consumer_waiting, false, __ATOMIC_RELAXED);
+            ready.signal();
+        }
+        if(!__atomic_load_n(&running, __ATOMIC_ACQUIRE)) return;
+        space.wait();
+    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&consumer_waiting, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&consumer_waiting, false, __ATOMIC_RELAXED);
+        ready.signal();
+    }
+
+    // stay within ahead_samples of the renderer, it already has this event
+    while(ahead(time) && __atomic_load_n(&running, __ATOMIC_ACQUIRE)) {
+        wait_consumer();
+        if(!ahead(time)) break;
+        space.wait();
+    }
+    __atomic_store_n(&producer_waiting, false, __ATOMIC_RELAXED);
+}
+
+void ParseAhead::finish()
+{
+    end_time = time;
+    __atomic_store_n(&parse_done, true, __ATOMIC_RELEASE);
+    emit(EVENT_END, 0, 0, 0);
+    finished = true;
+}
+
+// the parser is prebuffer ahead, at the end or stuck on a full queue
+bool ParseAhead::buffered() const
+{
+    if(__atomic_load_n(&parse_done, __ATOMIC_ACQUIRE)) return true;
+    if(__atomic_load_n(&producer_waiting, __ATOMIC_RELAXED)) return true;
+    return __atomic_load_n(&parsed_time, __ATOMIC_ACQUIRE) - played_time >= prebuffer;
+}
+
+const ChipEvent *ParseAhead::next()
+{
+    const ChipEvent *event = queue.front();
+
+    if(event != NULL && !buffering) return event;
+    if(event == NULL) {
+        starve_count++;
+        // ran dry: build the jitter buffer up again
+        buffering = prebuffer != 0;
+    }
+    // it may be parked on a full queue of events that were all due now
+    release_producer();
+    for(;;) {
+        __atomic_store_n(&consumer_waiting, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        event = queue.front();
+        if(event != NULL && (!buffering || buffered())) break;
+        ready.wait();
+    }
+    __atomic_store_n(&consumer_waiting, false, __ATOMIC_RELAXED);
+    buffering = false;
+    return event;
+}
+
+bool ParseAhead::ended(uint32_t *end_time) const
+{
+    if(!__atomic_load_n(&parse_done, __ATOMIC_ACQUIRE)) return false;
+    *end_time = this->end_time;
+    return true;
+}
+
+void ParseAhead::played(uint32_t time)
+{
+    __atomic_store_n(&played_time, time, __ATOMIC_RELEASE);
+    release_producer();
+}
+
+void ParseAhead::release_producer()
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&producer_waiting, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&producer_waiting, false, __ATOMIC_RELAXED);
+        space.signal();
+    }
+}
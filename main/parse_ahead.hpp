@@ -0,0 +1,120 @@
+#ifndef PARSE_AHEAD_HPP
+#define PARSE_AHEAD_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "spsc_queue.hpp"
+#include "task.hpp"
+
+#define PARSE_QUEUE_SIZE 1024
+
+enum ChipEventType
+{
+    EVENT_YM2612,       // port, reg, data
+    EVENT_SN76489,      // data
+    EVENT_GG_STEREO,    // data
+    EVENT_LOOP,         // the song is at its loop point, value: PCM position
+    EVENT_KEYFRAME,     // seek point, value: PCM position, offset: next command
+    EVENT_END,
+};
+
+// chip write or marker, at a sample time
+struct ChipEvent
+{
+    uint32_t time;
+    uint32_t value;
+    uint32_t offset;
+    uint8_t type;
+    uint8_t port;
+    uint8_t reg;
+    uint8_t data;
+};
+
+//
+// Runs the VGM parser ahead of the renderer on its own task (next to the
+// renderer on the device's one core, a thread on the host). On one core
+// this adds no CPU time; it decodes in bursts rather than a command per
+// render block, keeps card and input waits out of the renderer, and gives
+// the crossfade the song end ahead of time.
+//
+// The parse function decodes one command, emits its chip writes and
+// returns its wait. Events go through a lock-free queue stamped with the
+// sample they happen at; the parser runs at most ahead_samples in front of
+// what the renderer has played, or until the queue is full. Either side
+// only blocks on an Event when the other one has to catch up.
+//
+// For live input a prebuffer (jitter buffer) holds the renderer back until
+// the parser is that far ahead, at the start and again after the renderer
+// ran dry, so input arriving late is absorbed instead of played choppy.
+//
+class ParseAhead
+{
+public:
+    ParseAhead(uint32_t ahead_samples);
+    ~ParseAhead();
+
+    // the first command parsed is at start_time
+    bool start(uint32_t (*parse)(void *arg), void *arg, uint32_t start_time = 0);
+    // stop the parser wherever it is, events not consumed are dropped
+    void stop();
+    // jitter buffer in samples, 0 for none; before start()
+    void set_prebuffer(uint32_t samples);
+
+    // parse task side
+    void emit(uint8_t type, uint8_t port, uint8_t reg, uint8_t data, uint32_t value = 0, uint32_t offset = 0);
+    // emits EVENT_END, the parse function isn't called again
+    void finish();
+    // sample time of the command being parsed
+    uint32_t parse_time() const { return time; }
+
+    // renderer side: next event, waits for the parser when there is none
+    const ChipEvent *next();
+    void pop() { queue.pop(); }
+    // renderer clock, lets the parser run further
+    void played(uint32_t time);
+    // the parser is done, all events up to EVENT_END (at end_time) are queued
+    bool ended(uint32_t *end_time) const;
+
+    // times the renderer had to wait for the parser
+    uint32_t starved() const { return starve_count; }
+
+private:
+    ParseAhead(const ParseAhead &);
+    ParseAhead &operator=(const ParseAhead &);
+
+    static void parse_entry(void *self);
+    void run();
+    bool ahead(uint32_t time) const;
+    bool buffered() const;
+    void wait_consumer();
+    void release_producer();
+
+    SpscQueue<ChipEvent, PARSE_QUEUE_SIZE> queue;
+    uint32_t (*parse)(void *arg);
+    void *arg;
+    uint32_t ahead_samples;
+    uint32_t prebuffer;
+
+    // parse task
+    uint32_t time;
+    bool finished;
+
+    // renderer
+    bool buffering;
+
+    // shared, atomic
+    uint32_t played_time;
+    uint32_t parsed_time;   // with a prebuffer only
+    uint32_t end_time;
+    bool parse_done;
+    bool running;
+    bool producer_waiting;
+    bool consumer_waiting;
+
+    uint32_t starve_count;
+    Event ready;            // events were queued
+    Event space;            // the renderer moved on, or stop()
+    Task task;
+};
+
+#endif
@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "pcm_bank.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+#define PAGE_NONE UINT32_MAX
+
+// data block types
+#define BLOCK_COMPRESSED 0x40
+#define BLOCK_TABLE 0x7f
+
+// cc ll ll ll ll bd bc st aa aa
+#define COMPRESSED_HEADER_SIZE 10
+// cc st bd bc nn nn
+#define TABLE_HEADER_SIZE 6
+
+static void *alloc_buffer(size_t size)
+{
+#ifdef ESP_PLATFORM
+    // sample data goes to PSRAM, the page table stays small
+    void *buffer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if(buffer == NULL) buffer = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    return buffer;
+#else
+    return malloc(size);
+#endif
+}
+
+// count bits at bit, 8 bits at a time: MSB first within a byte, the first
+// byte is the low part of the value
+static uint32_t read_bits(const uint8_t *data, uint32_t size, uint64_t bit, uint32_t count)
+{
+    uint32_t value = 0;
+    uint32_t out_bit = 0;
+
+    while(count > 0) {
+        uint32_t n = count < 8 ? count : 8;
+        uint64_t byte = bit >> 3;
+        uint32_t window = 0;
+        if(byte < size) window = data[byte] << 8;
+        if(byte + 1 < size) window |= data[byte + 1];
+        value |= ((window >> (16 - (bit & 7) - n)) & ((1 << n) - 1)) << out_bit;
+        out_bit += n;
+        bit += n;
+        count -= n;
+    }
+    return value;
+}
+
+PcmBank::PcmBank(uint32_t cache_pages)
+    : blocks(NULL), block_count(0), block_capacity(0), length(0), indexed_end(0),
+      pages(NULL), page_capacity(0),
+      cache(NULL), slot_page(NULL), cache_pages(cache_pages), next_slot(0),
+      table(NULL), table_count(0), table_value_size(1)
+{
+}
+
+PcmBank::~PcmBank()
+{
+    clear();
+}
+
+void PcmBank::clear()
+{
+    for(uint32_t i = 0; i < block_count; i++) {
+        if(blocks[i].owned) free((void *)blocks[i].data);
+        free(blocks[i].dpcm_state);
+    }
+    free(blocks);
+    free(pages);
+    free(cache);
+    free(slot_page);
+    free(table);
+    blocks = NULL;
+    block_count = block_capacity = 0;
+    length = 0;
+    indexed_end = 0;
+    pages = NULL;
+    page_capacity = 0;
+    cache = NULL;
+    slot_page = NULL;
+    next_slot = 0;
+    table = NULL;
+    table_count = 0;
+}
+
+void PcmBank::swap(PcmBank &other)
+{
+    std::swap(blocks, other.blocks);
+    std::swap(block_count, other.block_count);
+    std::swap(block_capacity, other.block_capacity);
+    std::swap(length, other.length);
+    std::swap(indexed_end, other.indexed_end);
+    std::swap(pages, other.pages);
+    std::swap(page_capacity, other.page_capacity);
+    std::swap(cache, other.cache);
+    std::swap(slot_page, other.slot_page);
+    std::swap(cache_pages, other.cache_pages);
+    std::swap(next_slot, other.next_slot);
+    std::swap(table, other.table);
+    std::swap(table_count, other.table_count);
+    std::swap(table_value_size, other.table_value_size);
+}
+
+void PcmBank::add(VgmReader &reader, uint8_t type, uint32_t size)
+{
+    size_t start = reader.pos();
+    Block block;
+
+    // blocks are indexed once, a loop or a second scan passes them again
+    if(start < indexed_end) {
+        reader.skip(size);
+        return;
+    }
+    indexed_end = start + size;
+    if(type == BLOCK_TABLE) {
+        load_table(reader, size);
+        return;
+    }
+
+    memset(&block, 0, sizeof(block));
+    block.start = length;
+    if(type & BLOCK_COMPRESSED) {
+        if(size < COMPRESSED_HEADER_SIZE) {
+            reader.skip(size);
+            return;
+        }
+        uint8_t compression = reader.u8();
+        block.length = reader.u32();
+        block.bits_dec = reader.u8();
+        block.bits_cmp = reader.u8();
+        block.sub_type = reader.u8();
+        block.add = reader.u16();
+        block.data_size = size - COMPRESSED_HEADER_SIZE;
+        block.compression = compression == 0 ? BITPACK : DPCM;
+        if(compression > 1 || block.bits_dec == 0 || block.bits_dec > 16 ||
+            block.bits_cmp == 0 || block.bits_cmp > 16) {
+            reader.skip(block.data_size);
+            return;
+        }
+    } else {
+        block.compression = RAW;
+        block.length = size;
+        block.data_size = size;
+    }
+    if(block.length == 0 || block.length > UINT32_MAX - length) {
+        reader.skip(block.data_size);
+        return;
+    }
+
+    // mapped images are used in place
+    block.data = reader.direct(block.data_size);
+    if(block.data != NULL) {
+        reader.skip(block.data_size);
+    } else {
+        uint8_t *copy = (uint8_t *)alloc_buffer(block.data_size);
+        if(copy == NULL || !reader.read(copy, block.data_size)) {
+            free(copy);
+            reader.skip(block.data_size);
+            return;
+        }
+        block.data = copy;
+        block.owned = true;
+    }
+
+    if(block_count == block_capacity) {
+        uint32_t capacity = block_capacity ? block_capacity * 2 : 8;
+        Block *grown = (Block *)realloc(blocks, capacity * sizeof(Block));
+        if(grown == NULL) {
+            if(block.owned) free((void *)block.data);
+            return;
+        }
+        blocks = grown;
+        block_capacity = capacity;
+    }
+    if(!grow((length + block.length + PCM_PAGE_MASK) >> PCM_PAGE_SHIFT)) {
+        if(block.owned) free((void *)block.data);
+        return;
+    }
+    if(block.compression == DPCM) dpcm_index(&block);
+    blocks[block_count++] = block;
+
+    // the last page may have ended inside the previous block
+    uint32_t first = length >> PCM_PAGE_SHIFT;
+    length += block.length;
+    map_pages(first);
+}
+
+bool PcmBank::grow(uint32_t page_count)
+{
+    if(page_count <= page_capacity) return true;
+    uint32_t capacity = page_capacity ? page_capacity : 64;
+    while(capacity < page_count) capacity *= 2;
+    const uint8_t **grown = (const uint8_t **)realloc(pages, capacity * sizeof(*pages));
+    if(grown == NULL) return false;
+    pages = grown;
+    for(uint32_t i = page_capacity; i < capacity; i++) pages[i] = NULL;
+    page_capacity = capacity;
+    return true;
+}
+
+void PcmBank::map_pages(uint32_t first)
+{
+    uint32_t page_count = (length + PCM_PAGE_MASK) >> PCM_PAGE_SHIFT;
+
+    for(uint32_t page = first; page < page_count; page++) {
+        // a decoded page may be missing the bytes of the new block
+        for(uint32_t slot = 0; slot_page != NULL && slot < cache_pages; slot++) {
+            if(slot_page[slot] == page) slot_page[slot] = PAGE_NONE;
+        }
+        pages[page] = direct_page(page);
+    }
+}
+
+// page inside one uncompressed block, read in place
+const uint8_t *PcmBank::direct_page(uint32_t page) const
+{
+    uint32_t from = page << PCM_PAGE_SHIFT;
+    uint32_t to = from + PCM_PAGE_SIZE < length ? from + PCM_PAGE_SIZE : length;
+    const Block *block = find(from);
+
+    if(block == NULL || block->compression != RAW || to - block->start > block->length) return NULL;
+    return block->data + (from - block->start);
+}
+
+// block holding offset, blocks are in bank order
+const PcmBank::Block *PcmBank::find(uint32_t offset) const
+{
+    uint32_t low = 0, high = block_count;
+
+    while(low < high) {
+        uint32_t mid = (low + high) / 2;
+        if(offset < blocks[mid].start) {
+            high = mid;
+        } else if(offset - blocks[mid].start >= blocks[mid].length) {
+            low = mid + 1;
+        } else {
+            return &blocks[mid];
+        }
+    }
+    return NULL;
+}
+
+void PcmBank::load_table(VgmReader &reader, uint32_t size)
+{
+    if(size < TABLE_HEADER_SIZE) {
+        reader.skip(size);
+        return;
+    }
+    reader.u8();    // compression type
+    reader.u8();    // sub type
+    uint8_t bits_dec = reader.u8();
+    reader.u8();    // bits compressed
+    uint32_t count = reader.u16();
+    uint32_t value_size = (bits_dec + 7) / 8;
+    uint32_t bytes = size - TABLE_HEADER_SIZE;
+
+    if(value_size == 0 || value_size > 2 || count * value_size > bytes) {
+        reader.skip(bytes);
+        return;
+    }
+    uint8_t *values = (uint8_t *)malloc(count * value_size);
+    if(values == NULL || !reader.read(values, count * value_size)) {
+        free(values);
+        reader.skip(bytes);
+        return;
+    }
+    reader.skip(bytes - count * value_size);
+    free(table);
+    table = values;
+    table_count = count;
+    table_value_size = value_size;
+}
+
+uint16_t PcmBank::table_value(uint32_t index) const
+{
+    if(index >= table_count) return 0;
+    if(table_value_size == 1) return table[index];
+    return vgm_load16(table + index * 2);
+}
+
+uint32_t PcmBank::decode_value(const Block *block, uint32_t index) const
+{
+    uint32_t code = read_bits(block->data, block->data_size, (uint64_t)index * block->bits_cmp, block->bits_cmp);
+
+    switch(block->sub_type) {
+        case 0x00:
+            return code + block->add;
+        case 0x01:
+            return (code << (block->bits_dec - block->bits_cmp)) + block->add;
+        default:
+            return table_value(code);
+    }
+}
+
+// DPCM runs through the whole block once, keeping the value every page
+void PcmBank::dpcm_index(Block *block)
+{
+    uint32_t value_size = (block->bits_dec + 7) / 8;
+    uint32_t values = (block->length + value_size - 1) / value_size;
+    uint32_t mask = (1 << block->bits_dec) - 1;
+    uint32_t value = block->add;
+
+    block->dpcm_state = (uint16_t *)malloc(((values >> PCM_PAGE_SHIFT) + 1) * sizeof(uint16_t));
+    if(block->dpcm_state == NULL) return;
+    for(uint32_t i = 0; i < values; i++) {
+        if((i & PCM_PAGE_MASK) == 0) block->dpcm_state[i >> PCM_PAGE_SHIFT] = value;
+        uint32_t code = read_bits(block->data, block->data_size, (uint64_t)i * block->bits_cmp, block->bits_cmp);
+        value = (value + table_value(code)) & mask;
+    }
+}
+
+// bank bytes [from, to) of block into dest
+void PcmBank::decode(const Block *block, uint32_t from, uint32_t to, uint8_t *dest) const
+{
+    if(block->compression == RAW) {
+        memcpy(dest, block->data + (from - block->start), to - from);
+        return;
+    }
+
+    uint32_t value_size = (block->bits_dec + 7) / 8;
+    uint32_t first = (from - block->start) / value_size;
+    uint32_t last = (to - 1 - block->start) / value_size;
+    uint32_t mask = (1 << block->bits_dec) - 1;
+    uint32_t value = 0;
+    uint32_t i = first;
+
+    if(block->compression == DPCM) {
+        if(block->dpcm_state == NULL) {
+            memset(dest, PCM_SILENCE, to - from);
+            return;
+        }
+        i = first & ~PCM_PAGE_MASK;
+        value = block->dpcm_state[i >> PCM_PAGE_SHIFT];
+    }
+    for(; i <= last; i++) {
+        if(block->compression == DPCM) {
+            uint32_t code = read_bits(block->data, block->data_size, (uint64_t)i * block->bits_cmp, block->bits_cmp);
+            value = (value + table_value(code)) & mask;
+            if(i < first) continue;
+        } else {
+            value = decode_value(block, i);
+        }
+        // little endian values, clipped to the range
+        for(uint32_t k = 0; k < value_size; k++) {
+            uint32_t pos = block->start + i * value_size + k;
+            if(pos >= from && pos < to) dest[pos - from] = value >> (k * 8);
+        }
+    }
+}
+
+uint8_t PcmBank::fault(uint32_t offset)
+{
+    uint32_t page = offset >> PCM_PAGE_SHIFT;
+
+    if(cache == NULL) {
+        if(cache_pages == 0) return PCM_SILENCE;
+        cache = (uint8_t *)alloc_buffer(cache_pages * PCM_PAGE_SIZE);
+        slot_page = (uint32_t *)malloc(cache_pages * sizeof(uint32_t));
+        if(cache == NULL || slot_page == NULL) {
+            free(cache);
+            free(slot_page);
+            cache = NULL;
+            slot_page = NULL;
+            cache_pages = 0;
+            return PCM_SILENCE;
+        }
+        for(uint32_t i = 0; i < cache_pages; i++) slot_page[i] = PAGE_NONE;
+    }
+
+    // round robin, PCM mostly plays forward
+    uint32_t slot = next_slot;
+    next_slot = (next_slot + 1) % cache_pages;
+    if(slot_page[slot] != PAGE_NONE) pages[slot_page[slot]] = NULL;
+
+    uint8_t *dest = cache + slot * PCM_PAGE_SIZE;
+    uint32_t from = page << PCM_PAGE_SHIFT;
+    uint32_t to = from + PCM_PAGE_SIZE < length ? from + PCM_PAGE_SIZE : length;
+    while(from < to) {
+        const Block *block = find(from);
+        uint32_t end = block->start + block->length < to ? block->start + block->length : to;
+        decode(block, from, end, dest + (from & PCM_PAGE_MASK));
+        from = end;
+    }
+    pages[page] = dest;
+    slot_page[slot] = page;
+    return dest[offset & PCM_PAGE_MASK];
+}
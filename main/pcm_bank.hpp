@@ -0,0 +1,100 @@
+#ifndef PCM_BANK_HPP
+#define PCM_BANK_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vgm_reader.hpp"
+
+#define PCM_PAGE_SHIFT 10
+#define PCM_PAGE_SIZE (1 << PCM_PAGE_SHIFT)
+#define PCM_PAGE_MASK (PCM_PAGE_SIZE - 1)
+
+// DAC centre, returned outside the bank
+#define PCM_SILENCE 0x80
+
+//
+// PCM data bank of one chip, built from the VGM data blocks (0x67).
+//
+// Blocks of the same type are concatenated in stream order. A page table
+// maps every 1 KB page of the bank: pages inside an uncompressed block
+// point straight at its bytes (the mapped image, or a copy when the source
+// streams), so a DAC read is one table lookup. Pages of bit-packed or
+// DPCM blocks are decoded on first use into a small round-robin cache;
+// DPCM blocks keep the running value every page, so any page decodes
+// without replaying the block from its start.
+//
+class PcmBank
+{
+public:
+    PcmBank(uint32_t cache_pages);
+    ~PcmBank();
+
+    // reader is at the data of a block of type (0x00-0x7F), moves past it
+    void add(VgmReader &reader, uint8_t type, uint32_t size);
+    void clear();
+    // exchange the banks of two songs, the next track is indexed ahead
+    void swap(PcmBank &other);
+
+    uint8_t read(uint32_t offset)
+    {
+        if(offset >= length) return PCM_SILENCE;
+        const uint8_t *page = pages[offset >> PCM_PAGE_SHIFT];
+        if(page != NULL) return page[offset & PCM_PAGE_MASK];
+        return fault(offset);
+    }
+
+    uint32_t size() const { return length; }
+
+private:
+    PcmBank(const PcmBank &);
+    PcmBank &operator=(const PcmBank &);
+
+    enum Compression { RAW, BITPACK, DPCM };
+
+    struct Block
+    {
+        uint32_t start;         // offset in the bank
+        uint32_t length;        // decoded length
+        const uint8_t *data;
+        uint32_t data_size;
+        bool owned;
+        uint8_t compression;
+        uint8_t bits_dec;
+        uint8_t bits_cmp;
+        uint8_t sub_type;
+        uint16_t add;           // bit-packing add value, DPCM start value
+        uint16_t *dpcm_state;   // DPCM value before every PCM_PAGE_SIZE values
+    };
+
+    uint8_t fault(uint32_t offset);
+    bool grow(uint32_t page_count);
+    void map_pages(uint32_t first);
+    const uint8_t *direct_page(uint32_t page) const;
+    const Block *find(uint32_t offset) const;
+    void load_table(VgmReader &reader, uint32_t size);
+    void dpcm_index(Block *block);
+    uint32_t decode_value(const Block *block, uint32_t index) const;
+    uint16_t table_value(uint32_t index) const;
+    void decode(const Block *block, uint32_t from, uint32_t to, uint8_t *dest) const;
+
+    Block *blocks;
+    uint32_t block_count;
+    uint32_t block_capacity;
+    uint32_t length;
+    size_t indexed_end;         // stream offset behind the last indexed block
+
+    const uint8_t **pages;
+    uint32_t page_capacity;
+
+    uint8_t *cache;
+    uint32_t *slot_page;
+    uint32_t cache_pages;
+    uint32_t next_slot;
+
+    // decompression table (data block 0x7F)
+    uint8_t *table;
+    uint32_t table_count;
+    uint8_t table_value_size;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <string.h>
+#include "song_archive.hpp"
+#include "vgm_reader.hpp"
+
+bool SongArchive::detect(const uint8_t *data, size_t size)
+{
+    return data != NULL && size >= ARCHIVE_HEADER_SIZE && memcmp(data, "Vga ", 4) == 0;
+}
+
+bool SongArchive::open(const uint8_t *data, size_t size)
+{
+    uint32_t count;
+
+    this->data = NULL;
+    this->size = 0;
+    songs = 0;
+    if(!detect(data, size)) return false;
+    count = vgm_load32(data + 0x08);
+    if(vgm_load32(data + 0x04) != ARCHIVE_VERSION || vgm_load32(data + 0x0c) != ARCHIVE_ENTRY_SIZE ||
+        count == 0 || count > (size - ARCHIVE_HEADER_SIZE) / ARCHIVE_ENTRY_SIZE) return false;
+
+    // checked once, song() only decodes
+    for(uint32_t i = 0; i < count; i++) {
+        const uint8_t *entry = data + ARCHIVE_HEADER_SIZE + i * ARCHIVE_ENTRY_SIZE;
+        uint32_t offset = vgm_load32(entry + 0x00);
+        uint32_t length = vgm_load32(entry + 0x04);
+        if(offset % ARCHIVE_ALIGN != 0 || offset > size || length == 0 || length > size - offset ||
+            vgm_load32(entry + 0x08) > ARCHIVE_VGC) return false;
+    }
+    this->data = data;
+    this->size = size;
+    songs = count;
+    return true;
+}
+
+bool SongArchive::song(uint32_t index, ArchiveSong *song) const
+{
+    if(index >= songs) return false;
+    const uint8_t *entry = data + ARCHIVE_HEADER_SIZE + index * ARCHIVE_ENTRY_SIZE;
+
+    song->data = data + vgm_load32(entry + 0x00);
+    song->size = vgm_load32(entry + 0x04);
+    song->format = vgm_load32(entry + 0x08);
+    song->total_samples = vgm_load32(entry + 0x0c);
+    song->loop_samples = vgm_load32(entry + 0x10);
+    song->clock_sn76489 = vgm_load32(entry + 0x14);
+    song->clock_ym2612 = vgm_load32(entry + 0x18);
+    memcpy(song->name, entry + 0x1c, ARCHIVE_NAME_SIZE);
+    song->name[ARCHIVE_NAME_SIZE] = '\0';
+    return true;
+}
+
+void SongArchive::print() const
+{
+    static const char *formats[] = { "vgm", "vgz", "vgc" };
+    ArchiveSong entry;
+
+    for(uint32_t i = 0; song(i, &entry); i++) {
+        uint32_t seconds = entry.total_samples / 44100;
+        printf("%3d %2d:%02d %s %s\n", i, seconds / 60, seconds % 60, formats[entry.format], entry.name);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef SONG_ARCHIVE_HPP
+#define SONG_ARCHIVE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// VGA, several songs in the sound partition, packed by tools/vga_pack.
+//
+// A directory at the start lists the songs with the header fields the
+// player shows or needs before opening one. Each song is stored as it was
+// given (VGM, VGZ or VGC) at a 4 KB aligned offset, on its own flash
+// sectors, and is played in place: changing tracks is a pointer change.
+//
+//   0x00 "Vga "
+//   0x04 version
+//   0x08 song count
+//   0x0c directory entry size
+//   0x10 directory, one entry per song:
+//        0x00 offset (absolute, 4 KB aligned)
+//        0x04 size
+//        0x08 format (ARCHIVE_VGM, ARCHIVE_VGZ, ARCHIVE_VGC)
+//        0x0c total samples
+//        0x10 loop samples, 0 without loop
+//        0x14 SN76489 clock
+//        0x18 YM2612 clock
+//        0x1c name, UTF-8, NUL padded
+//
+// All fields little endian.
+//
+
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_HEADER_SIZE 0x10
+#define ARCHIVE_ENTRY_SIZE 0x40
+#define ARCHIVE_NAME_SIZE (ARCHIVE_ENTRY_SIZE - 0x1c)
+// a flash sector
+#define ARCHIVE_ALIGN 4096
+
+#define ARCHIVE_VGM 0
+#define ARCHIVE_VGZ 1
+#define ARCHIVE_VGC 2
+
+struct ArchiveSong
+{
+    const uint8_t *data;
+    size_t size;
+    uint32_t format;
+    uint32_t total_samples;
+    uint32_t loop_samples;
+    uint32_t clock_sn76489;
+    uint32_t clock_ym2612;
+    char name[ARCHIVE_NAME_SIZE + 1];
+};
+
+//
+// Directory of a VGA image, read in place.
+//
+class SongArchive
+{
+public:
+    SongArchive() : data(NULL), size(0), songs(0) {}
+
+    static bool detect(const uint8_t *data, size_t size);
+    // false if it isn't a VGA image or an entry points outside it
+    bool open(const uint8_t *data, size_t size);
+
+    uint32_t count() const { return songs; }
+    bool song(uint32_t index, ArchiveSong *song) const;
+    void print() const;
+
+private:
+    const uint8_t *data;
+    size_t size;
+    uint32_t songs;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include "song_features.hpp"
+#include "vgm_command.hpp"
+
+static const char *feature_names[] = {
+    "ym2612", "sn76489", "fm", "dac", "lfo", "ssg-eg", "ch3-special", "csm",
+    "psg", "noise", "gg-stereo",
+};
+
+void SongFeatures::clear()
+{
+    flags = 0;
+    fm_mask = 0;
+    psg_mask = 0;
+    psg_latch = 0;
+    lfo_on = false;
+    lfo_modulation = false;
+}
+
+void SongFeatures::from_header(const VgmHeader &header)
+{
+    clear();
+    // before 1.10 the YM2612 clock was in the YM2413 field
+    if(header.clock_ym2612 != 0 || header.version < 0x110) {
+        flags |= FEATURE_YM2612 | FEATURE_FM | FEATURE_DAC | FEATURE_LFO | FEATURE_SSG_EG |
+            FEATURE_CH3_SPECIAL | FEATURE_CSM;
+        fm_mask = 0x3f;
+    }
+    if(header.clock_sn76489 != 0) {
+        flags |= FEATURE_SN76489 | FEATURE_PSG | FEATURE_NOISE | FEATURE_GG_STEREO;
+        psg_mask = 0x0f;
+    }
+}
+
+bool SongFeatures::scan(VgmReader &reader, uint32_t version)
+{
+    uint8_t command;
+    uint8_t reg;
+    uint32_t size;
+
+    clear();
+    while(!reader.failed()) {
+        command = reader.u8();
+        switch(command) {
+            case 0x4f:
+                gg_stereo(reader.u8());
+                break;
+            case 0x50:
+                sn76489(reader.u8());
+                break;
+            case 0x52:
+            case 0x53:
+                reg = reader.u8();
+                ym2612(command & 1, reg, reader.u8());
+                break;
+            case 0x66:
+                return true;
+            case 0x67:
+                reader.u8();
+                reader.u8();
+                size = reader.u32();
+                reader.skip(size);
+                break;
+            default:
+                // 0x8n go to the DAC, which 0x2b enables
+                reader.skip(vgm_command_size(command, version) - 1);
+                break;
+        }
+    }
+    return false;
+}
+
+void SongFeatures::ym2612(uint8_t port, uint8_t reg, uint8_t data)
+{
+    flags |= FEATURE_YM2612;
+    if(port == 0) {
+        switch(reg) {
+            case 0x22:
+                if(data & 0x08) lfo_on = true;
+                break;
+            case 0x27:
+                if(data & 0x40) flags |= FEATURE_CH3_SPECIAL;
+                if(data & 0x80) flags |= FEATURE_CSM | FEATURE_FM;
+                break;
+            case 0x28:
+                // 0-2 and 4-6 are channels, slot bits in the high nibble
+                if((data & 0xf0) && (data & 3) != 3) {
+                    fm_mask |= 1 << ((data & 3) + ((data & 4) ? 3 : 0));
+                    flags |= FEATURE_FM;
+                }
+                break;
+            case 0x2b:
+                if(data & 0x80) flags |= FEATURE_DAC;
+                break;
+        }
+    }
+    if(reg >= 0x90 && reg <= 0x9f && (data & 0x08)) flags |= FEATURE_SSG_EG;
+    if(reg >= 0xb4 && reg <= 0xb6 && (data & 0x37)) lfo_modulation = true;
+    if(lfo_on && lfo_modulation) flags |= FEATURE_LFO;
+}
+
+void SongFeatures::sn76489(uint8_t data)
+{
+    uint8_t channel;
+
+    flags |= FEATURE_SN76489;
+    // latch byte, or data byte for the latched register
+    if(data & 0x80) psg_latch = (data >> 4) & 0x07;
+    if(!(psg_latch & 1) || (data & 0x0f) == 0x0f) return;
+    channel = psg_latch >> 1;
+    psg_mask |= 1 << channel;
+    flags |= channel == 3 ? FEATURE_NOISE : FEATURE_PSG;
+}
+
+void SongFeatures::gg_stereo(uint8_t data)
+{
+    flags |= FEATURE_SN76489;
+    if(data != 0xff) flags |= FEATURE_GG_STEREO;
+}
+
+void SongFeatures::print() const
+{
+    printf("song features:");
+    for(uint32_t i = 0; i < sizeof(feature_names) / sizeof(feature_names[0]); i++) {
+        if(flags & (1 << i)) printf(" %s", feature_names[i]);
+    }
+    printf(" (fm channels %02x, psg channels %x)\n", fm_mask, psg_mask);
+}
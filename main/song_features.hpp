@@ -0,0 +1,68 @@
+#ifndef SONG_FEATURES_HPP
+#define SONG_FEATURES_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vgm_reader.hpp"
+
+enum SongFeature
+{
+    FEATURE_YM2612 = 1 << 0,        // any YM2612 write
+    FEATURE_SN76489 = 1 << 1,       // any SN76489 write
+    FEATURE_FM = 1 << 2,            // an FM channel keyed on
+    FEATURE_DAC = 1 << 3,           // DAC enabled (0x2b)
+    FEATURE_LFO = 1 << 4,           // LFO enabled (0x22) and AMS/FMS set on a channel (0xb4)
+    FEATURE_SSG_EG = 1 << 5,        // SSG-EG on an operator (0x90-0x9f)
+    FEATURE_CH3_SPECIAL = 1 << 6,   // channel 3 special mode (0x27)
+    FEATURE_CSM = 1 << 7,           // channel 3 keyed on by timer A (0x27)
+    FEATURE_PSG = 1 << 8,           // a tone channel volume other than off
+    FEATURE_NOISE = 1 << 9,         // the noise channel volume other than off
+    FEATURE_GG_STEREO = 1 << 10,    // Game Gear stereo other than all on
+};
+
+#define FEATURE_ALL 0x7ff
+
+//
+// Chips, channels and features a song uses, from one pass over its
+// commands before playing.
+//
+// The player renders only what the song can hear: a chip that is never
+// written (or never made audible) isn't updated, and the YM2612 LFO
+// kernels are only used when a channel is modulated. Sources that can't
+// be scanned cheaply take the chips from the header clocks.
+//
+class SongFeatures
+{
+public:
+    SongFeatures() { clear(); }
+
+    void clear();
+    // everything the header clocks allow, for songs that aren't scanned
+    void from_header(const VgmHeader &header);
+    // every command from the reader position to the end or the loop jump
+    bool scan(VgmReader &reader, uint32_t version);
+
+    // chip writes, in song order
+    void ym2612(uint8_t port, uint8_t reg, uint8_t data);
+    void sn76489(uint8_t data);
+    void gg_stereo(uint8_t data);
+
+    bool has(uint32_t feature) const { return (flags & feature) != 0; }
+    uint32_t all() const { return flags; }
+    // channels keyed on, bit per channel
+    uint8_t fm_channels() const { return fm_mask; }
+    // channels made audible, bit per channel (3: noise)
+    uint8_t psg_channels() const { return psg_mask; }
+
+    void print() const;
+
+private:
+    uint32_t flags;
+    uint8_t fm_mask;
+    uint8_t psg_mask;
+    uint8_t psg_latch;
+    bool lfo_on;
+    bool lfo_modulation;
+};
+
+#endif
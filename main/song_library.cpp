@@ -0,0 +1,518 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "song_library.hpp"
+#include "vgm_reader.hpp"
+#include "vgm_command.hpp"
+#include "statehash.h"
+
+#define LIBRARY_MAGIC 0x31494c56    // "VLI1"
+#define LIBRARY_PATH_MAX 256
+// read unit of the index pass, the hashed head of a file
+#define LIBRARY_READ_SIZE 4096
+// VGM sample counts are at 44.1 kHz whatever the output rate
+#define VGM_RATE 44100
+
+struct LibraryFileHeader
+{
+    uint32_t magic;
+    uint32_t record_size;
+    uint32_t count;
+    uint32_t names_size;
+};
+
+//
+// Reads a file through one buffer, a skip past it costs a seek. The index
+// pass touches the header, the tag and maybe the waits of each file once.
+//
+class FileWindow : public VgmSource
+{
+public:
+    FileWindow(FILE *file, size_t size)
+        : file(file), size(size), base(0), filled(0)
+    {
+        buffer = (uint8_t *)malloc(LIBRARY_READ_SIZE);
+    }
+
+    ~FileWindow() { free(buffer); }
+
+    size_t length() const { return size; }
+
+    const uint8_t *fetch(size_t offset, size_t count, size_t *available)
+    {
+        if(buffer == NULL || offset >= size) return NULL;
+        if(offset < base || offset - base + count > filled) {
+            if(fseek(file, offset, SEEK_SET) != 0) return NULL;
+            base = offset;
+            filled = fread(buffer, 1, LIBRARY_READ_SIZE, file);
+            if(filled == 0) return NULL;
+        }
+        *available = filled - (offset - base);
+        return buffer + (offset - base);
+    }
+
+    // the first block, which holds the header, and the GD3 tag, as a
+    // retitled song keeps its size
+    uint64_t hash()
+    {
+        size_t available;
+        size_t gd3 = 0;
+        size_t end;
+        uint64_t hash = statehash_combine(0, size);
+
+        const uint8_t *p = fetch(0, 1, &available);
+        if(p == NULL) return hash;
+        for(size_t i = 0; i < available; i++) hash = statehash_fold(hash, p[i]);
+        if(available >= 0x18) gd3 = vgm_load32(p + 0x14);
+        if(gd3 == 0 || gd3 >= size - 0x14) return hash;
+        gd3 += 0x14;
+
+        // "Gd3 ", version, length, then the strings
+        p = fetch(gd3, 12, &available);
+        if(p == NULL || available < 12) return hash;
+        end = gd3 + 12 + vgm_load32(p + 8);
+        if(end > size || end < gd3) end = size;
+        for(size_t pos = gd3; pos < end; pos += available) {
+            p = fetch(pos, 1, &available);
+            if(p == NULL) break;
+            if(available > end - pos) available = end - pos;
+            for(size_t i = 0; i < available; i++) hash = statehash_fold(hash, p[i]);
+        }
+        return hash;
+    }
+
+private:
+    FileWindow(const FileWindow &);
+    FileWindow &operator=(const FileWindow &);
+
+    FILE *file;
+    size_t size;
+    uint8_t *buffer;
+    size_t base;
+    size_t filled;
+};
+
+// one UTF-16LE string of the tag as UTF-8, cut on a character boundary
+static void gd3_string(VgmReader &reader, char *dest, size_t size)
+{
+    size_t length = 0;
+    uint32_t c;
+
+    while(!reader.failed()) {
+        c = reader.u16();
+        if(c == 0) break;
+        if(c >= 0xd800 && c < 0xdc00) {
+            size_t pos = reader.pos();
+            uint32_t low = reader.u16();
+            if(low >= 0xdc00 && low < 0xe000) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+            } else {
+                // unpaired, the unit after it is read on its own
+                c = 0xfffd;
+                reader.seek(pos);
+            }
+        } else if(c >= 0xdc00 && c < 0xe000) {
+            c = 0xfffd;
+        }
+        uint8_t bytes[4];
+        size_t n;
+        if(c < 0x80) {
+            bytes[0] = c;
+            n = 1;
+        } else if(c < 0x800) {
+            bytes[0] = 0xc0 | (c >> 6);
+            bytes[1] = 0x80 | (c & 0x3f);
+            n = 2;
+        } else if(c < 0x10000) {
+            bytes[0] = 0xe0 | (c >> 12);
+            bytes[1] = 0x80 | ((c >> 6) & 0x3f);
+            bytes[2] = 0x80 | (c & 0x3f);
+            n = 3;
+        } else {
+            bytes[0] = 0xf0 | (c >> 18);
+            bytes[1] = 0x80 | ((c >> 12) & 0x3f);
+            bytes[2] = 0x80 | ((c >> 6) & 0x3f);
+            bytes[3] = 0x80 | (c & 0x3f);
+            n = 4;
+        }
+        // the rest is still read, the next string follows it
+        if(length + n < size) {
+            memcpy(dest + length, bytes, n);
+            length += n;
+        } else {
+            size = length + 1;
+        }
+    }
+    dest[length] = '\0';
+}
+
+// UTF-8 copy cut on a character boundary to fit size
+static void utf8_copy(char *dest, const char *src, size_t size)
+{
+    size_t length = strlen(src);
+
+    if(length >= size) {
+        length = size - 1;
+        while(length > 0 && (src[length] & 0xc0) == 0x80) length--;
+    }
+    memcpy(dest, src, length);
+    dest[length] = '\0';
+}
+
+// English string, the Japanese one when that is empty
+static void gd3_pair(VgmReader &reader, char *dest, size_t size)
+{
+    char other[LIBRARY_TAG_MAX];
+
+    gd3_string(reader, dest, size);
+    gd3_string(reader, other, sizeof(other));
+    if(dest[0] == '\0') utf8_copy(dest, other, size);
+}
+
+static bool read_gd3(FileWindow &source, uint32_t offset, Gd3Tag *tag)
+{
+    VgmReader reader(&source);
+    char magic[4];
+
+    memset(tag, 0, sizeof(*tag));
+    if(!reader.seek(offset) || !reader.read((uint8_t *)magic, sizeof(magic)) || memcmp(magic, "Gd3 ", 4) != 0) {
+        return false;
+    }
+    reader.u32();
+    size_t end = reader.u32();
+    reader = VgmReader(&source, reader.pos() + end);
+    reader.seek(offset + 12);
+    gd3_pair(reader, tag->title, sizeof(tag->title));
+    gd3_pair(reader, tag->game, sizeof(tag->game));
+    gd3_pair(reader, tag->system, sizeof(tag->system));
+    gd3_pair(reader, tag->author, sizeof(tag->author));
+    gd3_string(reader, tag->date, sizeof(tag->date));
+    gd3_string(reader, tag->ripper, sizeof(tag->ripper));
+    return true;
+}
+
+// sample counts from the waits, for headers without them
+static void scan_waits(FileWindow &source, const VgmHeader &header, SongEntry *entry)
+{
+    VgmReader reader(&source, header.eof_offset);
+    uint32_t time = 0;
+    uint32_t loop_time = 0;
+    bool looped = false;
+    uint8_t command;
+
+    reader.seek(header.data_offset);
+    while(!reader.failed()) {
+        if(!looped && header.loop_offset != 0 && reader.pos() >= header.loop_offset) {
+            loop_time = time;
+            looped = true;
+        }
+        command = reader.u8();
+        if(command == 0x66) break;
+        if(command == 0x61) {
+            time += reader.u16();
+        } else if(command == 0x62) {
+            time += 735;
+        } else if(command == 0x63) {
+            time += 882;
+        } else if(command >= 0x70 && command <= 0x7f) {
+            time += (command & 0x0f) + 1;
+        } else if(command >= 0x80 && command <= 0x8f) {
+            time += command & 0x0f;
+        } else if(command == 0x67) {
+            reader.skip(2);
+            reader.skip(reader.u32());
+        } else {
+            reader.skip(vgm_command_size(command, header.version) - 1);
+        }
+    }
+    entry->total_samples = time;
+    entry->loop_samples = looped ? time - loop_time : 0;
+    entry->flags |= SONG_SCANNED;
+}
+
+static bool is_song(const char *name)
+{
+    size_t length = strlen(name);
+
+    return length > 4 && strcasecmp(name + length - 4, ".vgm") == 0;
+}
+
+// qsort has no context argument, the pool of the library being sorted
+static const char *sort_names;
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(sort_names + ((const SongEntry *)a)->name, sort_names + ((const SongEntry *)b)->name);
+}
+
+SongLibrary::SongLibrary()
+    : dir(NULL), entries(NULL), entry_count(0), entry_capacity(0),
+      names(NULL), names_size(0), names_capacity(0)
+{
+}
+
+SongLibrary::~SongLibrary()
+{
+    close();
+}
+
+void SongLibrary::close()
+{
+    free(dir);
+    free(entries);
+    free(names);
+    dir = NULL;
+    entries = NULL;
+    names = NULL;
+    entry_count = entry_capacity = 0;
+    names_size = names_capacity = 0;
+}
+
+bool SongLibrary::open(const char *dir)
+{
+    DIR *d;
+
+    close();
+    d = opendir(dir);
+    if(d == NULL) return false;
+    closedir(d);
+    this->dir = strdup(dir);
+    if(this->dir == NULL) return false;
+    // a missing or stale index is rebuilt by update()
+    if(!load()) {
+        free(entries);
+        free(names);
+        entries = NULL;
+        names = NULL;
+        entry_count = entry_capacity = 0;
+        names_size = names_capacity = 0;
+    }
+    return true;
+}
+
+bool SongLibrary::load()
+{
+    char path[LIBRARY_PATH_MAX];
+    LibraryFileHeader header;
+    bool ok;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, LIBRARY_INDEX_NAME);
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return false;
+    if(fread(&header, sizeof(header), 1, file) != 1 || header.magic != LIBRARY_MAGIC ||
+        header.record_size != sizeof(SongEntry) || header.names_size == 0 ||
+        header.count > UINT32_MAX / sizeof(SongEntry)) {
+        fclose(file);
+        return false;
+    }
+    entries = (SongEntry *)malloc(header.count * sizeof(SongEntry) + sizeof(SongEntry));
+    names = (char *)malloc(header.names_size);
+    ok = entries != NULL && names != NULL &&
+        fread(entries, sizeof(SongEntry), header.count, file) == header.count &&
+        fread(names, 1, header.names_size, file) == header.names_size;
+    fclose(file);
+    if(!ok || names[header.names_size - 1] != '\0') return false;
+    for(uint32_t i = 0; i < header.count; i++) {
+        if(entries[i].name >= header.names_size) return false;
+        entries[i].title[LIBRARY_TITLE_MAX - 1] = '\0';
+    }
+    entry_count = entry_capacity = header.count;
+    names_size = names_capacity = header.names_size;
+    return true;
+}
+
+bool SongLibrary::save() const
+{
+    char path[LIBRARY_PATH_MAX];
+    LibraryFileHeader header;
+    bool ok;
+
+    if(dir == NULL) return false;
+    snprintf(path, sizeof(path), "%s/%s", dir, LIBRARY_INDEX_NAME);
+    FILE *file = fopen(path, "wb");
+    if(file == NULL) return false;
+    header.magic = LIBRARY_MAGIC;
+    header.record_size = sizeof(SongEntry);
+    header.count = entry_count;
+    header.names_size = names_size;
+    ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(entries, sizeof(SongEntry), entry_count, file) == entry_count &&
+        fwrite(names, 1, names_size, file) == names_size;
+    ok = fclose(file) == 0 && ok;
+    // a partial file would fail the next load anyway
+    if(!ok) remove(path);
+    return ok;
+}
+
+uint32_t SongLibrary::update()
+{
+    char path[LIBRARY_PATH_MAX];
+    struct dirent *file;
+    struct stat info;
+    SongLibrary known;
+    SongEntry entry;
+    uint32_t read = 0;
+    uint32_t kept = 0;
+
+    if(dir == NULL) return 0;
+    DIR *d = opendir(dir);
+    if(d == NULL) return 0;
+
+    // the old index, looked up by name while the new one is built
+    known.entries = entries;
+    known.entry_count = entry_count;
+    known.names = names;
+    entries = NULL;
+    names = NULL;
+    entry_count = entry_capacity = 0;
+    names_size = names_capacity = 0;
+
+    while((file = readdir(d)) != NULL) {
+        if(!is_song(file->d_name)) continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, file->d_name);
+        if(stat(path, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+
+        const SongEntry *old = known.find(file->d_name);
+        if(old != NULL) kept++;
+        if(old != NULL && old->size == (uint32_t)info.st_size && old->mtime == (uint32_t)info.st_mtime) {
+            add(*old, file->d_name);
+            continue;
+        }
+        memset(&entry, 0, sizeof(entry));
+        entry.size = info.st_size;
+        entry.mtime = info.st_mtime;
+        if(!index_file(path, old, &entry)) continue;
+        add(entry, file->d_name);
+        read++;
+    }
+    closedir(d);
+    sort();
+    // files that went away are a change too
+    return read + known.entry_count - kept;
+}
+
+bool SongLibrary::index_file(const char *path, const SongEntry *old, SongEntry *entry) const
+{
+    VgmHeader header;
+    Gd3Tag tag;
+
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return false;
+    FileWindow source(file, entry->size);
+
+    entry->hash = source.hash();
+    if(old != NULL && old->size == entry->size && old->hash == entry->hash) {
+        // touched, not changed
+        uint32_t mtime = entry->mtime;
+        *entry = *old;
+        entry->mtime = mtime;
+        fclose(file);
+        return true;
+    }
+
+    VgmReader reader(&source);
+    if(!reader.header(&header)) {
+        entry->flags = SONG_INVALID;
+        fclose(file);
+        return true;
+    }
+    entry->total_samples = header.total_samples;
+    entry->loop_samples = header.loop_offset != 0 ? header.loop_samples : 0;
+    entry->gd3_offset = header.gd3_offset;
+    if(entry->total_samples == 0) scan_waits(source, header, entry);
+    if(entry->gd3_offset != 0 && read_gd3(source, entry->gd3_offset, &tag)) {
+        utf8_copy(entry->title, tag.title, sizeof(entry->title));
+    }
+    fclose(file);
+    return true;
+}
+
+const SongEntry *SongLibrary::find(const char *name) const
+{
+    uint32_t low = 0, high = entry_count;
+
+    while(low < high) {
+        uint32_t mid = (low + high) / 2;
+        int order = strcmp(names + entries[mid].name, name);
+        if(order == 0) return &entries[mid];
+        if(order < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+bool SongLibrary::add(const SongEntry &entry, const char *name)
+{
+    uint32_t length = strlen(name) + 1;
+
+    if(entry_count == entry_capacity) {
+        uint32_t capacity = entry_capacity ? entry_capacity * 2 : 64;
+        SongEntry *grown = (SongEntry *)realloc(entries, capacity * sizeof(SongEntry));
+        if(grown == NULL) return false;
+        entries = grown;
+        entry_capacity = capacity;
+    }
+    if(names_size + length > names_capacity) {
+        uint32_t capacity = names_capacity ? names_capacity : 1024;
+        while(capacity < names_size + length) capacity *= 2;
+        char *grown = (char *)realloc(names, capacity);
+        if(grown == NULL) return false;
+        names = grown;
+        names_capacity = capacity;
+    }
+    memcpy(names + names_size, name, length);
+    entries[entry_count] = entry;
+    entries[entry_count].name = names_size;
+    entry_count++;
+    names_size += length;
+    return true;
+}
+
+void SongLibrary::sort()
+{
+    if(entry_count < 2) return;
+    sort_names = names;
+    qsort(entries, entry_count, sizeof(SongEntry), compare_entries);
+}
+
+uint32_t SongLibrary::length_ms(uint32_t index) const
+{
+    return (uint64_t)entries[index].total_samples * 1000 / VGM_RATE;
+}
+
+bool SongLibrary::tag(uint32_t index, Gd3Tag *tag) const
+{
+    char path[LIBRARY_PATH_MAX];
+    bool ok;
+
+    memset(tag, 0, sizeof(*tag));
+    if(entries[index].gd3_offset == 0) return false;
+    snprintf(path, sizeof(path), "%s/%s", dir, name(index));
+    FILE *file = fopen(path, "rb");
+    if(file == NULL) return false;
+    FileWindow source(file, entries[index].size);
+    ok = read_gd3(source, entries[index].gd3_offset, tag);
+    fclose(file);
+    return ok;
+}
+
+void SongLibrary::print() const
+{
+    for(uint32_t i = 0; i < entry_count; i++) {
+        const SongEntry &song = entries[i];
+        uint32_t seconds = length_ms(i) / 1000;
+
+        if(song.flags & SONG_INVALID) {
+            printf("%4d %s (not a vgm file)\n", i, name(i));
+            continue;
+        }
+        printf("%4d %2d:%02d%s %s\n", i, seconds / 60, seconds % 60, song.loop_samples != 0 ? " loop" : "     ",
+            song.title[0] != '\0' ? song.title : name(i));
+    }
+}
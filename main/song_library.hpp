@@ -0,0 +1,101 @@
+#ifndef SONG_LIBRARY_HPP
+#define SONG_LIBRARY_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// index file inside the song directory
+#define LIBRARY_INDEX_NAME "library.idx"
+#define LIBRARY_TITLE_MAX 40
+#define LIBRARY_TAG_MAX 64
+
+// durations are counted by a wait scan, the header had none
+#define SONG_SCANNED 0x01
+// not a VGM file (or a truncated one), kept so it isn't read again
+#define SONG_INVALID 0x02
+
+// one file of the library, as stored in the index
+struct SongEntry
+{
+    uint32_t size;
+    uint32_t mtime;
+    uint64_t hash;          // the file's first block and GD3 tag
+    uint32_t total_samples; // 44.1 kHz
+    uint32_t loop_samples;  // 0 when the song doesn't loop
+    uint32_t gd3_offset;    // absolute, 0 without a tag
+    uint32_t name;          // into the name pool
+    uint32_t flags;
+    char title[LIBRARY_TITLE_MAX];  // UTF-8, cut to fit
+};
+
+// GD3 strings in UTF-8, English where the tag has it
+struct Gd3Tag
+{
+    char title[LIBRARY_TAG_MAX];
+    char game[LIBRARY_TAG_MAX];
+    char system[LIBRARY_TAG_MAX];
+    char author[LIBRARY_TAG_MAX];
+    char date[LIBRARY_TAG_MAX];
+    char ripper[LIBRARY_TAG_MAX];
+};
+
+//
+// Track list of a directory of VGM files, cached on disk.
+//
+// update() stats every .vgm file and only opens the ones whose size or
+// modification time changed since the index was saved: the header gives
+// the sample counts and the GD3 offset, the track title is read from the
+// tag. Songs without sample counts are measured by a scan that reads the
+// waits and skips everything else. A file that was touched but hashes the
+// same (header block and tag) keeps its entry.
+//
+// Only the title is cached, the rest of the tag is read from the file when
+// tag() asks for it.
+//
+// Compressed .vgz files are left out. GzipSource inflates from an image in
+// memory, so indexing one would read the whole file into internal RAM (no
+// PSRAM here), and the SD player only streams plain VGM, so a .vgz in the
+// list couldn't be played anyway.
+//
+class SongLibrary
+{
+public:
+    SongLibrary();
+    ~SongLibrary();
+
+    // directory of songs, its index is loaded when there is a usable one
+    bool open(const char *dir);
+    void close();
+    // rescan the directory, returns the number of files read or gone
+    uint32_t update();
+    bool save() const;
+
+    // entries are sorted by file name
+    uint32_t count() const { return entry_count; }
+    const SongEntry &entry(uint32_t index) const { return entries[index]; }
+    const char *name(uint32_t index) const { return names + entries[index].name; }
+    uint32_t length_ms(uint32_t index) const;
+
+    bool tag(uint32_t index, Gd3Tag *tag) const;
+    void print() const;
+
+private:
+    SongLibrary(const SongLibrary &);
+    SongLibrary &operator=(const SongLibrary &);
+
+    bool load();
+    bool index_file(const char *path, const SongEntry *old, SongEntry *entry) const;
+    const SongEntry *find(const char *name) const;
+    bool add(const SongEntry &entry, const char *name);
+    void sort();
+
+    char *dir;
+    SongEntry *entries;
+    uint32_t entry_count;
+    uint32_t entry_capacity;
+    char *names;
+    uint32_t names_size;
+    uint32_t names_capacity;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// Lock-free ring between exactly one producer and one consumer thread.
+//
+// head is only written by the consumer, tail only by the producer; the
+// release store of one and the acquire load by the other publish the item
+// slots in between. Size is a power of two, the free running indices wrap.
+//
+template<typename T, uint32_t SIZE>
+class SpscQueue
+{
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // producer, false when full
+    bool push(const T &item)
+    {
+        uint32_t t = tail;
+        if(t - __atomic_load_n(&head, __ATOMIC_ACQUIRE) == SIZE) return false;
+        items[t & (SIZE - 1)] = item;
+        __atomic_store_n(&tail, t + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // consumer, oldest item or NULL when empty; valid until pop()
+    T *front()
+    {
+        uint32_t h = head;
+        if(h == __atomic_load_n(&tail, __ATOMIC_ACQUIRE)) return NULL;
+        return &items[h & (SIZE - 1)];
+    }
+
+    void pop()
+    {
+        __atomic_store_n(&head, head + 1, __ATOMIC_RELEASE);
+    }
+
+    // only while neither side runs
+    void clear()
+    {
+        head = tail = 0;
+    }
+
+private:
+    SpscQueue(const SpscQueue &);
+    SpscQueue &operator=(const SpscQueue &);
+
+    static_assert((SIZE & (SIZE - 1)) == 0, "queue size must be a power of two");
+
+    T items[SIZE];
+    // on separate cache lines, each side writes its own
+    alignas(64) uint32_t head;
+    alignas(64) uint32_t tail;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#else
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#endif
+
+//
+// Minimal threading for the player: FreeRTOS tasks pinned to a core on the
+// device, std::thread on the host. Core and priority are ignored on the
+// host.
+//
+
+#define TASK_WAIT_FOREVER UINT32_MAX
+
+class Mutex
+{
+public:
+#ifdef ESP_PLATFORM
+    Mutex() { handle = xSemaphoreCreateMutex(); }
+    ~Mutex() { vSemaphoreDelete(handle); }
+    void lock() { xSemaphoreTake(handle, portMAX_DELAY); }
+    void unlock() { xSemaphoreGive(handle); }
+#else
+    Mutex() {}
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+#endif
+
+private:
+    Mutex(const Mutex &);
+    Mutex &operator=(const Mutex &);
+#ifdef ESP_PLATFORM
+    SemaphoreHandle_t handle;
+#else
+    std::mutex mutex;
+#endif
+};
+
+//
+// Auto-reset event: a signal() before wait() isn't lost, several signals
+// before a wait() wake it once.
+//
+class Event
+{
+public:
+#ifdef ESP_PLATFORM
+    Event() { handle = xSemaphoreCreateBinary(); }
+    ~Event() { vSemaphoreDelete(handle); }
+    void signal() { xSemaphoreGive(handle); }
+    // false on timeout
+    bool wait(uint32_t timeout_ms = TASK_WAIT_FOREVER)
+    {
+        TickType_t ticks = timeout_ms == TASK_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+        return xSemaphoreTake(handle, ticks) == pdTRUE;
+    }
+#else
+    Event() : flag(false) {}
+    void signal()
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        flag = true;
+        cond.notify_one();
+    }
+    bool wait(uint32_t timeout_ms = TASK_WAIT_FOREVER)
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        if(timeout_ms == TASK_WAIT_FOREVER) {
+            cond.wait(guard, [this] { return flag; });
+        } else if(!cond.wait_for(guard, std::chrono::milliseconds(timeout_ms), [this] { return flag; })) {
+            return false;
+        }
+        flag = false;
+        return true;
+    }
+#endif
+
+private:
+    Event(const Event &);
+    Event &operator=(const Event &);
+#ifdef ESP_PLATFORM
+    SemaphoreHandle_t handle;
+#else
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool flag;
+#endif
+};
+
+class Task
+{
+public:
+    Task() : entry(NULL), arg(NULL), running(false) {}
+    ~Task() { join(); }
+
+    bool start(const char *name, void (*entry)(void *), void *arg, int core, int priority, uint32_t stack)
+    {
+        if(running) return false;
+        this->entry = entry;
+        this->arg = arg;
+#ifdef ESP_PLATFORM
+        if(xTaskCreatePinnedToCore(trampoline, name, stack, this, priority, NULL, core) != pdPASS) return false;
+#else
+        (void)name;
+        (void)core;
+        (void)priority;
+        (void)stack;
+        thread = std::thread(trampoline, this);
+#endif
+        running = true;
+        return true;
+    }
+
+    // wait for the entry function to return
+    void join()
+    {
+        if(!running) return;
+#ifdef ESP_PLATFORM
+        done.wait();
+#else
+        thread.join();
+#endif
+        running = false;
+    }
+
+private:
+    Task(const Task &);
+    Task &operator=(const Task &);
+
+    static void trampoline(void *self)
+    {
+        Task *task = (Task *)self;
+        task->entry(task->arg);
+#ifdef ESP_PLATFORM
+        task->done.signal();
+        vTaskDelete(NULL);
+#endif
+    }
+
+    void (*entry)(void *);
+    void *arg;
+    bool running;
+#ifdef ESP_PLATFORM
+    Event done;
+#else
+    std::thread thread;
+#endif
+};
+
+#endif
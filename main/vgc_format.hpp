@@ -0,0 +1,92 @@
+#ifndef VGC_FORMAT_HPP
+#define VGC_FORMAT_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "vgm_reader.hpp"
+
+//
+// VGC, a VGM song precompiled on the host by tools/vgc_compile.
+//
+// The compiler keeps only what the player emulates: register writes are
+// combined with their port, runs of writes share one opcode byte, writes
+// the YM2612 would discard as unchanged are dropped, waits are merged and
+// the PCM data blocks are decoded into one flat region. The image is read
+// in place from flash.
+//
+//   0x00 "Vgc "
+//   0x04 version
+//   0x08 SN76489 clock
+//   0x0c YM2612 clock
+//   0x10 total samples
+//   0x14 loop samples
+//   0x18 event stream offset
+//   0x1c event stream size
+//   0x20 loop offset (absolute, into the event stream), 0 without loop
+//   0x24 PCM offset
+//   0x28 PCM size
+//   0x2c reserved
+//
+// All fields little endian.
+//
+
+#define VGC_VERSION 1
+#define VGC_HEADER_SIZE 0x30
+
+// events, a write group opcode carries its count - 1 in the low 6 bits
+#define VGC_YM2612_PORT0 0x00   // n (reg, data) pairs for port 0
+#define VGC_YM2612_PORT1 0x40   // n (reg, data) pairs for port 1
+#define VGC_SN76489 0x80        // n data bytes
+#define VGC_DAC 0xc0            // next PCM byte to the DAC, then wait (low 5 bits)
+#define VGC_WAIT 0xe0           // wait (low 4 bits) + 1 samples
+#define VGC_WAIT16 0xf0         // wait u16 samples
+#define VGC_PCM_SEEK 0xf1       // u32 PCM offset
+#define VGC_GG_STEREO 0xf2      // data
+#define VGC_END 0xff            // loop, or the end of the song
+
+#define VGC_GROUP_MAX 64
+#define VGC_DAC_WAIT_MAX 31
+#define VGC_WAIT_SHORT_MAX 16
+
+struct VgcHeader
+{
+    uint32_t version;
+    uint32_t clock_sn76489;
+    uint32_t clock_ym2612;
+    uint32_t total_samples;
+    uint32_t loop_samples;
+    uint32_t events_offset;
+    uint32_t events_size;
+    uint32_t loop_offset;
+    uint32_t pcm_offset;
+    uint32_t pcm_size;
+};
+
+// decode and range check the header, false if it isn't a VGC image
+static inline bool vgc_header(const uint8_t *p, size_t size, VgcHeader *header)
+{
+    memset(header, 0, sizeof(*header));
+    if(p == NULL || size < VGC_HEADER_SIZE || memcmp(p, "Vgc ", 4) != 0) return false;
+
+    header->version = vgm_load32(p + 0x04);
+    header->clock_sn76489 = vgm_load32(p + 0x08);
+    header->clock_ym2612 = vgm_load32(p + 0x0c);
+    header->total_samples = vgm_load32(p + 0x10);
+    header->loop_samples = vgm_load32(p + 0x14);
+    header->events_offset = vgm_load32(p + 0x18);
+    header->events_size = vgm_load32(p + 0x1c);
+    header->loop_offset = vgm_load32(p + 0x20);
+    header->pcm_offset = vgm_load32(p + 0x24);
+    header->pcm_size = vgm_load32(p + 0x28);
+
+    if(header->version != VGC_VERSION) return false;
+    if(header->events_offset < VGC_HEADER_SIZE || header->events_offset > size || header->events_size == 0 ||
+        header->events_size > size - header->events_offset) return false;
+    if(header->pcm_offset > size || header->pcm_size > size - header->pcm_offset) return false;
+    if(header->loop_offset != 0 && (header->loop_offset < header->events_offset ||
+        header->loop_offset - header->events_offset >= header->events_size)) return false;
+    return true;
+}
+
+#endif
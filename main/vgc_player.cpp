@@ -0,0 +1,166 @@
+#include "vgc_player.hpp"
+#include "ym2612.hpp"
+
+// DAC centre outside the PCM region
+#define VGC_DAC_SILENCE 0x80
+
+// size of the event at p, 0 when it doesn't fit in count bytes
+static size_t event_size(const uint8_t *p, size_t count)
+{
+    uint8_t op = p[0];
+    size_t size;
+
+    if(op < VGC_SN76489) {
+        size = 1 + 2 * ((op & 0x3f) + 1);
+    } else if(op < VGC_DAC) {
+        size = 1 + (op & 0x3f) + 1;
+    } else if(op < VGC_WAIT16 || op == VGC_END) {
+        size = 1;
+    } else if(op == VGC_WAIT16) {
+        size = 3;
+    } else if(op == VGC_PCM_SEEK) {
+        size = 5;
+    } else if(op == VGC_GG_STEREO) {
+        size = 2;
+    } else {
+        return 0;
+    }
+    return size <= count ? size : 0;
+}
+
+VgcPlayer::VgcPlayer()
+    : events(NULL), cursor(NULL), loop(NULL), pcm(NULL), pcm_cursor(0), psg(NULL), end(true)
+{
+    memset(&info, 0, sizeof(info));
+}
+
+bool VgcPlayer::detect(const uint8_t *data, size_t size)
+{
+    VgcHeader header;
+    return vgc_header(data, size, &header);
+}
+
+bool VgcPlayer::open(const uint8_t *data, size_t size)
+{
+    size_t pos = 0;
+    bool loop_found = false;
+
+    end = true;
+    if(!vgc_header(data, size, &info)) return false;
+    events = data + info.events_offset;
+    loop = info.loop_offset != 0 ? data + info.loop_offset : NULL;
+
+    // every event fits, the loop is on an event and the stream ends with VGC_END
+    for(;;) {
+        size_t n = event_size(events + pos, info.events_size - pos);
+        if(n == 0) return false;
+        if(events + pos == loop) loop_found = true;
+        if(events[pos] == VGC_END) {
+            if(pos + n != info.events_size) return false;
+            break;
+        }
+        pos += n;
+    }
+    if(loop != NULL && !loop_found) return false;
+
+    cursor = events;
+    pcm = data + info.pcm_offset;
+    pcm_cursor = 0;
+    end = false;
+    return true;
+}
+
+void VgcPlayer::scan(SongFeatures *features) const
+{
+    const uint8_t *p = events;
+
+    features->clear();
+    if(end) return;
+    // open() checked every event, the stream ends with VGC_END
+    while(*p != VGC_END) {
+        uint8_t op = *p;
+        size_t n = event_size(p, info.events_size - (p - events));
+        if(op < VGC_SN76489) {
+            for(size_t i = 1; i < n; i += 2) features->ym2612(op >> 6, p[i], p[i + 1]);
+        } else if(op < VGC_DAC) {
+            for(size_t i = 1; i < n; i++) features->sn76489(p[i]);
+        } else if(op == VGC_GG_STEREO) {
+            features->gg_stereo(p[1]);
+        }
+        p += n;
+    }
+}
+
+uint32_t VgcPlayer::step()
+{
+    const uint8_t *p = cursor;
+    uint32_t wait;
+
+    if(end) return 0;
+    for(;;) {
+        uint8_t op = *p++;
+        uint32_t n = (op & 0x3f) + 1;
+        switch(op >> 6) {
+            case 0:
+                do {
+                    YM2612_Write(0, p[0]);
+                    YM2612_Write(1, p[1]);
+                    p += 2;
+                } while(--n);
+                break;
+            case 1:
+                do {
+                    YM2612_Write(2, p[0]);
+                    YM2612_Write(3, p[1]);
+                    p += 2;
+                } while(--n);
+                break;
+            case 2:
+                do {
+                    SN76489_Write(psg, *p++);
+                } while(--n);
+                break;
+            default:
+                if(op < VGC_WAIT) {
+                    YM2612_Write(0, 0x2a);
+                    YM2612_Write(1, pcm_cursor < info.pcm_size ? pcm[pcm_cursor] : VGC_DAC_SILENCE);
+                    pcm_cursor++;
+                    wait = op & VGC_DAC_WAIT_MAX;
+                    if(wait == 0) break;
+                    cursor = p;
+                    return wait;
+                }
+                if(op < VGC_WAIT16) {
+                    cursor = p;
+                    return (op & 0x0f) + 1;
+                }
+                switch(op) {
+                    case VGC_WAIT16:
+                        cursor = p + 2;
+                        return vgm_load16(p);
+                    case VGC_PCM_SEEK:
+                        pcm_cursor = vgm_load32(p);
+                        p += 4;
+                        break;
+                    case VGC_GG_STEREO:
+                        SN76489_GGStereoWrite(psg, *p++);
+                        break;
+                    default:
+                        // VGC_END, open() allows nothing else
+                        if(loop == NULL) {
+                            cursor = p - 1;
+                            end = true;
+                            return 0;
+                        }
+                        p = loop;
+                        break;
+                }
+                break;
+        }
+        // stop on the loop point for the loop cache
+        if(p == loop) {
+            cursor = p;
+            return 0;
+        }
+    }
+}
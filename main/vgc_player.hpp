@@ -0,0 +1,49 @@
+#ifndef VGC_PLAYER_HPP
+#define VGC_PLAYER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vgc_format.hpp"
+#include "song_features.hpp"
+extern "C" {
+#include "sn76489.h"
+}
+
+//
+// Plays a VGC image (see vgc_format.hpp) in place.
+//
+// open() walks the event stream once, so step() runs without bounds
+// checks: one opcode dispatch per write group, DAC writes without a wait
+// don't return to the caller.
+//
+class VgcPlayer
+{
+public:
+    VgcPlayer();
+
+    static bool detect(const uint8_t *data, size_t size);
+    bool open(const uint8_t *data, size_t size);
+    void set_psg(SN76489_Context *psg) { this->psg = psg; }
+    const VgcHeader &header() const { return info; }
+    // chip writes of the whole stream, after open()
+    void scan(SongFeatures *features) const;
+
+    // play events up to the next wait or the loop point, returns the wait
+    uint32_t step();
+
+    bool ended() const { return end; }
+    bool at_loop() const { return loop != NULL && cursor == loop; }
+    uint32_t pcm_position() const { return pcm_cursor; }
+
+private:
+    VgcHeader info;
+    const uint8_t *events;
+    const uint8_t *cursor;
+    const uint8_t *loop;
+    const uint8_t *pcm;
+    uint32_t pcm_cursor;
+    SN76489_Context *psg;
+    bool end;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#include "vgm_command.hpp"
+
+// opcodes without a defined length are taken as a single byte
+const uint8_t vgm_command_length[256] = {
+    // 0x00-0x2f unused
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    // 0x30 2nd SN76489, 0x31 AY8910 stereo mask, 0x3f 2nd GG stereo, others reserved: dd
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    // 0x40 Mikey, others reserved: aa dd / 0x4f GG stereo: dd
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 2,
+    // 0x50 SN76489: dd / 0x51-0x5f YM2413, YM2612, YM2151 ... YMF278B, YMF271, YMZ280B: aa dd
+    2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    // 0x61 wait nnnn, 0x62/0x63 wait frame, 0x66 end, 0x67 data block, 0x68 PCM RAM write
+    1, 3, 1, 1, 1, 1, 1, 0, 12, 1, 1, 1, 1, 1, 1, 1,
+    // 0x70-0x7f wait n+1
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    // 0x80-0x8f YM2612 DAC write from the data bank, wait n
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    // 0x90-0x95 DAC stream control
+    5, 5, 6, 11, 2, 5, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    // 0xa0 AY8910, 0xb0-0xbf RF5C68 ... GA20, others reserved: aa dd
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+    // 0xc0-0xdf Sega PCM, RF5C68 memory, MultiPCM, QSound, K054539 ...: pp aa dd
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    // 0xe0 PCM seek, 0xe1 C352, others reserved: dd dd dd dd
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+};
@@ -0,0 +1,27 @@
+#ifndef VGM_COMMAND_HPP
+#define VGM_COMMAND_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+//
+// VGM 1.71 command lengths.
+//
+// Every opcode has a fixed size except the data block (0x67), whose size
+// follows in its header, so commands for chips the player doesn't emulate
+// can be stepped over without decoding them.
+//
+
+// Size in bytes including the opcode, 0 for the data block
+// (0x67 0x66 tt ss ss ss ss, followed by ss bytes).
+extern const uint8_t vgm_command_length[256];
+
+// Size of a fixed length command. Before 1.60 the reserved 0x40-0x4E
+// opcodes took one operand instead of two.
+inline uint32_t vgm_command_size(uint8_t command, uint32_t version)
+{
+    if(command >= 0x40 && command <= 0x4e && version < 0x160) return 2;
+    return vgm_command_length[command];
+}
+
+#endif
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include "vgm_file.hpp"
+#include "vgm_reader.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+// prefetch task, on the one core of this build (CONFIG_FREERTOS_UNICORE);
+// above the renderer, but it mostly waits on the card or for a free block
+#define PREFETCH_CORE 0
+#define PREFETCH_PRIORITY 3
+#define PREFETCH_STACK 3072
+
+#define VGM_SAMPLE_RATE 44100
+
+// keep some internal RAM for the rest of the player
+#define INTERNAL_RESERVE 48 * 1024
+
+// one block at a time, a fragmented heap still gives a shorter ring
+static uint8_t *alloc_block()
+{
+#ifdef ESP_PLATFORM
+    if(heap_caps_get_free_size(MALLOC_CAP_8BIT) < INTERNAL_RESERVE + FILE_BLOCK_SIZE) return NULL;
+    return (uint8_t *)heap_caps_malloc(FILE_BLOCK_SIZE, MALLOC_CAP_8BIT);
+#else
+    return (uint8_t *)malloc(FILE_BLOCK_SIZE);
+#endif
+}
+
+FileSource::FileSource()
+    : file(NULL), size(0), song_end(0), blocks(NULL), block_count(0),
+      retained(NULL), retain_offset(0), retained_size(0),
+      filled(0), consumed(0), generation(0), next_read(0),
+      running(false), read_error(false), underrun_count(0)
+{
+}
+
+FileSource::~FileSource()
+{
+    close();
+}
+
+bool FileSource::open(const char *path)
+{
+    struct stat st;
+    uint8_t header[0x40];
+    uint32_t rate = 0;
+
+    close();
+    file = fopen(path, "rb");
+    if(file == NULL) return false;
+    if(fstat(fileno(file), &st) != 0 || st.st_size <= 0) {
+        close();
+        return false;
+    }
+    size = st.st_size;
+    song_end = size;
+
+    // size the ring from the song data rate
+    if(read_at(0, header, sizeof(header)) == sizeof(header) && memcmp(header, "Vgm ", 4) == 0) {
+        uint32_t eof = vgm_load32(header + 0x04);
+        uint32_t samples = vgm_load32(header + 0x18);
+        if(eof != 0 && eof <= size - 0x04) song_end = 0x04 + eof;
+        if(samples >= VGM_SAMPLE_RATE && song_end > sizeof(header)) {
+            rate = (uint32_t)((uint64_t)(song_end - sizeof(header)) * VGM_SAMPLE_RATE / samples);
+        }
+    }
+    uint32_t wanted = (uint32_t)((uint64_t)rate * FILE_READ_AHEAD_MS / 1000 / FILE_BLOCK_SIZE) + 1;
+    if(wanted < FILE_BLOCKS_MIN) wanted = FILE_BLOCKS_MIN;
+    if(wanted > FILE_BLOCKS_MAX) wanted = FILE_BLOCKS_MAX;
+
+    // fewer blocks than wanted when internal RAM is short, down to the minimum
+    blocks = (Block *)malloc(wanted * sizeof(Block));
+    if(blocks == NULL) {
+        close();
+        return false;
+    }
+    for(block_count = 0; block_count < wanted; block_count++) {
+        uint8_t *data = alloc_block();
+        if(data == NULL) break;
+        blocks[block_count].offset = 0;
+        blocks[block_count].length = 0;
+        blocks[block_count].data = data;
+    }
+    if(block_count < FILE_BLOCKS_MIN) {
+        printf("vgm file: no memory for %d read blocks\n", FILE_BLOCKS_MIN);
+        close();
+        return false;
+    }
+    if(block_count < wanted) printf("vgm file: %d of %d read blocks\n", block_count, wanted);
+
+    filled = consumed = 0;
+    next_read = 0;
+    read_error = false;
+    underrun_count = 0;
+    running = true;
+    if(!task.start("vgm_prefetch", prefetch_entry, this, PREFETCH_CORE, PREFETCH_PRIORITY, PREFETCH_STACK)) {
+        running = false;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FileSource::close()
+{
+    lock.lock();
+    bool was_running = running;
+    running = false;
+    lock.unlock();
+    if(was_running) {
+        space.signal();
+        task.join();
+    }
+    if(file != NULL) fclose(file);
+    file = NULL;
+    for(uint32_t i = 0; i < block_count; i++) free(blocks[i].data);
+    free(blocks);
+    free(retained);
+    blocks = NULL;
+    retained = NULL;
+    retained_size = 0;
+    block_count = 0;
+    size = song_end = 0;
+}
+
+size_t FileSource::read_at(size_t offset, uint8_t *dest, size_t count)
+{
+    size_t n = 0;
+
+    file_lock.lock();
+    if(fseek(file, offset, SEEK_SET) == 0) n = fread(dest, 1, count, file);
+    file_lock.unlock();
+    return n;
+}
+
+void FileSource::retain(size_t offset)
+{
+    if(file == NULL || offset >= song_end) return;
+    size_t count = song_end - offset < FILE_RETAIN_SIZE ? song_end - offset : FILE_RETAIN_SIZE;
+    if(retained == NULL) retained = (uint8_t *)malloc(FILE_RETAIN_SIZE);
+    if(retained == NULL || read_at(offset, retained, count) != count) return;
+
+    lock.lock();
+    retain_offset = offset;
+    retained_size = count;
+    // the prefetch may already be idle at the song end
+    if(next_read >= song_end && offset + count < song_end) {
+        next_read = offset + count;
+        space.signal();
+    }
+    lock.unlock();
+}
+
+void FileSource::prefetch_entry(void *self)
+{
+    ((FileSource *)self)->prefetch();
+}
+
+void FileSource::prefetch()
+{
+    lock.lock();
+    while(running) {
+        if(read_error || filled - consumed >= block_count || next_read >= size) {
+            lock.unlock();
+            space.wait();
+            lock.lock();
+            continue;
+        }
+        uint32_t seek_generation = generation;
+        size_t pos = next_read;
+        Block *block = &blocks[filled % block_count];
+        // back to block alignment after a seek or loop wrap
+        size_t count = FILE_BLOCK_SIZE - pos % FILE_BLOCK_SIZE;
+        if(count > size - pos) count = size - pos;
+        lock.unlock();
+
+        size_t n = read_at(pos, block->data, count);
+
+        lock.lock();
+        // the parser moved elsewhere while the card was busy
+        if(seek_generation != generation) continue;
+        if(n == 0) {
+            read_error = true;
+            data.signal();
+            continue;
+        }
+        block->offset = pos;
+        block->length = n;
+        filled++;
+        next_read = pos + n;
+        if(next_read >= song_end) {
+            // play order: the loop continues behind the retained copy
+            if(retained_size > 0 && retain_offset + retained_size < song_end) {
+                next_read = retain_offset + retained_size;
+            } else {
+                next_read = size;
+            }
+        }
+        data.signal();
+    }
+    lock.unlock();
+}
+
+// ring block holding offset, waits for the prefetch or restarts it there
+const FileSource::Block *FileSource::find(size_t offset)
+{
+    bool waited = false;
+
+    lock.lock();
+    for(;;) {
+        for(uint32_t seq = consumed; seq != filled; seq++) {
+            Block *block = &blocks[seq % block_count];
+            if(offset >= block->offset && offset - block->offset < block->length) {
+                // everything before it in play order is done with
+                if(seq != consumed) {
+                    consumed = seq;
+                    space.signal();
+                }
+                lock.unlock();
+                return block;
+            }
+        }
+        if(read_error) {
+            lock.unlock();
+            return NULL;
+        }
+        if(offset >= next_read && offset - next_read < (size_t)block_count * FILE_BLOCK_SIZE) {
+            // coming up next
+            if(consumed != filled) {
+                consumed = filled;
+                space.signal();
+            }
+        } else {
+            // seek
+            generation++;
+            consumed = filled;
+            next_read = offset - offset % FILE_BLOCK_SIZE;
+            space.signal();
+        }
+        if(!waited) {
+            underrun_count++;
+            waited = true;
+        }
+        lock.unlock();
+        data.wait();
+        lock.lock();
+    }
+}
+
+const uint8_t *FileSource::piece(size_t offset, size_t *available)
+{
+    if(retained_size > 0 && offset >= retain_offset && offset - retain_offset < retained_size) {
+        *available = retained_size - (offset - retain_offset);
+        return retained + (offset - retain_offset);
+    }
+    const Block *block = find(offset);
+    if(block == NULL) return NULL;
+    *available = block->length - (offset - block->offset);
+    return block->data + (offset - block->offset);
+}
+
+const uint8_t *FileSource::fetch(size_t offset, size_t count, size_t *available)
+{
+    size_t n, done = 0;
+    const uint8_t *p;
+
+    if(file == NULL || offset >= size) return NULL;
+    if(count > size - offset) count = size - offset;
+    p = piece(offset, &n);
+    if(p == NULL) return NULL;
+    if(n >= count) {
+        *available = n;
+        return p;
+    }
+    // straddles two blocks
+    for(;;) {
+        size_t m = n < count - done ? n : count - done;
+        memcpy(bounce + done, p, m);
+        done += m;
+        if(done == count) break;
+        p = piece(offset + done, &n);
+        if(p == NULL) return NULL;
+    }
+    *available = count;
+    return bounce;
+}
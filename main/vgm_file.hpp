@@ -0,0 +1,96 @@
+#ifndef VGM_FILE_HPP
+#define VGM_FILE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "vgm_source.hpp"
+#include "task.hpp"
+
+// read unit, a multiple of the SD sector size
+#define FILE_BLOCK_SIZE 4096
+#define FILE_BLOCKS_MIN 4
+#define FILE_BLOCKS_MAX 32
+// how far the read-ahead runs in front of the parser
+#define FILE_READ_AHEAD_MS 1000
+// copy of the loop start
+#define FILE_RETAIN_SIZE (2 * FILE_BLOCK_SIZE)
+
+//
+// Streaming file source for songs larger than the flash partition.
+//
+// A prefetch task reads blocks into a ring in the
+// order the song plays them, refilling a block as soon as the parser is
+// done with it. The ring holds about FILE_READ_AHEAD_MS of song data,
+// from the data rate in the VGM header, in blocks allocated one by one
+// from internal RAM; when that runs short the ring gets fewer of them.
+// Memory use is the ring and the retained loop start, whatever the file
+// size.
+//
+// After retain() the first bytes of the loop are kept in memory and the
+// prefetch continues behind them when it reaches the end of the song, so
+// a loop jump never waits for the card. Other seeks restart the prefetch
+// at the new position.
+//
+class FileSource : public VgmSource
+{
+public:
+    FileSource();
+    ~FileSource();
+
+    bool open(const char *path);
+    void close();
+
+    size_t length() const { return size; }
+    const uint8_t *fetch(size_t offset, size_t count, size_t *available);
+    void retain(size_t offset);
+
+    // parser had to wait for the card
+    uint32_t underruns() const { return underrun_count; }
+
+private:
+    FileSource(const FileSource &);
+    FileSource &operator=(const FileSource &);
+
+    struct Block
+    {
+        size_t offset;
+        size_t length;
+        uint8_t *data;
+    };
+
+    static void prefetch_entry(void *self);
+    void prefetch();
+    size_t read_at(size_t offset, uint8_t *dest, size_t count);
+    const uint8_t *piece(size_t offset, size_t *available);
+    const Block *find(size_t offset);
+
+    FILE *file;
+    size_t size;
+    size_t song_end;        // header EoF offset
+    uint8_t bounce[VGM_FETCH_MAX];
+
+    Block *blocks;
+    uint32_t block_count;
+
+    uint8_t *retained;
+    size_t retain_offset;
+    size_t retained_size;
+
+    // guarded by lock
+    Mutex lock;
+    uint32_t filled;        // blocks published (sequence number)
+    uint32_t consumed;      // first block the parser still uses
+    uint32_t generation;    // bumped on a seek, drops reads in flight
+    size_t next_read;
+    bool running;
+    bool read_error;
+    uint32_t underrun_count;
+
+    Mutex file_lock;
+    Event space;            // a block was released, or a seek
+    Event data;             // a block was published
+    Task task;
+};
+
+#endif
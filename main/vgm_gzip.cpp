@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include "vgm_gzip.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+// compressed bytes per inflate call, bounds the work of one step
+#define GZIP_INPUT_CHUNK 4096
+
+#define GZIP_FLAG_HCRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+
+#define RETAIN_NONE ((size_t)-1)
+
+static void *alloc_buffer(size_t size, bool spiram)
+{
+#ifdef ESP_PLATFORM
+    void *buffer = NULL;
+    if(spiram) buffer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if(buffer == NULL) buffer = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    return buffer;
+#else
+    (void)spiram;
+    return malloc(size);
+#endif
+}
+
+// offset of the deflate data behind the gzip header, 0 when it isn't one
+static size_t gzip_header_size(const uint8_t *p, size_t size)
+{
+    size_t pos = 10;
+
+    // header + empty deflate block + crc32 and size
+    if(size < 20 || p[0] != 0x1f || p[1] != 0x8b || p[2] != 8) return 0;
+    uint8_t flags = p[3];
+    if(flags & GZIP_FLAG_EXTRA) {
+        pos += 2 + (p[pos] | (p[pos + 1] << 8));
+    }
+    if(flags & GZIP_FLAG_NAME) {
+        while(pos < size && p[pos] != 0) pos++;
+        pos++;
+    }
+    if(flags & GZIP_FLAG_COMMENT) {
+        while(pos < size && p[pos] != 0) pos++;
+        pos++;
+    }
+    if(flags & GZIP_FLAG_HCRC) pos += 2;
+    if(pos >= size) return 0;
+    return pos;
+}
+
+GzipSource::GzipSource()
+    : in(NULL), in_size(0), in_pos(0), deflate_start(0),
+      ring(NULL), produced(0), finished(true), error(false), retain_offset(RETAIN_NONE)
+{
+    memset(&checkpoint, 0, sizeof(checkpoint));
+#ifdef ESP_PLATFORM
+    inflator = NULL;
+#else
+    memset(&stream, 0, sizeof(stream));
+    stream_init = false;
+#endif
+}
+
+GzipSource::~GzipSource()
+{
+    close();
+}
+
+bool GzipSource::detect(const uint8_t *data, size_t size)
+{
+    return data != NULL && gzip_header_size(data, size) != 0;
+}
+
+bool GzipSource::open(const uint8_t *data, size_t size)
+{
+    close();
+    deflate_start = gzip_header_size(data, size);
+    if(deflate_start == 0) return false;
+
+    // the ring is read for every command, keep it in internal RAM
+    ring = (uint8_t *)alloc_buffer(GZIP_RING_SIZE, false);
+#ifdef ESP_PLATFORM
+    inflator = (tinfl_decompressor *)alloc_buffer(sizeof(tinfl_decompressor), false);
+    if(ring == NULL || inflator == NULL) {
+        close();
+        return false;
+    }
+#else
+    if(ring == NULL || inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+        close();
+        return false;
+    }
+    stream_init = true;
+#endif
+    in = data;
+    in_size = size;
+    return restart();
+}
+
+void GzipSource::close()
+{
+    free(ring);
+    ring = NULL;
+#ifdef ESP_PLATFORM
+    free(inflator);
+    inflator = NULL;
+#else
+    if(stream_init) inflateEnd(&stream);
+    stream_init = false;
+    if(checkpoint.stream_init) inflateEnd(&checkpoint.stream);
+#endif
+    free(checkpoint.ring);
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    retain_offset = RETAIN_NONE;
+    in = NULL;
+    in_size = in_pos = 0;
+    produced = 0;
+    finished = true;
+    error = false;
+}
+
+size_t GzipSource::length() const
+{
+    return finished ? produced : (size_t)-1;
+}
+
+bool GzipSource::restart()
+{
+    produced = 0;
+    finished = false;
+    error = false;
+#ifdef ESP_PLATFORM
+    // tinfl inflates raw deflate, the gzip header is skipped by hand
+    in_pos = deflate_start;
+    tinfl_init(inflator);
+#else
+    in_pos = 0;
+    if(inflateReset(&stream) != Z_OK) {
+        finished = error = true;
+        return false;
+    }
+#endif
+    return true;
+}
+
+// inflate up to the end of the ring, at most GZIP_INPUT_CHUNK input bytes
+bool GzipSource::inflate_step()
+{
+    size_t before = produced;
+    size_t pos = produced & GZIP_RING_MASK;
+    size_t in_bytes = in_size - in_pos;
+    size_t out_bytes = GZIP_RING_SIZE - pos;
+
+    if(in_bytes > GZIP_INPUT_CHUNK) in_bytes = GZIP_INPUT_CHUNK;
+#ifdef ESP_PLATFORM
+    mz_uint32 flags = in_pos + in_bytes < in_size ? TINFL_FLAG_HAS_MORE_INPUT : 0;
+    // the ring is the dictionary, so output always runs to the ring end
+    tinfl_status status = tinfl_decompress(inflator, in + in_pos, &in_bytes, ring, ring + pos, &out_bytes, flags);
+    in_pos += in_bytes;
+    produced += out_bytes;
+    if(status == TINFL_STATUS_DONE) {
+        finished = true;
+    } else if(status < 0 || (status == TINFL_STATUS_NEEDS_MORE_INPUT && in_pos >= in_size)) {
+        finished = error = true;
+    }
+#else
+    stream.next_in = (Bytef *)(in + in_pos);
+    stream.avail_in = in_bytes;
+    stream.next_out = ring + pos;
+    stream.avail_out = out_bytes;
+    int status = inflate(&stream, Z_NO_FLUSH);
+    in_pos += in_bytes - stream.avail_in;
+    produced += out_bytes - stream.avail_out;
+    if(status == Z_STREAM_END) {
+        finished = true;
+    } else if(status != Z_OK && !(status == Z_BUF_ERROR && in_pos < in_size)) {
+        finished = error = true;
+    }
+#endif
+
+    if(retain_offset != RETAIN_NONE && !checkpoint.valid && before <= retain_offset && retain_offset < produced) {
+        save_checkpoint();
+    }
+    return !error;
+}
+
+// position the stream so offset can be inflated again
+bool GzipSource::rewind(size_t offset)
+{
+    if(checkpoint.valid) {
+        size_t held = checkpoint.produced < GZIP_RING_SIZE ? checkpoint.produced : GZIP_RING_SIZE;
+        if(offset >= checkpoint.produced - held) {
+            load_checkpoint();
+            return true;
+        }
+    }
+    return restart();
+}
+
+void GzipSource::retain(size_t offset)
+{
+    if(in == NULL) return;
+    if(checkpoint.ring == NULL) {
+#ifdef ESP_PLATFORM
+        checkpoint.ring = (uint8_t *)alloc_buffer(GZIP_RING_SIZE + sizeof(tinfl_decompressor), true);
+        if(checkpoint.ring == NULL) return;
+        checkpoint.inflator = (tinfl_decompressor *)(checkpoint.ring + GZIP_RING_SIZE);
+#else
+        checkpoint.ring = (uint8_t *)alloc_buffer(GZIP_RING_SIZE, true);
+        if(checkpoint.ring == NULL) return;
+#endif
+    }
+    retain_offset = offset;
+    checkpoint.valid = false;
+    // already in the ring
+    if(offset < produced && produced - offset <= GZIP_RING_SIZE) save_checkpoint();
+}
+
+void GzipSource::save_checkpoint()
+{
+    if(checkpoint.ring == NULL) return;
+#ifdef ESP_PLATFORM
+    *checkpoint.inflator = *inflator;
+#else
+    if(checkpoint.stream_init) inflateEnd(&checkpoint.stream);
+    checkpoint.stream_init = inflateCopy(&checkpoint.stream, &stream) == Z_OK;
+    if(!checkpoint.stream_init) return;
+#endif
+    memcpy(checkpoint.ring, ring, GZIP_RING_SIZE);
+    checkpoint.in_pos = in_pos;
+    checkpoint.produced = produced;
+    checkpoint.valid = true;
+}
+
+void GzipSource::load_checkpoint()
+{
+#ifdef ESP_PLATFORM
+    *inflator = *checkpoint.inflator;
+#else
+    inflateEnd(&stream);
+    stream_init = inflateCopy(&stream, &checkpoint.stream) == Z_OK;
+    if(!stream_init) {
+        finished = error = true;
+        return;
+    }
+#endif
+    memcpy(ring, checkpoint.ring, GZIP_RING_SIZE);
+    in_pos = checkpoint.in_pos;
+    produced = checkpoint.produced;
+    finished = false;
+    error = false;
+}
+
+void GzipSource::copy_out(uint8_t *dest, size_t offset, size_t count) const
+{
+    for(size_t i = 0; i < count; i++) {
+        dest[i] = ring[(offset + i) & GZIP_RING_MASK];
+    }
+}
+
+const uint8_t *GzipSource::fetch(size_t offset, size_t count, size_t *available)
+{
+    size_t pending = 0;
+
+    if(in == NULL) return NULL;
+    // behind the ring
+    if(offset < produced && produced - offset > GZIP_RING_SIZE) {
+        if(!rewind(offset)) return NULL;
+    }
+
+    while(produced < offset + count && !finished) {
+        // a step can run a whole lap of the ring, keep what was asked for
+        if(offset + pending < produced) {
+            copy_out(bounce + pending, offset + pending, produced - offset - pending);
+            pending = produced - offset;
+        }
+        inflate_step();
+    }
+    if(produced <= offset) return NULL;
+    if(produced < offset + count) count = produced - offset;
+
+    if(pending > 0) {
+        copy_out(bounce + pending, offset + pending, count - pending);
+        *available = count;
+        return bounce;
+    }
+
+    size_t contiguous = GZIP_RING_SIZE - (offset & GZIP_RING_MASK);
+    *available = produced - offset < contiguous ? produced - offset : contiguous;
+    if(*available < count) {
+        // straddles the ring end
+        copy_out(bounce, offset, count);
+        *available = count;
+        return bounce;
+    }
+    return ring + (offset & GZIP_RING_MASK);
+}
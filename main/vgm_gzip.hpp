@@ -0,0 +1,93 @@
+#ifndef VGM_GZIP_HPP
+#define VGM_GZIP_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vgm_source.hpp"
+
+#ifdef ESP_PLATFORM
+#include "rom/miniz.h"
+#else
+#include <zlib.h>
+#endif
+
+// deflate window, also the size of the output ring
+#define GZIP_RING_SIZE 32768
+#define GZIP_RING_MASK (GZIP_RING_SIZE - 1)
+
+//
+// Streaming .vgz source.
+//
+// The compressed image stays in flash (or a file mapping) and is inflated
+// on demand into a 32 KB ring, which doubles as the deflate dictionary, so
+// memory use doesn't depend on the song size. The device uses the tinfl
+// inflater in ROM, the host zlib.
+//
+// Reads behind the ring re-inflate from a checkpoint: retain() marks the
+// loop offset and the inflater state and ring are saved as the stream
+// passes it, so a loop jump costs one ring copy. Any other backward seek
+// restarts from the beginning of the stream.
+//
+class GzipSource : public VgmSource
+{
+public:
+    GzipSource();
+    ~GzipSource();
+
+    static bool detect(const uint8_t *data, size_t size);
+
+    bool open(const uint8_t *data, size_t size);
+    void close();
+
+    size_t length() const;
+    const uint8_t *fetch(size_t offset, size_t count, size_t *available);
+    void retain(size_t offset);
+
+private:
+    GzipSource(const GzipSource &);
+    GzipSource &operator=(const GzipSource &);
+
+    struct Checkpoint
+    {
+        bool valid;
+        size_t in_pos;
+        size_t produced;
+        uint8_t *ring;
+#ifdef ESP_PLATFORM
+        tinfl_decompressor *inflator;   // allocated behind ring
+#else
+        z_stream stream;
+        bool stream_init;
+#endif
+    };
+
+    bool restart();
+    bool inflate_step();
+    bool rewind(size_t offset);
+    void save_checkpoint();
+    void load_checkpoint();
+    void copy_out(uint8_t *dest, size_t offset, size_t count) const;
+
+    const uint8_t *in;
+    size_t in_size;
+    size_t in_pos;
+    size_t deflate_start;
+
+    uint8_t *ring;
+    size_t produced;
+    bool finished;
+    bool error;
+    uint8_t bounce[VGM_FETCH_MAX];
+
+    size_t retain_offset;
+    Checkpoint checkpoint;
+
+#ifdef ESP_PLATFORM
+    tinfl_decompressor *inflator;
+#else
+    z_stream stream;
+    bool stream_init;
+#endif
+};
+
+#endif
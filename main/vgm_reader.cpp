@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include "vgm_reader.hpp"
+#ifdef ESP_PLATFORM
+#include "esp_partition.h"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define VGM_HEADER_MIN 0x40
+
+// relative offset field to an absolute offset, 0 when unset or outside the image
+static uint32_t absolute_offset(const uint8_t *header, uint32_t field, size_t size)
+{
+    uint32_t rel = vgm_load32(header + field);
+    if(rel == 0 || rel >= size - field) return 0;
+    return field + rel;
+}
+
+// window of at least count bytes at the cursor
+bool VgmReader::refill(size_t count)
+{
+    size_t available;
+
+    if(size - cursor < count) return fail();
+    window = source->fetch(cursor, count, &available);
+    if(window == NULL || available < count) {
+        window = NULL;
+        window_size = 0;
+        return fail();
+    }
+    base = cursor;
+    window_size = available < size - cursor ? available : size - cursor;
+    return true;
+}
+
+const uint8_t *VgmReader::take_slow(size_t count)
+{
+    if(!refill(count)) return NULL;
+    cursor += count;
+    return window;
+}
+
+bool VgmReader::read(uint8_t *dest, size_t count)
+{
+    if(size - cursor < count) return fail();
+    while(count > 0) {
+        size_t offset = cursor - base;
+        if(offset >= window_size) {
+            if(!refill(1)) return false;
+            offset = 0;
+        }
+        size_t n = window_size - offset;
+        if(n > count) n = count;
+        memcpy(dest, window + offset, n);
+        dest += n;
+        cursor += n;
+        count -= n;
+    }
+    return true;
+}
+
+bool VgmReader::header(VgmHeader *header)
+{
+    uint8_t p[VGM_HEADER_MIN];
+
+    memset(header, 0, sizeof(*header));
+
+    if(!seek(0) || !read(p, VGM_HEADER_MIN) || memcmp(p, "Vgm ", 4) != 0) return false;
+
+    header->version = vgm_load32(p + 0x08);
+    // data starts at 0x40 before 1.50
+    header->data_offset = VGM_HEADER_MIN;
+    if(header->version >= 0x150) {
+        uint32_t data_offset = absolute_offset(p, 0x34, size);
+        if(data_offset != 0) header->data_offset = data_offset;
+    }
+    if(header->data_offset < VGM_HEADER_MIN || header->data_offset >= size) return false;
+
+    // a flash partition is larger than the song, trust the EoF offset when it fits
+    uint32_t eof = vgm_load32(p + 0x04);
+    header->eof_offset = (eof != 0 && eof <= size - 0x04) ? 0x04 + eof : size;
+    if(header->eof_offset <= header->data_offset) header->eof_offset = size;
+
+    header->clock_sn76489 = vgm_load32(p + 0x0c);
+    header->clock_ym2413 = vgm_load32(p + 0x10);
+    header->gd3_offset = absolute_offset(p, 0x14, size);
+    header->total_samples = vgm_load32(p + 0x18);
+    header->loop_offset = absolute_offset(p, 0x1c, size);
+    if(header->loop_offset < header->data_offset || header->loop_offset >= header->eof_offset) {
+        header->loop_offset = 0;
+    }
+    header->loop_samples = vgm_load32(p + 0x20);
+
+    if(header->version >= 0x101) header->rate = vgm_load32(p + 0x24);
+    if(header->version >= 0x110) {
+        header->sn76489_feedback = vgm_load16(p + 0x28);
+        header->sn76489_width = p[0x2a];
+        header->sn76489_flags = p[0x2b];
+        header->clock_ym2612 = vgm_load32(p + 0x2c);
+        header->clock_ym2151 = vgm_load32(p + 0x30);
+    } else {
+        // 1.01 and earlier drive every FM chip from the YM2413 clock
+        header->clock_ym2612 = header->clock_ym2413;
+        header->clock_ym2151 = header->clock_ym2413;
+    }
+
+    return true;
+}
+
+VgmMap::~VgmMap()
+{
+    unmap();
+}
+
+#ifdef ESP_PLATFORM
+
+bool VgmMap::map_partition()
+{
+    const esp_partition_t *part;
+    spi_flash_mmap_handle_t hrom;
+    const void *mapped;
+
+    unmap();
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_PHY, NULL);
+    if(part == NULL) {
+        printf("Couldn't find vgm part!\n");
+        return false;
+    }
+    if(esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &mapped, &hrom) != ESP_OK) {
+        printf("Couldn't map vgm part!\n");
+        return false;
+    }
+    printf("read vgm data @%p\n", mapped);
+
+    base = (const uint8_t *)mapped;
+    size = part->size;
+    handle = hrom;
+    return true;
+}
+
+void VgmMap::unmap()
+{
+    if(base == NULL) return;
+    spi_flash_munmap(handle);
+    base = NULL;
+    size = 0;
+}
+
+#else
+
+bool VgmMap::map_file(const char *path)
+{
+    struct stat st;
+    void *mapped;
+
+    unmap();
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        printf("Couldn't open %s\n", path);
+        return false;
+    }
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file referenced
+    close(fd);
+    if(mapped == MAP_FAILED) {
+        printf("Couldn't map %s\n", path);
+        return false;
+    }
+    // the parser walks forward, let the kernel read ahead
+    madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+    base = (const uint8_t *)mapped;
+    size = st.st_size;
+    return true;
+}
+
+void VgmMap::unmap()
+{
+    if(base == NULL) return;
+    munmap((void *)base, size);
+    base = NULL;
+    size = 0;
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef VGM_READER_HPP
+#define VGM_READER_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "vgm_source.hpp"
+
+//
+// Little endian loads from any address. memcpy keeps them legal on
+// unaligned flash/mmap pointers and compiles to plain loads where possible.
+//
+static inline uint16_t vgm_load16(const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap16(v);
+#endif
+    return v;
+}
+
+static inline uint32_t vgm_load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+//
+// Decoded VGM header. Offsets are absolute, 0 when the song has none.
+// Fields a short (old version) header doesn't have read as 0.
+//
+struct VgmHeader
+{
+    uint32_t eof_offset;
+    uint32_t version;
+    uint32_t clock_sn76489;
+    uint32_t clock_ym2413;
+    uint32_t gd3_offset;
+    uint32_t total_samples;
+    uint32_t loop_offset;
+    uint32_t loop_samples;
+    uint32_t rate;
+    uint16_t sn76489_feedback;
+    uint8_t sn76489_width;
+    uint8_t sn76489_flags;
+    uint32_t clock_ym2612;
+    uint32_t clock_ym2151;
+    uint32_t data_offset;
+};
+
+//
+// Cursor over a VGM image.
+//
+// Bytes are read from a window the source hands out, so the inline paths
+// are plain loads and only a window change calls into the source. Every
+// read is checked against the image: reading past the end returns 0 and
+// latches failed(), which the parser treats as the end of the song.
+// Readers don't own the bytes, any number of them can walk one memory
+// source at once (a streaming source serves one reader).
+//
+class VgmReader
+{
+public:
+    VgmReader() : source(NULL), window(NULL), base(0), window_size(0), size(0), cursor(0), overrun(false) {}
+    VgmReader(VgmSource *source) : source(source), window(NULL), base(0), window_size(0),
+        size(source->length()), cursor(0), overrun(false) {}
+    // image cut at size (the header EoF offset)
+    VgmReader(VgmSource *source, size_t size) : source(source), window(NULL), base(0), window_size(0),
+        size(size < source->length() ? size : source->length()), cursor(0), overrun(false) {}
+
+    // decode the header at the start of the image, leaves the cursor after it
+    bool header(VgmHeader *header);
+
+    size_t pos() const { return cursor; }
+    size_t length() const { return size; }
+    bool failed() const { return overrun; }
+
+    bool seek(size_t pos)
+    {
+        if(pos > size) return fail();
+        cursor = pos;
+        return true;
+    }
+
+    bool skip(size_t count)
+    {
+        if(size - cursor < count) return fail();
+        cursor += count;
+        return true;
+    }
+
+    uint8_t u8()
+    {
+        const uint8_t *p = take(1);
+        return p != NULL ? p[0] : 0;
+    }
+
+    uint16_t u16()
+    {
+        const uint8_t *p = take(2);
+        return p != NULL ? vgm_load16(p) : 0;
+    }
+
+    uint32_t u32()
+    {
+        const uint8_t *p = take(4);
+        return p != NULL ? vgm_load32(p) : 0;
+    }
+
+    // copy count bytes to dest
+    bool read(uint8_t *dest, size_t count);
+
+    // count bytes at the cursor that stay valid with the source (the cursor
+    // doesn't move), NULL when the source has no image in memory
+    const uint8_t *direct(size_t count) const
+    {
+        if(size - cursor < count) return NULL;
+        return source->direct(cursor, count);
+    }
+
+private:
+    // count bytes at the cursor, advancing past them
+    const uint8_t *take(size_t count)
+    {
+        size_t offset = cursor - base;
+        if(offset < window_size && window_size - offset >= count) {
+            cursor += count;
+            return window + offset;
+        }
+        return take_slow(count);
+    }
+
+    const uint8_t *take_slow(size_t count);
+    bool refill(size_t count);
+
+    bool fail()
+    {
+        overrun = true;
+        cursor = size;
+        return false;
+    }
+
+    VgmSource *source;
+    const uint8_t *window;
+    size_t base;
+    size_t window_size;
+    size_t size;
+    size_t cursor;
+    bool overrun;
+};
+
+//
+// Read-only mapping of a VGM image: the sound partition on the device,
+// a file on the host.
+//
+class VgmMap
+{
+public:
+    VgmMap() : base(NULL), size(0), handle(0) {}
+    ~VgmMap();
+
+#ifdef ESP_PLATFORM
+    bool map_partition();
+#else
+    bool map_file(const char *path);
+#endif
+    void unmap();
+
+    const uint8_t *data() const { return base; }
+    size_t length() const { return size; }
+
+private:
+    VgmMap(const VgmMap &);
+    VgmMap &operator=(const VgmMap &);
+
+    const uint8_t *base;
+    size_t size;
+    uint32_t handle;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef VGM_SOURCE_HPP
+#define VGM_SOURCE_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// largest count a reader passes to fetch() (one multi-byte field)
+#define VGM_FETCH_MAX 16
+
+//
+// Where a VgmReader gets its bytes from.
+//
+// A source hands out windows of the (uncompressed) VGM image. A memory
+// source returns the whole rest of the image as one window, a streaming
+// source only what it holds in its buffer.
+//
+class VgmSource
+{
+public:
+    virtual ~VgmSource() {}
+
+    // size of the image, SIZE_MAX while a stream doesn't know it yet
+    virtual size_t length() const = 0;
+
+    // Window starting at offset with at least count (<= VGM_FETCH_MAX) bytes,
+    // fewer only at the end of the image; *available is set to its size.
+    // NULL at or past the end. The window is valid until the next fetch().
+    virtual const uint8_t *fetch(size_t offset, size_t count, size_t *available) = 0;
+
+    // count bytes at offset that stay valid with the source, NULL unless the
+    // image is in memory
+    virtual const uint8_t *direct(size_t offset, size_t count)
+    {
+        (void)offset;
+        (void)count;
+        return NULL;
+    }
+
+    // the reader is going to seek back to offset (the loop point)
+    virtual void retain(size_t offset) { (void)offset; }
+};
+
+//
+// Image fully in memory: a flash partition or file mapping.
+//
+class MemorySource : public VgmSource
+{
+public:
+    MemorySource() : data(NULL), size(0) {}
+    MemorySource(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+    size_t length() const { return size; }
+
+    const uint8_t *fetch(size_t offset, size_t count, size_t *available)
+    {
+        (void)count;
+        if(offset >= size) return NULL;
+        *available = size - offset;
+        return data + offset;
+    }
+
+    const uint8_t *direct(size_t offset, size_t count)
+    {
+        if(offset > size || size - offset < count) return NULL;
+        return data + offset;
+    }
+
+private:
+    const uint8_t *data;
+    size_t size;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include "vgm_stream.hpp"
+#ifdef ESP_PLATFORM
+#include <esp_heap_caps.h>
+#endif
+
+// input task, on the one core of this build (CONFIG_FREERTOS_UNICORE);
+// above the renderer, it only wakes up when the UART has data
+#define STREAM_CORE 0
+#define STREAM_PRIORITY 3
+#define STREAM_STACK 3072
+
+StreamSource::StreamSource()
+    : fd(-1), ring(NULL), written(0), released(0), ended(true), running(false),
+      reader_waiting(false), consumer_waiting(false), underrun_count(0)
+{
+}
+
+StreamSource::~StreamSource()
+{
+    close();
+}
+
+bool StreamSource::open(int fd)
+{
+    close();
+    if(fd < 0) return false;
+#ifdef ESP_PLATFORM
+    ring = (uint8_t *)heap_caps_malloc(STREAM_RING_SIZE, MALLOC_CAP_8BIT);
+#else
+    ring = (uint8_t *)malloc(STREAM_RING_SIZE);
+#endif
+    if(ring == NULL) return false;
+
+    this->fd = fd;
+    written = released = 0;
+    ended = false;
+    reader_waiting = consumer_waiting = false;
+    underrun_count = 0;
+    running = true;
+    if(!task.start("vgm_stream", reader_entry, this, STREAM_CORE, STREAM_PRIORITY, STREAM_STACK)) {
+        running = false;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void StreamSource::close()
+{
+    lock.lock();
+    bool was_running = running;
+    running = false;
+    ended = true;
+    lock.unlock();
+    if(was_running) {
+        space.signal();
+        data.signal();
+        task.join();
+    }
+    free(ring);
+    ring = NULL;
+    fd = -1;
+}
+
+size_t StreamSource::length() const
+{
+    lock.lock();
+    size_t size = ended ? written : SIZE_MAX;
+    lock.unlock();
+    return size;
+}
+
+size_t StreamSource::received() const
+{
+    lock.lock();
+    size_t size = written;
+    lock.unlock();
+    return size;
+}
+
+void StreamSource::reader_entry(void *self)
+{
+    ((StreamSource *)self)->reader();
+}
+
+void StreamSource::reader()
+{
+    lock.lock();
+    while(running && !ended) {
+        // bytes skipped by the parser before they arrived are free as well
+        size_t used = written > released ? written - released : 0;
+        if(used >= STREAM_RING_SIZE) {
+            // backpressure: leave the rest in the sender's buffer
+            reader_waiting = true;
+            lock.unlock();
+            space.wait();
+            lock.lock();
+            continue;
+        }
+        size_t pos = written & (STREAM_RING_SIZE - 1);
+        size_t count = STREAM_RING_SIZE - used;
+        if(count > STREAM_RING_SIZE - pos) count = STREAM_RING_SIZE - pos;
+        if(count > STREAM_READ_MAX) count = STREAM_READ_MAX;
+        lock.unlock();
+
+        // wait with a timeout, so close() doesn't hang on a silent input
+        fd_set fds;
+        struct timeval timeout;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        timeout.tv_sec = 0;
+        timeout.tv_usec = STREAM_POLL_MS * 1000;
+        int ready = select(fd + 1, &fds, NULL, NULL, &timeout);
+        ssize_t n = 0;
+        if(ready > 0) n = read(fd, ring + pos, count);
+        int error = errno;
+
+        lock.lock();
+        if(ready == 0) continue;
+        if((ready < 0 || n < 0) && (error == EINTR || error == EAGAIN)) continue;
+        if(ready < 0 || n <= 0) {
+            // end of file, or the input went away
+            ended = true;
+        } else {
+            written += n;
+        }
+        if(consumer_waiting) {
+            consumer_waiting = false;
+            data.signal();
+        }
+    }
+    lock.unlock();
+}
+
+const uint8_t *StreamSource::fetch(size_t offset, size_t count, size_t *available)
+{
+    bool waited = false;
+    size_t n;
+
+    lock.lock();
+    // read once, front to back
+    if(ring == NULL || offset < released) {
+        lock.unlock();
+        return NULL;
+    }
+    if(offset > released) {
+        released = offset;
+        if(reader_waiting) {
+            reader_waiting = false;
+            space.signal();
+        }
+    }
+    while((written < offset || written - offset < count) && !ended) {
+        if(!waited) {
+            underrun_count++;
+            waited = true;
+        }
+        consumer_waiting = true;
+        lock.unlock();
+        data.wait();
+        lock.lock();
+    }
+    if(written <= offset) {
+        lock.unlock();
+        return NULL;
+    }
+    n = written - offset;
+    lock.unlock();
+
+    // the ring from offset up to written stays put until the next fetch
+    size_t pos = offset & (STREAM_RING_SIZE - 1);
+    size_t contiguous = STREAM_RING_SIZE - pos;
+    if(n <= contiguous || contiguous >= count) {
+        *available = n < contiguous ? n : contiguous;
+        return ring + pos;
+    }
+    // wraps around the ring end
+    if(count > n) count = n;
+    memcpy(bounce, ring + pos, contiguous);
+    memcpy(bounce + contiguous, ring, count - contiguous);
+    *available = count;
+    return bounce;
+}
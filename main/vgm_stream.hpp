@@ -0,0 +1,72 @@
+#ifndef VGM_STREAM_HPP
+#define VGM_STREAM_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include "vgm_source.hpp"
+#include "task.hpp"
+
+// bytes held between the input and the parser, a power of two
+#define STREAM_RING_SIZE (16 * 1024)
+#define STREAM_READ_MAX 1024
+// how often a blocked read looks at close()
+#define STREAM_POLL_MS 100
+
+//
+// Live VGM input from a file descriptor: stdin, a FIFO or a socket on the
+// host, a UART on the device.
+//
+// A reader task copies whatever arrives into a ring. The parser reads the
+// stream once, front to back; bytes before its last fetch are released.
+// When the ring is full the reader stops reading, so the sender blocks
+// (backpressure through the pipe, socket or UART buffer). A fetch past the
+// data received so far waits for it and counts an underrun. The image
+// ends, and length() becomes known, when the input reaches end of file.
+//
+// The stream can't seek backwards: no loop jump, no keyframes.
+//
+class StreamSource : public VgmSource
+{
+public:
+    StreamSource();
+    ~StreamSource();
+
+    // the source reads fd until end of file or close(), it doesn't close it
+    bool open(int fd);
+    void close();
+
+    size_t length() const;
+    const uint8_t *fetch(size_t offset, size_t count, size_t *available);
+
+    // parser had to wait for input
+    uint32_t underruns() const { return underrun_count; }
+    // input bytes so far
+    size_t received() const;
+
+private:
+    StreamSource(const StreamSource &);
+    StreamSource &operator=(const StreamSource &);
+
+    static void reader_entry(void *self);
+    void reader();
+
+    int fd;
+    uint8_t *ring;
+    uint8_t bounce[VGM_FETCH_MAX];
+
+    // guarded by lock
+    mutable Mutex lock;
+    size_t written;         // stream offset the ring is filled to
+    size_t released;        // the parser is done with everything before
+    bool ended;
+    bool running;
+    bool reader_waiting;
+    bool consumer_waiting;
+
+    uint32_t underrun_count;
+    Event space;            // the parser released bytes, or close()
+    Event data;             // bytes arrived, or the end
+    Task task;
+};
+
+#endif
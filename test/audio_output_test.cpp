@@ -0,0 +1,150 @@
+//
+// Host check of the block output path: rendered SN76489 blocks of varying
+// length go through audio_frames() into a HostOutput, which has to count
+// one write per block and every frame. The clipped frames are compared
+// with the render buffers, and a block write is timed against the old
+// one driver call per frame. dac_frames() is checked against known
+// offset binary values and on every block.
+//
+//   ./audio_output_test [seconds]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "audio_output.hpp"
+extern "C" {
+#include "sn76489.h"
+}
+
+#define SAMPLING_RATE 44100
+#define FRAME_SIZE_MAX 2048
+
+static unsigned int state = 1;
+
+static unsigned int next_random()
+{
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+static int clip(int sample)
+{
+    if(sample < -0x7fff) return -0x7fff;
+    if(sample > 0x7fff) return 0x7fff;
+    return sample;
+}
+
+// the DAC's offset binary: the sample plus 32768
+static uint32_t check_dac_values()
+{
+    static const int16_t samples[] = { -32768, -32767, -1, 0, 1, 0x7ffe, 0x7fff };
+    static const uint16_t expected[] = { 0x0000, 0x0001, 0x7fff, 0x8000, 0x8001, 0xfffe, 0xffff };
+    uint16_t dac[8];
+    uint32_t errors = 0;
+
+    // a frame is two samples, the odd one out is converted twice
+    for(size_t i = 0; i < 7; i++) {
+        int16_t frame[2] = { samples[i], samples[6 - i] };
+        dac_frames(frame, dac, 1);
+        if(dac[0] != expected[i] || dac[1] != expected[6 - i]) {
+            printf("FAIL: dac_frames(%d, %d) is 0x%04x, 0x%04x\n", samples[i], samples[6 - i], dac[0], dac[1]);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+static double elapsed_ms(clock_t start)
+{
+    return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t seconds = argc > 1 ? atoi(argv[1]) : 60;
+    uint64_t total = (uint64_t)seconds * SAMPLING_RATE;
+    int *buffer[2];
+    int16_t *frames;
+    HostOutput block_output;
+    HostOutput frame_output;
+    uint32_t blocks = 0;
+    uint64_t done = 0;
+    uint32_t errors = 0;
+    uint32_t clipped = 0;
+    uint32_t dac_errors;
+    uint16_t *dac;
+    clock_t start;
+    double block_ms, frame_ms;
+
+    buffer[0] = (int *)malloc(FRAME_SIZE_MAX * sizeof(int));
+    buffer[1] = (int *)malloc(FRAME_SIZE_MAX * sizeof(int));
+    frames = (int16_t *)malloc(FRAME_SIZE_MAX * 2 * sizeof(int16_t));
+    dac = (uint16_t *)malloc(FRAME_SIZE_MAX * 2 * sizeof(uint16_t));
+    dac_errors = check_dac_values();
+    SN76489_Context *psg = SN76489_Init(3579545, SAMPLING_RATE);
+    SN76489_Reset(psg);
+
+    block_output.open(SAMPLING_RATE);
+    frame_output.open(SAMPLING_RATE);
+    block_ms = frame_ms = 0;
+    while(done < total) {
+        uint32_t length = 1 + next_random() % FRAME_SIZE_MAX;
+        if(length > total - done) length = total - done;
+
+        // loud enough that some blocks clip after the gain below
+        for(int ch = 0; ch < 4; ch++) {
+            SN76489_Write(psg, 0x80 | (ch << 5) | (next_random() & 0x0f));
+            SN76489_Write(psg, next_random() & 0x3f);
+            SN76489_Write(psg, 0x90 | (ch << 5) | (next_random() % 4));
+        }
+        SN76489_Update(psg, buffer, length);
+        for(uint32_t i = 0; i < length; i++) {
+            buffer[0][i] *= 4;
+            buffer[1][i] *= 4;
+        }
+
+        audio_frames(buffer, frames, length);
+        for(uint32_t i = 0; i < length; i++) {
+            if(frames[i * 2] != clip(buffer[0][i]) || frames[i * 2 + 1] != clip(buffer[1][i])) errors++;
+            if(clip(buffer[0][i]) != buffer[0][i] || clip(buffer[1][i]) != buffer[1][i]) clipped++;
+        }
+        dac_frames(frames, dac, length);
+        for(uint32_t i = 0; i < length * 2; i++) {
+            if(dac[i] != frames[i] + 32768) dac_errors++;
+        }
+
+        start = clock();
+        block_output.write(frames, length);
+        block_ms += elapsed_ms(start);
+        start = clock();
+        for(uint32_t i = 0; i < length; i++) frame_output.write(frames + i * 2, 1);
+        frame_ms += elapsed_ms(start);
+
+        blocks++;
+        done += length;
+    }
+    block_output.close();
+    frame_output.close();
+
+    printf("%u blocks, %llu frames, %u clipped\n", blocks, (unsigned long long)done, clipped);
+    printf("block writes: %u calls, %.2f ms\n", block_output.writes(), block_ms);
+    printf("frame writes: %u calls, %.2f ms\n", frame_output.writes(), frame_ms);
+    if(block_output.writes() != blocks || block_output.frames() != total) {
+        printf("FAIL: block output counted %u writes, %llu frames\n", block_output.writes(),
+            (unsigned long long)block_output.frames());
+        errors++;
+    }
+    if(frame_output.writes() != total || frame_output.frames() != total) {
+        printf("FAIL: frame output counted %u writes\n", frame_output.writes());
+        errors++;
+    }
+    if(errors != 0) printf("FAIL: %u clipped frames differ\n", errors);
+    if(dac_errors != 0) printf("FAIL: %u DAC samples differ\n", dac_errors);
+
+    SN76489_Shutdown(psg);
+    free(dac);
+    free(frames);
+    free(buffer[0]);
+    free(buffer[1]);
+    return errors != 0 || dac_errors != 0 ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+//
+// Host stress test of AudioPipeline on std::thread: the main thread writes
+// numbered frames in random-sized pieces, a driver behind the output
+// thread checks that every frame arrives once and in order. The driver
+// stalls now and then, so both the full ring (renderer waits) and the
+// empty ring (output starves) are hit, at every depth from 1 to 8 and
+// again after set_depth(). Build with make -C test tsan to run it under
+// ThreadSanitizer.
+//
+//   ./audio_pipeline_test [frames per depth]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <chrono>
+#include "audio_pipeline.hpp"
+
+#define BLOCK_FRAMES 256
+
+static unsigned int state = 1;
+
+static unsigned int next_random()
+{
+    state = state * 1664525 + 1013904223;
+    return state >> 8;
+}
+
+// frame n is (n, ~n) in the low 16 bits
+class CheckOutput : public AudioOutput
+{
+public:
+    CheckOutput() : expected(0), errors(0), oversized(0), stalls(1) {}
+
+    bool open(uint32_t sample_rate) { (void)sample_rate; return true; }
+    void close() {}
+
+    void write(const int16_t *frames, size_t count)
+    {
+        if(count > BLOCK_FRAMES) oversized++;
+        for(size_t i = 0; i < count; i++) {
+            if(frames[i * 2] != (int16_t)expected || frames[i * 2 + 1] != (int16_t)~expected) errors++;
+            expected++;
+        }
+        write_count++;
+        frame_count += count;
+        // the output thread's own generator, so the main thread's stays unshared
+        stalls = stalls * 1103515245 + 12345;
+        if((stalls >> 16) % 8 == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    uint32_t expected;
+    uint32_t errors;
+    uint32_t oversized;
+
+private:
+    unsigned int stalls;
+};
+
+static bool run(AudioPipeline &pipeline, CheckOutput &check, uint32_t depth, uint32_t total)
+{
+    static int16_t frames[4096 * 2];
+    uint32_t done = 0;
+
+    check.expected = 0;
+    if(!pipeline.open(44100)) {
+        printf("depth %u: open fail\n", depth);
+        return false;
+    }
+    uint32_t writes = check.writes();
+    uint64_t written = check.frames();
+    while(done < total) {
+        uint32_t count = next_random() % 4096;
+        if(count > total - done) count = total - done;
+        for(uint32_t i = 0; i < count; i++) {
+            frames[i * 2] = (int16_t)(done + i);
+            frames[i * 2 + 1] = (int16_t)~(done + i);
+        }
+        pipeline.write(frames, count);
+        // the renderer sometimes falls behind too
+        if(next_random() % 64 == 0) std::this_thread::sleep_for(std::chrono::microseconds(500));
+        done += count;
+    }
+    pipeline.close();
+
+    // the last block goes out even when it isn't full
+    writes = check.writes() - writes;
+    written = check.frames() - written;
+    bool ok = check.errors == 0 && check.oversized == 0 && check.expected == total && written == total &&
+        writes == (total + BLOCK_FRAMES - 1) / BLOCK_FRAMES;
+    printf("depth %u: %llu frames, %u writes, %u starved %s\n", depth, (unsigned long long)written, writes,
+        pipeline.starved(), ok ? "ok" : "FAIL");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t total = argc > 1 ? atoi(argv[1]) : 1000000;
+    uint32_t failed = 0;
+
+    for(uint32_t depth = 1; depth <= 8; depth++) {
+        CheckOutput check;
+        AudioPipeline pipeline(&check, BLOCK_FRAMES, depth, 0, 5);
+        if(!run(pipeline, check, depth, total)) failed++;
+    }
+
+    // reopened with another depth, as the player does for live input
+    CheckOutput check;
+    AudioPipeline pipeline(&check, BLOCK_FRAMES, 8, 0, 5);
+    if(!run(pipeline, check, 8, total)) failed++;
+    pipeline.set_depth(2);
+    if(!run(pipeline, check, 2, total)) failed++;
+
+    if(failed != 0) printf("FAIL: %u runs\n", failed);
+    return failed != 0 ? 1 : 0;
+}
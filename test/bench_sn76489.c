@@ -0,0 +1,111 @@
+/*
+	bench_sn76489.c
+	Host timing of SN76489_Update: 300 s of 60 Hz PSG writes rendered in
+	735-sample blocks, best of several runs per scenario. Built twice by
+	the Makefile, with the vector kernel and with -DSN76489_NO_SIMD (the
+	scalar loops the ESP32 runs), so the two can be compared.
+
+	./bench_sn76489 [runs]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "sn76489.h"
+
+#define BENCH_CLOCK     3579545
+#define BENCH_RATE      44100
+#define BENCH_BLOCK     735
+#define BENCH_FRAMES    (60 * 300)
+
+static const char *scenarios[] = {
+	"three tones + quiet noise",
+	"low tones",
+	"panned",
+	"one audible tone",
+};
+
+static unsigned int bench_state;
+
+static unsigned int bench_rand(void)
+{
+	bench_state = bench_state * 1664525 + 1013904223;
+	return bench_state >> 8;
+}
+
+/* ms for one run, checksum of the output in *sum */
+static double bench_run(int scenario, long long *sum)
+{
+	static int left[BENCH_BLOCK], right[BENCH_BLOCK];
+	int *buffer[2] = { left, right };
+	SN76489_Context *chip;
+	clock_t start;
+	int frame, ch, period, volume;
+
+	bench_state = 12345;
+	*sum = 0;
+	chip = SN76489_Init(BENCH_CLOCK, BENCH_RATE);
+	SN76489_Reset(chip);
+	if (scenario == 2)
+		SN76489_SetPanning(chip, -80, 40, 0, 120);
+
+	start = clock();
+	for (frame = 0; frame < BENCH_FRAMES; frame++)
+	{
+		if (frame % 8 == 0)
+		{
+			for (ch = 0; ch < 3; ch++)
+			{
+				period = scenario == 1 ? 0x300 + bench_rand() % 0xff : 0x40 + bench_rand() % 0x3c0;
+				SN76489_Write(chip, 0x80 | (ch << 5) | (period & 0xf));
+				SN76489_Write(chip, period >> 4);
+			}
+		}
+		for (ch = 0; ch < 4; ch++)
+		{
+			if (scenario == 3)
+				volume = ch == 0 ? 2 : 0xf;
+			else if (ch == 3)
+				volume = 0xf - (frame % 32 < 4 ? 8 : 0);
+			else
+				volume = bench_rand() % 6;
+			SN76489_Write(chip, 0x90 | (ch << 5) | volume);
+		}
+		if (frame % 32 == 0)
+			SN76489_Write(chip, 0xe4 | (bench_rand() & 3));
+
+		SN76489_Update(chip, buffer, BENCH_BLOCK);
+		*sum += left[100] + right[700];
+	}
+	start = clock() - start;
+
+	SN76489_Shutdown(chip);
+	return start * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char **argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 15;
+	int scenario, run;
+	double ms, best;
+	long long sum = 0;
+
+#ifdef SN76489_NO_SIMD
+	printf("sn76489 scalar kernel, best of %d:\n", runs);
+#else
+	printf("sn76489 vector kernel, best of %d:\n", runs);
+#endif
+	for (scenario = 0; scenario < 4; scenario++)
+	{
+		best = 0;
+		for (run = 0; run < runs; run++)
+		{
+			ms = bench_run(scenario, &sum);
+			if (run == 0 || ms < best)
+				best = ms;
+		}
+		printf("  %-26s %7.1f ms for 300 s (%.2f ns/sample), check %lld\n",
+			scenarios[scenario], best, best * 1e6 / ((double)BENCH_RATE * 300), sum);
+	}
+	return 0;
+}
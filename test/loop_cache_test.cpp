@@ -0,0 +1,181 @@
+//
+// Host check of the loop cache on a looping PSG+FM song, built here as a
+// list of timed chip writes: an FM note and PSG tones with software
+// volume decays and a noise burst, all silent again before the loop
+// ends. The loop is not a whole number of tone periods long, so the PSG
+// counters and the clock fraction differ at every loop start. The
+// chip state hash of main.cpp is read there, and the cache has to take
+// over from the second pass of the loop. In a second run a PSG tone is held over the
+// loop point, whose phase can be heard, and the cache must not engage.
+//
+//   ./loop_cache_test
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include "loop_cache.hpp"
+#include "audio_output.hpp"
+extern "C" {
+#include "sn76489.h"
+#include "statehash.h"
+}
+#include "ym2612.hpp"
+
+#define SAMPLING_RATE 44100
+#define FRAME_SIZE_MAX 2048
+#define LOOP_SAMPLES (2 * SAMPLING_RATE + 37)
+#define PASSES 4
+
+enum { PSG, FM0, FM1 };
+
+struct Write
+{
+    uint32_t time;
+    uint8_t chip;
+    uint8_t reg;
+    uint8_t data;
+};
+
+static Write song[512];
+static uint32_t song_length;
+
+static void add(uint32_t time, uint8_t chip, uint8_t reg, uint8_t data)
+{
+    Write &w = song[song_length++];
+    w.time = time;
+    w.chip = chip;
+    w.reg = reg;
+    w.data = data;
+}
+
+static void psg(uint32_t time, uint8_t data)
+{
+    add(time, PSG, 0, data);
+}
+
+static void psg_tone(uint32_t time, int ch, int period, int volume)
+{
+    psg(time, 0x80 | (ch << 5) | (period & 0x0f));
+    psg(time, (period >> 4) & 0x3f);
+    psg(time, 0x90 | (ch << 5) | volume);
+}
+
+// one volume step every 1/60 s down to silence
+static void psg_decay(uint32_t time, int ch, int volume)
+{
+    for(; volume <= 0x0f; volume++, time += SAMPLING_RATE / 60) psg(time, 0x90 | (ch << 5) | volume);
+}
+
+// loop body, times relative to the loop start
+static void build_song(bool held_tone)
+{
+    song_length = 0;
+    // FM channel 1: algorithm 7, fast release, no LFO
+    add(0, FM0, 0x22, 0x00);
+    add(0, FM0, 0x27, 0x00);
+    add(0, FM0, 0xb0, 0x07);
+    add(0, FM0, 0xb4, 0xc0);
+    for(int slot = 0; slot < 4; slot++) {
+        add(0, FM0, 0x30 + slot * 4, 0x01);
+        add(0, FM0, 0x40 + slot * 4, 0x28);
+        add(0, FM0, 0x50 + slot * 4, 0x1f);
+        add(0, FM0, 0x60 + slot * 4, 0x05);
+        add(0, FM0, 0x70 + slot * 4, 0x02);
+        add(0, FM0, 0x80 + slot * 4, 0x1f);
+    }
+    add(0, FM0, 0xa4, 0x22);
+    add(0, FM0, 0xa0, 0x69);
+    add(0, FM0, 0x28, 0xf0);
+    add(SAMPLING_RATE / 2, FM0, 0x28, 0x00);
+
+    // PSG melody and a noise burst
+    psg_tone(0, 0, 0x1fd, 2);
+    psg_decay(SAMPLING_RATE / 4, 0, 3);
+    psg_tone(SAMPLING_RATE / 2, 1, 0x0e3, 1);
+    psg_decay(SAMPLING_RATE, 1, 2);
+    psg(SAMPLING_RATE / 3, 0xe5);
+    psg(SAMPLING_RATE / 3, 0xf4);
+    psg_decay(SAMPLING_RATE / 3 + SAMPLING_RATE / 10, 3, 5);
+    if(held_tone) psg_tone(0, 2, 0x0b7, 6);
+}
+
+static void write_chip(const Write &w, SN76489_Context *chip)
+{
+    if(w.chip == PSG) {
+        SN76489_Write(chip, w.data);
+    } else {
+        YM2612_Write(w.chip == FM0 ? 0 : 2, w.reg);
+        YM2612_Write(w.chip == FM0 ? 1 : 3, w.data);
+    }
+}
+
+// the player's chip_state_hash() without a DAC stream
+static uint64_t chip_state_hash(SN76489_Context *chip)
+{
+    return statehash_combine(YM2612_GetStateHash(), SN76489_GetStateHash(chip));
+}
+
+// returns the pass the cache took over at, 0 when it didn't. pass 0 is the
+// intro, which leaves the registers as the loop end does
+static int play(bool held_tone)
+{
+    static int left[FRAME_SIZE_MAX], right[FRAME_SIZE_MAX];
+    static int16_t frames[FRAME_SIZE_MAX * 2];
+    int *buffer[2] = { left, right };
+    LoopCache cache(16 * 1024 * 1024, true);
+    int hit = 0;
+
+    build_song(held_tone);
+    SN76489_Context *chip = SN76489_Init(3579545, SAMPLING_RATE);
+    SN76489_Reset(chip);
+    YM2612_Init(7670453, SAMPLING_RATE, 0);
+    // what the song pre-scan sets without AMS/FMS
+    LFO_Modulation = 0;
+
+    for(int pass = 0; pass < PASSES && hit == 0; pass++) {
+        if(pass > 0 && cache.loop_point(chip_state_hash(chip))) {
+            hit = pass;
+            break;
+        }
+        uint32_t time = 0;
+        while(time < LOOP_SAMPLES) {
+            // the writes are in time order per helper, not overall
+            uint32_t until = LOOP_SAMPLES;
+            for(uint32_t i = 0; i < song_length; i++) {
+                if(song[i].time == time) write_chip(song[i], chip);
+                if(song[i].time > time && song[i].time < until) until = song[i].time;
+            }
+            uint32_t length = until - time;
+            if(length > FRAME_SIZE_MAX) length = FRAME_SIZE_MAX;
+            SN76489_Update(chip, buffer, length);
+            YM2612_Update(buffer, length);
+            audio_frames(buffer, frames, length);
+            cache.record(frames, length);
+            time += length;
+        }
+    }
+
+    LFO_Modulation = 1;
+    YM2612_End();
+    SN76489_Shutdown(chip);
+    return hit;
+}
+
+int main()
+{
+    int errors = 0;
+
+    int hit = play(false);
+    printf("PSG+FM loop: %s\n", hit ? "cached" : "synthesised");
+    if(hit != 2) {
+        printf("FAIL: the cache took over at pass %d, not at the second loop pass\n", hit);
+        errors++;
+    }
+
+    hit = play(true);
+    printf("PSG tone held over the loop point: %s\n", hit ? "cached" : "synthesised");
+    if(hit != 0) {
+        printf("FAIL: the cache took over at pass %d\n", hit);
+        errors++;
+    }
+    return errors != 0 ? 1 : 0;
+}
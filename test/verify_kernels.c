@@ -0,0 +1,38 @@
+/*
+	verify_kernels.c
+	Host driver for synth_verify.c: runs the differential kernel checks
+	over a fixed set of seeds, exits 1 on any mismatch.
+
+	./verify_kernels [seed]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "synth_verify.h"
+
+static const unsigned int seeds[] = { 1, 0x5eed, 0x12345678, 0xdeadbeef };
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int errors = 0;
+
+	if (argc > 1)
+	{
+		unsigned int seed = strtoul(argv[1], NULL, 0);
+		errors += synth_verify_sn76489(seed, 2000);
+		errors += synth_verify_ym2612(seed, 400);
+	}
+	else
+	{
+		for (i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++)
+		{
+			printf("seed %#x\n", seeds[i]);
+			errors += synth_verify_sn76489(seeds[i], 2000);
+			errors += synth_verify_ym2612(seeds[i], 400);
+		}
+	}
+
+	printf("%s: %d mismatches\n", errors ? "FAIL" : "ok", errors);
+	return errors ? 1 : 0;
+}
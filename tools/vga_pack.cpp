@@ -0,0 +1,134 @@
+//
+// Packs VGM/VGZ/VGC files into one VGA image for the sound partition
+// (see main/song_archive.hpp).
+//
+//   cd tools
+//   g++ -O2 -I../main -o vga_pack vga_pack.cpp ../main/vgm_reader.cpp
+//       ../main/vgm_gzip.cpp -lz
+//   ./vga_pack sound.vga song1.vgm song2.vgz song3.vgc
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "vgm_reader.hpp"
+#include "vgm_gzip.hpp"
+#include "vgc_format.hpp"
+#include "song_archive.hpp"
+
+// sound partition in partitions.csv
+#define PARTITION_SIZE 0x1ef000
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+// file name without directory and extension
+static void song_name(const char *path, char *name)
+{
+    const char *base = strrchr(path, '/');
+    base = base != NULL ? base + 1 : path;
+    size_t length = strlen(base);
+    const char *dot = strrchr(base, '.');
+    if(dot != NULL && dot != base) length = dot - base;
+    if(length > ARCHIVE_NAME_SIZE) length = ARCHIVE_NAME_SIZE;
+    memset(name, 0, ARCHIVE_NAME_SIZE);
+    memcpy(name, base, length);
+}
+
+// the header fields of the directory entry
+static bool describe(const char *path, const uint8_t *data, size_t size, uint8_t *entry)
+{
+    VgcHeader vgc;
+    VgmHeader header;
+    GzipSource gzip;
+    MemorySource memory;
+    VgmSource *source;
+    uint32_t format;
+
+    if(vgc_header(data, size, &vgc)) {
+        put32(entry + 0x08, ARCHIVE_VGC);
+        put32(entry + 0x0c, vgc.total_samples);
+        put32(entry + 0x10, vgc.loop_samples);
+        put32(entry + 0x14, vgc.clock_sn76489);
+        put32(entry + 0x18, vgc.clock_ym2612);
+        return true;
+    }
+    if(GzipSource::detect(data, size) && gzip.open(data, size)) {
+        source = &gzip;
+        format = ARCHIVE_VGZ;
+    } else {
+        memory = MemorySource(data, size);
+        source = &memory;
+        format = ARCHIVE_VGM;
+    }
+    VgmReader reader(source);
+    if(!reader.header(&header)) {
+        fprintf(stderr, "%s: not a vgm, vgz or vgc file\n", path);
+        return false;
+    }
+    put32(entry + 0x08, format);
+    put32(entry + 0x0c, header.total_samples);
+    put32(entry + 0x10, header.loop_offset != 0 ? header.loop_samples : 0);
+    put32(entry + 0x14, header.clock_sn76489 != 0 ? header.clock_sn76489 : 3579545);
+    put32(entry + 0x18, header.clock_ym2612 != 0 ? header.clock_ym2612 : 7670453);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3) {
+        fprintf(stderr, "usage: %s output.vga input.vgm|vgz|vgc...\n", argv[0]);
+        return 1;
+    }
+    uint32_t count = argc - 2;
+    size_t directory = ARCHIVE_HEADER_SIZE + count * ARCHIVE_ENTRY_SIZE;
+    std::vector<uint8_t> image((directory + ARCHIVE_ALIGN - 1) & ~(size_t)(ARCHIVE_ALIGN - 1), 0);
+
+    memcpy(&image[0], "Vga ", 4);
+    put32(&image[0x04], ARCHIVE_VERSION);
+    put32(&image[0x08], count);
+    put32(&image[0x0c], ARCHIVE_ENTRY_SIZE);
+
+    for(uint32_t i = 0; i < count; i++) {
+        const char *path = argv[i + 2];
+        VgmMap map;
+        uint8_t entry[ARCHIVE_ENTRY_SIZE];
+
+        if(!map.map_file(path)) return 1;
+        memset(entry, 0, sizeof(entry));
+        if(!describe(path, map.data(), map.length(), entry)) return 1;
+        put32(entry + 0x00, image.size());
+        put32(entry + 0x04, map.length());
+        song_name(path, (char *)entry + 0x1c);
+        memcpy(&image[ARCHIVE_HEADER_SIZE + i * ARCHIVE_ENTRY_SIZE], entry, sizeof(entry));
+
+        // every song starts on a sector of its own
+        image.insert(image.end(), map.data(), map.data() + map.length());
+        image.resize((image.size() + ARCHIVE_ALIGN - 1) & ~(size_t)(ARCHIVE_ALIGN - 1), 0);
+        printf("%3u %s: %u byte\n", i, path, (uint32_t)map.length());
+    }
+
+    FILE *file = fopen(argv[1], "wb");
+    if(file == NULL) {
+        fprintf(stderr, "%s: can't create\n", argv[1]);
+        return 1;
+    }
+    bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+    ok = fclose(file) == 0 && ok;
+    if(!ok) {
+        fprintf(stderr, "%s: write error\n", argv[1]);
+        return 1;
+    }
+
+    printf("%s: %u songs, %u byte\n", argv[1], count, (uint32_t)image.size());
+    if(image.size() > PARTITION_SIZE) {
+        fprintf(stderr, "%s: larger than the sound partition (%u byte)\n", argv[1], PARTITION_SIZE);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,315 @@
+//
+// Compiles a VGM/VGZ file into the VGC image the player reads from flash
+// (see main/vgc_format.hpp).
+//
+//   cd tools
+//   g++ -O2 -I../main -o vgc_compile vgc_compile.cpp ../main/vgm_reader.cpp
+//       ../main/vgm_gzip.cpp ../main/vgm_command.cpp ../main/pcm_bank.cpp -lz
+//   ./vgc_compile song.vgz song.vgc
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "vgm_reader.hpp"
+#include "vgm_gzip.hpp"
+#include "vgm_command.hpp"
+#include "pcm_bank.hpp"
+#include "vgc_format.hpp"
+
+// every PCM page is decoded once while flattening
+#define FLATTEN_CACHE_PAGES 1
+
+// YM2612 registers the chip doesn't act on when written with the same value
+// (the same test as YM2612_Write), and the LFO / DAC enable pure state
+static bool ym2612_shadowed(int port, uint8_t reg)
+{
+    if(reg >= 0x30) return true;
+    return port == 0 && (reg == 0x22 || reg == 0x2b);
+}
+
+class Compiler
+{
+public:
+    Compiler() : dropped(0), writes(0), skipped(0),
+        group_op(0), group_count(0), group_at(0), wait(0), dac_pending(false)
+    {
+        invalidate();
+    }
+
+    void ym2612(int port, uint8_t reg, uint8_t data)
+    {
+        writes++;
+        // part 2 has no registers below 0x30
+        if(port == 1 && reg < 0x30) {
+            dropped++;
+            return;
+        }
+        if(ym2612_shadowed(port, reg)) {
+            if(shadow[port][reg] == data) {
+                dropped++;
+                return;
+            }
+            shadow[port][reg] = data;
+        }
+        uint8_t bytes[2] = { reg, data };
+        group(port == 0 ? VGC_YM2612_PORT0 : VGC_YM2612_PORT1, bytes, 2);
+    }
+
+    void sn76489(uint8_t data)
+    {
+        writes++;
+        group(VGC_SN76489, &data, 1);
+    }
+
+    void gg_stereo(uint8_t data)
+    {
+        flush();
+        out.push_back(VGC_GG_STEREO);
+        out.push_back(data);
+    }
+
+    void dac()
+    {
+        flush();
+        dac_pending = true;
+    }
+
+    void pcm_seek(uint32_t offset)
+    {
+        flush();
+        out.push_back(VGC_PCM_SEEK);
+        for(int i = 0; i < 4; i++) out.push_back(offset >> (i * 8));
+    }
+
+    void delay(uint32_t samples)
+    {
+        flush_group();
+        wait += samples;
+    }
+
+    // the loop starts here, on the second pass the chip state differs
+    size_t mark_loop()
+    {
+        flush();
+        invalidate();
+        return out.size();
+    }
+
+    void finish()
+    {
+        flush();
+        out.push_back(VGC_END);
+    }
+
+    std::vector<uint8_t> out;
+    uint32_t dropped;
+    uint32_t writes;
+    uint32_t skipped;
+
+private:
+    void invalidate()
+    {
+        // unknown, no register value matches
+        for(int port = 0; port < 2; port++) {
+            for(int reg = 0; reg < 256; reg++) shadow[port][reg] = -1;
+        }
+    }
+
+    void group(uint8_t op, const uint8_t *bytes, int count)
+    {
+        if(wait > 0 || dac_pending) flush_wait();
+        if(group_count > 0 && (group_op != op || group_count == VGC_GROUP_MAX)) flush_group();
+        if(group_count == 0) {
+            group_op = op;
+            group_at = out.size();
+            out.push_back(op);
+        }
+        out.insert(out.end(), bytes, bytes + count);
+        group_count++;
+        out[group_at] = group_op | (group_count - 1);
+    }
+
+    void flush_group()
+    {
+        group_count = 0;
+    }
+
+    void flush_wait()
+    {
+        if(dac_pending) {
+            uint32_t n = wait < VGC_DAC_WAIT_MAX ? wait : VGC_DAC_WAIT_MAX;
+            out.push_back(VGC_DAC | n);
+            wait -= n;
+            dac_pending = false;
+        }
+        while(wait > 0) {
+            if(wait <= VGC_WAIT_SHORT_MAX) {
+                out.push_back(VGC_WAIT | (wait - 1));
+                wait = 0;
+            } else {
+                uint32_t n = wait < 0xffff ? wait : 0xffff;
+                out.push_back(VGC_WAIT16);
+                out.push_back(n & 0xff);
+                out.push_back(n >> 8);
+                wait -= n;
+            }
+        }
+    }
+
+    void flush()
+    {
+        flush_group();
+        flush_wait();
+    }
+
+    int shadow[2][256];
+    uint8_t group_op;
+    uint32_t group_count;
+    size_t group_at;
+    uint32_t wait;
+    bool dac_pending;
+};
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    for(int i = 0; i < 4; i++) p[i] = v >> (i * 8);
+}
+
+// YM2612 PCM blocks and the decompression table, the rest isn't played
+static void add_data_block(PcmBank &bank, VgmReader &reader, uint8_t type, uint32_t size)
+{
+    if(type == 0x00 || type == 0x40 || type == 0x7f) {
+        bank.add(reader, type, size);
+    } else {
+        reader.skip(size);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    VgmMap map;
+    MemorySource memory;
+    GzipSource gzip;
+    VgmSource *source;
+    VgmHeader header;
+    PcmBank bank(FLATTEN_CACHE_PAGES);
+    Compiler compiler;
+    long loop = -1;
+    uint8_t command, type;
+    uint32_t size;
+
+    if(argc != 3) {
+        fprintf(stderr, "usage: %s input.vgm|vgz output.vgc\n", argv[0]);
+        return 1;
+    }
+    if(!map.map_file(argv[1])) return 1;
+    if(GzipSource::detect(map.data(), map.length()) && gzip.open(map.data(), map.length())) {
+        source = &gzip;
+    } else {
+        memory = MemorySource(map.data(), map.length());
+        source = &memory;
+    }
+
+    VgmReader reader(source);
+    if(!reader.header(&header)) {
+        fprintf(stderr, "%s: not a vgm file\n", argv[1]);
+        return 1;
+    }
+    reader = VgmReader(source, header.eof_offset);
+    reader.seek(header.data_offset);
+
+    // one pass in stream order, the loop is a marker in the events
+    while(!reader.failed()) {
+        if(header.loop_offset != 0 && reader.pos() == header.loop_offset) loop = (long)compiler.mark_loop();
+        command = reader.u8();
+        if(reader.failed() || command == 0x66) break;
+        switch(command) {
+            case 0x4f:
+                compiler.gg_stereo(reader.u8());
+                break;
+            case 0x50:
+                compiler.sn76489(reader.u8());
+                break;
+            case 0x52:
+            case 0x53: {
+                uint8_t reg = reader.u8();
+                compiler.ym2612(command & 1, reg, reader.u8());
+                break;
+            }
+            case 0x61:
+                compiler.delay(reader.u16());
+                break;
+            case 0x62:
+                compiler.delay(735);
+                break;
+            case 0x63:
+                compiler.delay(882);
+                break;
+            case 0x67:
+                reader.u8();
+                type = reader.u8();
+                size = reader.u32();
+                add_data_block(bank, reader, type, size);
+                break;
+            case 0xe0:
+                compiler.pcm_seek(reader.u32());
+                break;
+            default:
+                if(command >= 0x70 && command <= 0x7f) {
+                    compiler.delay((command & 0x0f) + 1);
+                } else if(command >= 0x80 && command <= 0x8f) {
+                    compiler.dac();
+                    compiler.delay(command & 0x0f);
+                } else {
+                    // chips the player doesn't emulate
+                    reader.skip(vgm_command_size(command, header.version) - 1);
+                    compiler.skipped++;
+                }
+                break;
+        }
+    }
+    compiler.finish();
+
+    // PCM decoded into one region, the player reads it with a plain index
+    std::vector<uint8_t> pcm(bank.size());
+    for(uint32_t i = 0; i < bank.size(); i++) pcm[i] = bank.read(i);
+
+    uint8_t head[VGC_HEADER_SIZE];
+    uint32_t events_offset = VGC_HEADER_SIZE;
+    uint32_t pcm_offset = (events_offset + compiler.out.size() + 3) & ~3;
+    memset(head, 0, sizeof(head));
+    memcpy(head, "Vgc ", 4);
+    put32(head + 0x04, VGC_VERSION);
+    put32(head + 0x08, header.clock_sn76489 != 0 ? header.clock_sn76489 : 3579545);
+    put32(head + 0x0c, header.clock_ym2612 != 0 ? header.clock_ym2612 : 7670453);
+    put32(head + 0x10, header.total_samples);
+    put32(head + 0x14, loop >= 0 ? header.loop_samples : 0);
+    put32(head + 0x18, events_offset);
+    put32(head + 0x1c, compiler.out.size());
+    put32(head + 0x20, loop >= 0 ? events_offset + (uint32_t)loop : 0);
+    put32(head + 0x24, pcm_offset);
+    put32(head + 0x28, pcm.size());
+
+    FILE *file = fopen(argv[2], "wb");
+    if(file == NULL) {
+        fprintf(stderr, "%s: can't create\n", argv[2]);
+        return 1;
+    }
+    static const uint8_t pad[4] = { 0 };
+    bool ok = fwrite(head, 1, sizeof(head), file) == sizeof(head);
+    ok = ok && fwrite(compiler.out.data(), 1, compiler.out.size(), file) == compiler.out.size();
+    ok = ok && fwrite(pad, 1, pcm_offset - events_offset - compiler.out.size(), file) == pcm_offset - events_offset - compiler.out.size();
+    ok = ok && fwrite(pcm.data(), 1, pcm.size(), file) == pcm.size();
+    ok = fclose(file) == 0 && ok;
+    if(!ok) {
+        fprintf(stderr, "%s: write error\n", argv[2]);
+        return 1;
+    }
+
+    printf("%s: %u writes, %u redundant dropped, %u other chip commands skipped\n",
+        argv[2], compiler.writes, compiler.dropped, compiler.skipped);
+    printf("events %u byte, pcm %u byte, vgm data %u byte\n",
+        (uint32_t)compiler.out.size(), (uint32_t)pcm.size(), header.eof_offset - header.data_offset);
+    return 0;
+}